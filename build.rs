@@ -6,19 +6,22 @@ fn main() {
     let crate_dir = env::var("CARGO_MANIFEST_DIR").unwrap();
     cbindgen::Builder::new()
         .with_crate(crate_dir)
+        .with_pragma_once(true)
         .generate()
         .expect("Unable to generate bindings")
         .write_to_file("vst3-wrapper/source/bindings.h");
 
-    println!("cargo:rustc-link-lib=ole32");
+    let windows = env::var("CARGO_CFG_TARGET_OS").unwrap() == "windows";
 
-    let dst = Config::new("vst3-wrapper")
+    let build = Config::new("vst3-wrapper")
         .build_target("vst3wrapper")
         .profile("Release")
         .no_default_flags(true)
         .build()
-        .join("build")
-        .join("Release");
+        .join("build");
+
+    // Only the Visual Studio generator puts each configuration in its own directory
+    let dst = if windows { build.join("Release") } else { build };
 
     println!("cargo::warning={}", dst.display());
 
@@ -26,4 +29,13 @@ fn main() {
 
     println!("cargo:rustc-link-lib=static=vst3wrapper");
     println!("cargo:rustc-link-lib=static=VST_SDK");
+
+    // System libraries go after the static ones that need them
+    if windows {
+        println!("cargo:rustc-link-lib=ole32");
+    } else {
+        println!("cargo:rustc-link-lib=stdc++");
+        println!("cargo:rustc-link-lib=dl");
+        println!("cargo:rustc-link-lib=pthread");
+    }
 }
@@ -109,7 +109,7 @@ impl AudioCallback for SDLAudioDeviceCallback {
         if let Some(output) = output_buses.get_mut(0) {
             for i in 0..self.block_size {
                 for j in 0..CHANNELS as usize {
-                    out[i * CHANNELS as usize + j] = output.data[j][i];
+                    out[i * CHANNELS as usize + j] = output.channel(j)[i];
                 }
             }
         }
@@ -0,0 +1,427 @@
+use std::{
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex, MutexGuard,
+    },
+    thread::JoinHandle,
+    time::Duration,
+};
+
+use ringbuf::{traits::*, HeapCons, HeapProd, HeapRb};
+
+use crate::{
+    audio_bus::AudioBus, event::HostIssuedEvent, plugin::PluginInstance, BlockSize,
+    ProcessDetails,
+};
+
+/// How long the render thread sleeps when it is far enough ahead.
+const WORKER_POLL: Duration = Duration::from_millis(1);
+
+/// Transport restarts that can be queued before the render thread picks them up.
+const ANCHOR_CAPACITY: usize = 16;
+
+#[derive(Debug, Clone, Copy)]
+pub struct AnticipativeSettings {
+    /// Block size the plugin is processed with on the render thread.
+    pub render_block_size: BlockSize,
+    /// Rendered blocks buffered ahead of the playhead. Rendering runs up to
+    /// `render_block_size * lookahead_blocks` samples ahead.
+    pub lookahead_blocks: usize,
+}
+
+impl Default for AnticipativeSettings {
+    fn default() -> Self {
+        AnticipativeSettings {
+            render_block_size: 2048,
+            lookahead_blocks: 8,
+        }
+    }
+}
+
+/// What a track without live input plays: its input audio and events, known ahead of time.
+pub trait TrackSource: Send {
+    /// {Render thread} Fills `inputs` and returns the events for the block described by
+    /// `details`, which lies ahead of the playhead. Event `block_time`s are relative to the block.
+    fn block(
+        &mut self,
+        details: &ProcessDetails,
+        inputs: &mut [AudioBus<'_, f32>],
+    ) -> Vec<HostIssuedEvent>;
+}
+
+/// Handle for `AnticipativeTrack::invalidate` from other threads.
+#[derive(Clone)]
+pub struct Invalidator {
+    invalidated: Arc<AtomicBool>,
+}
+
+impl Invalidator {
+    /// {Any thread} See `AnticipativeTrack::invalidate`.
+    pub fn invalidate(&self) {
+        self.invalidated.store(true, Ordering::Release);
+    }
+}
+
+struct RenderedBlock {
+    generation: u64,
+    /// Track position of the first sample.
+    position: u64,
+    /// `render_block_size` samples per output channel, channel after channel.
+    samples: Vec<f32>,
+}
+
+/// Where rendering restarts from.
+struct Anchor {
+    generation: u64,
+    position: u64,
+    details: ProcessDetails,
+    /// Suspends and resumes the plugin first, dropping notes and tails from the abandoned render.
+    reset: bool,
+}
+
+/// Renders a plugin on a track with no live input ahead of the playhead on a background thread,
+/// so the audio callback only copies finished audio and the plugin's cost no longer counts
+/// against the real-time deadline.
+///
+/// The transport passed to `process` is followed block by block. A jump, a tempo change or any
+/// other discontinuity discards everything rendered and restarts from the new position, which
+/// is silent until the first block there has been rendered. Call `invalidate` after anything
+/// that changes what's already rendered, such as a parameter edit. Audio up to one render block
+/// ahead is still played, and everything after is rendered again.
+pub struct AnticipativeTrack {
+    plugin: Option<Arc<Mutex<PluginInstance>>>,
+    worker: Option<JoinHandle<()>>,
+    stop: Arc<AtomicBool>,
+    invalidated: Arc<AtomicBool>,
+    anchors: HeapProd<Anchor>,
+    /// A restart the render thread hasn't been sent yet because `anchors` was full.
+    pending_anchor: Option<Anchor>,
+    rendered: HeapCons<RenderedBlock>,
+    recycled: HeapProd<RenderedBlock>,
+    current: Option<RenderedBlock>,
+    render_block_size: usize,
+    generation: u64,
+    /// Blocks of the previous generation are played up to here.
+    handover: u64,
+    /// Samples played since the track was created.
+    position: u64,
+    /// Transport expected at the next block if playback runs on uninterrupted.
+    expected: Option<ProcessDetails>,
+    underruns: u64,
+}
+
+impl AnticipativeTrack {
+    /// {UI thread} Moves `plugin` onto a render thread fed by `source`. Gives the plugin back if
+    /// it doesn't allow being processed ahead of time, so it can be processed live instead.
+    pub fn new(
+        mut plugin: PluginInstance,
+        source: Box<dyn TrackSource>,
+        settings: AnticipativeSettings,
+    ) -> Result<Self, PluginInstance> {
+        if !plugin.prefetchable() {
+            return Err(plugin);
+        }
+
+        let render_block_size = settings.render_block_size.max(1);
+        let block_count = settings.lookahead_blocks.max(2);
+
+        let io = plugin.get_io_configuration();
+        let channels: usize = (0..io.audio_outputs.len())
+            .map(|i| io.audio_outputs[i].channels)
+            .sum();
+
+        let (rendered_producer, rendered) = HeapRb::new(block_count).split();
+        let (mut recycled, recycled_consumer) = HeapRb::new(block_count).split();
+        let (anchors, anchors_consumer) = HeapRb::new(ANCHOR_CAPACITY).split();
+
+        // Every block is allocated here and passed back and forth from then on, so neither side
+        // allocates or frees while playing.
+        for _ in 0..block_count {
+            let _ = recycled.try_push(RenderedBlock {
+                generation: 0,
+                position: 0,
+                samples: vec![0.0; channels * render_block_size],
+            });
+        }
+
+        let plugin = Arc::new(Mutex::new(plugin));
+        let stop = Arc::new(AtomicBool::new(false));
+
+        let worker = RenderWorker {
+            plugin: plugin.clone(),
+            source,
+            stop: stop.clone(),
+            anchors: anchors_consumer,
+            rendered: rendered_producer,
+            recycled: recycled_consumer,
+            render_block_size,
+        };
+        let worker = std::thread::Builder::new()
+            .name("anticipative render".into())
+            .spawn(move || worker.run())
+            .expect("Failed to spawn the anticipative render thread");
+
+        Ok(AnticipativeTrack {
+            plugin: Some(plugin),
+            worker: Some(worker),
+            stop,
+            invalidated: Arc::new(AtomicBool::new(false)),
+            anchors,
+            pending_anchor: None,
+            rendered,
+            recycled,
+            current: None,
+            render_block_size,
+            generation: 0,
+            handover: 0,
+            position: 0,
+            expected: None,
+            underruns: 0,
+        })
+    }
+
+    /// {Audio thread} Copies the audio rendered for the block described by `details` into
+    /// `outputs`. Never blocks or runs the plugin. Returns false if the audio wasn't rendered in
+    /// time, in which case the missing part is silenced.
+    pub fn process(&mut self, outputs: &mut [AudioBus<f32>], details: &ProcessDetails) -> bool {
+        if !self.continues(details) {
+            self.restart(details, 0, true);
+        } else if self.invalidated.swap(false, Ordering::AcqRel) {
+            self.restart(details, self.render_block_size, false);
+        }
+
+        if let Some(anchor) = self.pending_anchor.take() {
+            if let Err(anchor) = self.anchors.try_push(anchor) {
+                self.pending_anchor = Some(anchor);
+            }
+        }
+
+        let frames = details.block_size;
+        let mut done = 0;
+        while done < frames {
+            let position = self.position + done as u64;
+            if !self.seek(position) {
+                break;
+            }
+
+            let block = self.current.as_ref().unwrap();
+            let offset = (position - block.position) as usize;
+            let count = (self.render_block_size - offset).min(frames - done);
+
+            let channels = outputs.iter_mut().flat_map(|bus| bus.data.iter_mut());
+            for (c, channel) in channels.enumerate() {
+                let start = c * self.render_block_size + offset;
+                channel[done..done + count].copy_from_slice(&block.samples[start..start + count]);
+            }
+            done += count;
+        }
+
+        if done < frames {
+            for channel in outputs.iter_mut().flat_map(|bus| bus.data.iter_mut()) {
+                channel[done..frames].fill(0.0);
+            }
+            self.underruns += 1;
+        }
+
+        self.position += frames as u64;
+        let mut expected = details.clone();
+        expected.advance(frames);
+        self.expected = Some(expected);
+
+        done == frames
+    }
+
+    /// {Any thread} Re-renders everything more than one render block ahead of the playhead,
+    /// from the next `process` call.
+    pub fn invalidate(&self) {
+        self.invalidated.store(true, Ordering::Release);
+    }
+
+    /// {Any thread} Handle for `invalidate` that can be kept on other threads, e.g. by the UI
+    /// when it forwards parameter edits.
+    pub fn invalidator(&self) -> Invalidator {
+        Invalidator {
+            invalidated: self.invalidated.clone(),
+        }
+    }
+
+    /// {Audio thread} Blocks that weren't rendered in time since the track was created.
+    pub fn underruns(&self) -> u64 {
+        self.underruns
+    }
+
+    /// {UI thread} Locks the plugin, e.g. for `get_events` or the editor. Waits while a block is
+    /// being rendered, so never call this from the audio thread.
+    pub fn plugin(&self) -> MutexGuard<'_, PluginInstance> {
+        self.plugin.as_ref().unwrap().lock().unwrap()
+    }
+
+    /// {UI thread} Stops the render thread and gives the plugin back, e.g. to process it live
+    /// once its track is armed.
+    pub fn into_inner(mut self) -> PluginInstance {
+        self.shutdown();
+        let plugin = self.plugin.take().unwrap();
+        match Arc::try_unwrap(plugin) {
+            Ok(plugin) => plugin.into_inner().unwrap(),
+            Err(_) => unreachable!("The render thread has exited"),
+        }
+    }
+
+    /// Whether `details` picks up where the previous block left off, as far as the render thread
+    /// would have predicted.
+    fn continues(&self, details: &ProcessDetails) -> bool {
+        let Some(expected) = &self.expected else {
+            return false;
+        };
+
+        let beats_per_sample = expected.tempo / 60.0 / expected.sample_rate as f64;
+        let tolerance = 0.5 * details.block_size.max(1) as f64 * beats_per_sample;
+
+        details.sample_rate == expected.sample_rate
+            && details.tempo == expected.tempo
+            && details.playing_state == expected.playing_state
+            && details.time_signature_numerator == expected.time_signature_numerator
+            && details.time_signature_denominator == expected.time_signature_denominator
+            && details.cycle_enabled == expected.cycle_enabled
+            && details.cycle_start == expected.cycle_start
+            && details.cycle_end == expected.cycle_end
+            && (details.player_time - expected.player_time).abs() <= tolerance
+    }
+
+    /// Renders again from `delay` samples after the current block, which starts at `details`.
+    fn restart(&mut self, details: &ProcessDetails, delay: usize, reset: bool) {
+        self.generation += 1;
+        self.handover = self.position + delay as u64;
+
+        let mut anchor_details = details.clone();
+        anchor_details.advance(delay);
+
+        // Replaces a restart that hasn't been sent yet
+        self.pending_anchor = Some(Anchor {
+            generation: self.generation,
+            position: self.handover,
+            details: anchor_details,
+            reset,
+        });
+    }
+
+    /// Makes `current` the block holding the sample at `position`, returning finished and
+    /// abandoned blocks to the render thread. Returns false if it hasn't been rendered yet.
+    fn seek(&mut self, position: u64) -> bool {
+        let wanted = if position < self.handover {
+            self.generation - 1
+        } else {
+            self.generation
+        };
+
+        loop {
+            if let Some(block) = &self.current {
+                let finished = block.generation < wanted
+                    || (block.generation == wanted
+                        && block.position + self.render_block_size as u64 <= position);
+
+                if !finished {
+                    return block.generation == wanted && block.position <= position;
+                }
+
+                let block = self.current.take().unwrap();
+                let _ = self.recycled.try_push(block);
+            }
+
+            match self.rendered.try_pop() {
+                Some(block) => self.current = Some(block),
+                None => return false,
+            }
+        }
+    }
+
+    fn shutdown(&mut self) {
+        self.stop.store(true, Ordering::Release);
+        if let Some(worker) = self.worker.take() {
+            let _ = worker.join();
+        }
+    }
+}
+
+impl Drop for AnticipativeTrack {
+    fn drop(&mut self) {
+        self.shutdown();
+    }
+}
+
+struct RenderWorker {
+    plugin: Arc<Mutex<PluginInstance>>,
+    source: Box<dyn TrackSource>,
+    stop: Arc<AtomicBool>,
+    anchors: HeapCons<Anchor>,
+    rendered: HeapProd<RenderedBlock>,
+    recycled: HeapCons<RenderedBlock>,
+    render_block_size: usize,
+}
+
+impl RenderWorker {
+    fn run(mut self) {
+        let block_size = self.render_block_size;
+        // The arena is a local of `run`, so it drops before `self` releases its plugin reference
+        let mut arena =
+            unsafe { self.plugin.lock().unwrap().create_shared_buffer_arena(block_size) };
+
+        let mut anchor: Option<Anchor> = None;
+        let mut details = ProcessDetails::default();
+        let mut position = 0;
+
+        while !self.stop.load(Ordering::Acquire) {
+            // Only the latest restart matters, but a reset asked for by one it replaced still
+            // applies
+            let mut restarted = false;
+            let mut reset = false;
+            while let Some(next) = self.anchors.try_pop() {
+                restarted = true;
+                reset |= next.reset;
+                anchor = Some(next);
+            }
+
+            let Some(current) = anchor.as_ref() else {
+                std::thread::sleep(WORKER_POLL);
+                continue;
+            };
+
+            if restarted {
+                details = current.details.clone();
+                details.block_size = block_size;
+                position = current.position;
+
+                if reset {
+                    let mut plugin = self.plugin.lock().unwrap();
+                    plugin.suspend();
+                    plugin.resume();
+                }
+            }
+
+            let Some(mut block) = self.recycled.try_pop() else {
+                std::thread::sleep(WORKER_POLL);
+                continue;
+            };
+
+            {
+                let mut plugin = self.plugin.lock().unwrap();
+                let mut buses = arena.buses(block_size);
+                let events = self.source.block(&details, &mut buses.inputs);
+                plugin.process(&buses.inputs, &mut buses.outputs, events, &details);
+
+                let channels = buses.outputs.iter().flat_map(|bus| bus.data.iter());
+                for (c, channel) in channels.enumerate() {
+                    block.samples[c * block_size..(c + 1) * block_size].copy_from_slice(channel);
+                }
+            }
+
+            block.generation = current.generation;
+            block.position = position;
+            // Can't fail, the ring holds every block
+            let _ = self.rendered.try_push(block);
+
+            position += block_size as u64;
+            details.advance(block_size);
+        }
+    }
+}
@@ -1,21 +1,71 @@
-use crate::{error::{err, Error}, heapless_vec::HeaplessVec};
+use std::{
+    alloc::{alloc_zeroed, dealloc, handle_alloc_error, Layout},
+    ptr::NonNull,
+};
 
+use crate::{
+    error::{err, Error},
+    heapless_vec::HeaplessVec,
+    BlockSize,
+};
+
+/// Alignment of every channel handed out by `BufferArena` and `AudioBus::new_alloced`.
+pub const CHANNEL_ALIGNMENT: usize = 64;
+
+/// A set of channels passed to or from a plugin. Channels are views so a bus can borrow from
+/// `Vec`s, from a `BufferArena` or own a single aligned allocation. They are only handed out
+/// borrowed from the bus, as the views of an owning bus die with it.
 pub struct AudioBus<'a, T> {
-    pub data: &'a mut Vec<Vec<T>>,
-    owned_data: *mut Vec<Vec<T>>,
+    pub(crate) data: Vec<&'a mut [T]>,
+    /// Keeps the allocation behind `data` alive for buses created with `new_alloced`.
+    _owned_data: Option<AlignedBuffer<T>>,
 }
 
 impl<'a, T> AudioBus<'a, T> {
+    /// Views the channels of `data`. Allocates the `Vec` holding the views, so build buses once
+    /// outside the audio callback and keep them, or take them from `BufferArena::buses`.
     pub fn new(data: &'a mut Vec<Vec<T>>) -> Self {
         AudioBus {
-            data,
-            owned_data: std::ptr::null_mut(),
+            data: data.iter_mut().map(|channel| channel.as_mut_slice()).collect(),
+            _owned_data: None,
+        }
+    }
+
+    /// Creates a bus viewing the given channel slices.
+    pub fn from_channels(channels: Vec<&'a mut [T]>) -> Self {
+        AudioBus {
+            data: channels,
+            _owned_data: None,
         }
     }
 
     pub fn channels(&self) -> usize {
         self.data.len()
     }
+
+    pub fn channel(&self, index: usize) -> &[T] {
+        self.data[index]
+    }
+
+    pub fn channel_mut(&mut self, index: usize) -> &mut [T] {
+        self.data[index]
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = &[T]> {
+        self.data.iter().map(|channel| &**channel)
+    }
+
+    pub fn iter_mut(&mut self) -> ChannelsMut<'_, 'a, T> {
+        self.data.iter_mut().map(reborrow_channel)
+    }
+}
+
+/// Channels of a bus, reborrowed so the views themselves can't be replaced or moved out.
+pub type ChannelsMut<'s, 'a, T> =
+    std::iter::Map<std::slice::IterMut<'s, &'a mut [T]>, for<'x> fn(&'x mut &'a mut [T]) -> &'x mut [T]>;
+
+fn reborrow_channel<'s, T>(channel: &'s mut &mut [T]) -> &'s mut [T] {
+    channel
 }
 
 #[derive(Clone, Debug)]
@@ -79,26 +129,214 @@ pub struct AudioBusDescriptor {
     pub channels: usize,
 }
 
-impl<T> AudioBus<'_, T>
+impl<T> AudioBus<'static, T>
 where
-    T: Default + Clone,
+    T: Default + Copy,
 {
+    /// Allocates `channels` channels of `block_size` samples in one allocation. Each channel is
+    /// aligned to `CHANNEL_ALIGNMENT` bytes.
     pub fn new_alloced(block_size: usize, channels: usize) -> Self {
-        let buffer = vec![vec![T::default(); block_size]; channels];
-        let ptr = Box::into_raw(Box::new(buffer));
+        let stride = channel_stride::<T>(block_size);
+        let mut buffer = AlignedBuffer::new(stride * channels);
+
+        // The slices point into the heap allocation owned by `buffer`, which lives as long as
+        // the bus and is never moved or resized.
+        let base: *mut T = buffer.as_mut_ptr();
+        let data = (0..channels)
+            .map(|c| unsafe { std::slice::from_raw_parts_mut(base.add(c * stride), block_size) })
+            .collect();
+
         AudioBus {
-            data: unsafe { &mut *ptr },
-            owned_data: ptr,
+            data,
+            _owned_data: Some(buffer),
         }
     }
 }
 
-impl<T> Drop for AudioBus<'_, T> {
+/// Every input, output and scratch channel of a plugin instance in a single
+/// `CHANNEL_ALIGNMENT` aligned allocation, sized for a maximum block size. Keeping the channels
+/// adjacent touches fewer cache lines and pages per block than one heap allocation per channel,
+/// and lets plugins use aligned SIMD loads.
+///
+/// Create one with `PluginInstance::create_buffer_arena`, then take views with `buses`.
+pub struct BufferArena<T> {
+    buffer: AlignedBuffer<T>,
+    input_channels: Vec<usize>,
+    output_channels: Vec<usize>,
+    scratch_channels: usize,
+    max_block_size: BlockSize,
+    stride: usize,
+    /// Unused channels between the inputs and outputs. Only non-zero for shared arenas.
+    output_gap: usize,
+}
+
+/// Views into a `BufferArena` for one block of `block_size` samples.
+pub struct ArenaBuses<'a, T> {
+    pub inputs: Vec<AudioBus<'a, T>>,
+    pub outputs: Vec<AudioBus<'a, T>>,
+    pub scratch: Vec<&'a mut [T]>,
+}
+
+impl<T: Default + Copy> BufferArena<T> {
+    pub fn new(io: &IOConfigutaion, max_block_size: BlockSize, scratch_channels: usize) -> Self {
+        let input_channels: Vec<usize> = io.audio_inputs.iter().map(|b| b.channels).collect();
+        let output_channels: Vec<usize> = io.audio_outputs.iter().map(|b| b.channels).collect();
+
+        let total_channels = input_channels.iter().sum::<usize>()
+            + output_channels.iter().sum::<usize>()
+            + scratch_channels;
+
+        let stride = channel_stride::<T>(max_block_size);
+
+        BufferArena {
+            buffer: AlignedBuffer::new(stride * total_channels),
+            input_channels,
+            output_channels,
+            scratch_channels,
+            max_block_size,
+            stride,
+            output_gap: 0,
+        }
+    }
+
+    /// Arena over channels owned by someone else, like a sandboxed plugin's shared buffers.
+    /// Channels are `stride` samples apart, inputs starting at `inputs` and outputs at `outputs`.
+    ///
+    /// # Safety
+    /// `outputs` must be a whole number of strides after the last input channel, in the same
+    /// allocation, and all channels must stay valid and otherwise unused while the arena lives.
+    pub(crate) unsafe fn from_shared(
+        io: &IOConfigutaion,
+        max_block_size: BlockSize,
+        inputs: *mut T,
+        outputs: *mut T,
+        stride: usize,
+    ) -> Self {
+        let input_channels: Vec<usize> = io.audio_inputs.iter().map(|b| b.channels).collect();
+        let output_channels: Vec<usize> = io.audio_outputs.iter().map(|b| b.channels).collect();
+
+        let outputs_start = outputs.offset_from(inputs) as usize / stride;
+        let len = (outputs_start + output_channels.iter().sum::<usize>()) * stride;
+
+        BufferArena {
+            buffer: AlignedBuffer::borrowed(inputs, len),
+            output_gap: outputs_start - input_channels.iter().sum::<usize>(),
+            input_channels,
+            output_channels,
+            scratch_channels: 0,
+            max_block_size,
+            stride,
+        }
+    }
+
+    pub fn max_block_size(&self) -> BlockSize {
+        self.max_block_size
+    }
+
+    /// Size of the allocation in bytes.
+    pub fn size_bytes(&self) -> usize {
+        self.buffer.len * std::mem::size_of::<T>()
+    }
+
+    /// Splits the arena into input, output and scratch views of `block_size` samples each.
+    /// Allocates the `Vec`s holding the views, so call this outside the audio callback and keep
+    /// the result if the block size is fixed.
+    pub fn buses(&mut self, block_size: BlockSize) -> ArenaBuses<'_, T> {
+        assert!(
+            block_size <= self.max_block_size,
+            "Block size exceeds the arena's max block size"
+        );
+
+        let stride = self.stride;
+        let mut remaining = self.buffer.as_mut_slice();
+        let mut next_channel = move || {
+            let (channel, rest) = std::mem::take(&mut remaining).split_at_mut(stride);
+            remaining = rest;
+            &mut channel[..block_size]
+        };
+
+        let mut bus = |channels: usize| {
+            AudioBus::from_channels((0..channels).map(|_| next_channel()).collect())
+        };
+
+        let inputs = self.input_channels.iter().map(|&c| bus(c)).collect();
+        let _gap = bus(self.output_gap);
+        let outputs = self.output_channels.iter().map(|&c| bus(c)).collect();
+        let scratch = bus(self.scratch_channels).data;
+
+        ArenaBuses {
+            inputs,
+            outputs,
+            scratch,
+        }
+    }
+}
+
+/// Samples between the starts of adjacent channels so each starts on an aligned address.
+fn channel_stride<T>(block_size: usize) -> usize {
+    let per_line = (CHANNEL_ALIGNMENT / std::mem::size_of::<T>()).max(1);
+    block_size.div_ceil(per_line) * per_line
+}
+
+/// Zero initialised heap allocation aligned to `CHANNEL_ALIGNMENT`.
+struct AlignedBuffer<T> {
+    ptr: NonNull<T>,
+    len: usize,
+    owned: bool,
+}
+
+unsafe impl<T: Send> Send for AlignedBuffer<T> {}
+unsafe impl<T: Sync> Sync for AlignedBuffer<T> {}
+
+impl<T: Default + Copy> AlignedBuffer<T> {
+    fn new(len: usize) -> Self {
+        let layout = Self::layout(len);
+        let ptr = unsafe { alloc_zeroed(layout) } as *mut T;
+        let Some(ptr) = NonNull::new(ptr) else {
+            handle_alloc_error(layout);
+        };
+
+        for i in 0..len {
+            unsafe { ptr.as_ptr().add(i).write(T::default()) };
+        }
+
+        AlignedBuffer {
+            ptr,
+            len,
+            owned: true,
+        }
+    }
+}
+
+impl<T> AlignedBuffer<T> {
+    /// Wraps memory that is freed by its owner, not on drop.
+    unsafe fn borrowed(ptr: *mut T, len: usize) -> Self {
+        AlignedBuffer {
+            ptr: NonNull::new(ptr).expect("Null buffer"),
+            len,
+            owned: false,
+        }
+    }
+
+    fn layout(len: usize) -> Layout {
+        let size = (len * std::mem::size_of::<T>()).max(CHANNEL_ALIGNMENT);
+        Layout::from_size_align(size, CHANNEL_ALIGNMENT).expect("Invalid buffer layout")
+    }
+
+    fn as_mut_ptr(&mut self) -> *mut T {
+        self.ptr.as_ptr()
+    }
+
+    fn as_mut_slice(&mut self) -> &mut [T] {
+        unsafe { std::slice::from_raw_parts_mut(self.ptr.as_ptr(), self.len) }
+    }
+}
+
+impl<T> Drop for AlignedBuffer<T> {
     fn drop(&mut self) {
-        if !self.owned_data.is_null() {
-            unsafe {
-                drop(Box::from_raw(self.owned_data));
-            }
+        if !self.owned {
+            return;
         }
+        unsafe { dealloc(self.ptr.as_ptr() as *mut u8, Self::layout(self.len)) };
     }
 }
@@ -0,0 +1,196 @@
+use crate::{
+    event::{HostIssuedEvent, HostIssuedEventType},
+    parameter::ParameterUpdate,
+    Samples,
+};
+
+/// A value of an automation curve at `block_time` samples from the start of the block.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct AutomationPoint {
+    pub block_time: Samples,
+    pub value: f32,
+}
+
+/// {Audio thread} Appends the automation of `parameter_id` over one block as parameter events
+/// for `process`. `points` must be sorted by time.
+///
+/// Instead of one event per point, the curve is reduced to the fewest breakpoints whose linear
+/// interpolation stays within `tolerance` (in normalized units) of every point. Plugins receive
+/// all of a block's breakpoints for a parameter in one queue and interpolate between them, so a
+/// dense curve costs a handful of events. Doesn't allocate if `events` has the capacity.
+pub fn append_automation(
+    parameter_id: i32,
+    points: &[AutomationPoint],
+    tolerance: f32,
+    events: &mut Vec<HostIssuedEvent>,
+) {
+    reduce(points.len(), |i| points[i], tolerance, |point| {
+        events.push(parameter_event(parameter_id, point))
+    });
+}
+
+/// {Audio thread} Like `append_automation` for a curve sampled every `step` samples from the
+/// start of the block, e.g. per-sample automation with a `step` of 1.
+pub fn append_sampled_automation(
+    parameter_id: i32,
+    values: &[f32],
+    step: Samples,
+    tolerance: f32,
+    events: &mut Vec<HostIssuedEvent>,
+) {
+    let point = |i: usize| AutomationPoint {
+        block_time: i * step,
+        value: values[i],
+    };
+    reduce(values.len(), point, tolerance, |point| {
+        events.push(parameter_event(parameter_id, point))
+    });
+}
+
+fn parameter_event(parameter_id: i32, point: AutomationPoint) -> HostIssuedEvent {
+    HostIssuedEvent {
+        event_type: HostIssuedEventType::Parameter(ParameterUpdate::new(
+            parameter_id,
+            point.value,
+        )),
+        block_time: point.block_time,
+        ppq_time: 0.0,
+        bus_index: 0,
+    }
+}
+
+/// Emits the breakpoints of a piecewise linear approximation of `len` points. From each
+/// breakpoint, the segment is extended to the furthest point whose line keeps every point in
+/// between within `tolerance`. Those lines form a corridor of slopes that narrows with each point
+/// passed, so a segment ends as soon as the corridor closes.
+fn reduce(
+    len: usize,
+    point: impl Fn(usize) -> AutomationPoint,
+    tolerance: f32,
+    mut emit: impl FnMut(AutomationPoint),
+) {
+    if len == 0 {
+        return;
+    }
+
+    let tolerance = tolerance.max(0.0) as f64;
+    let mut anchor = 0;
+    emit(point(0));
+
+    while anchor + 1 < len {
+        let start = point(anchor);
+        let slope = |p: AutomationPoint, offset: f64| {
+            let dt = p.block_time.saturating_sub(start.block_time).max(1) as f64;
+            (p.value as f64 + offset - start.value as f64) / dt
+        };
+
+        let mut lower = f64::NEG_INFINITY;
+        let mut upper = f64::INFINITY;
+        let mut end = anchor + 1;
+
+        for i in anchor + 1..len {
+            let p = point(i);
+            let s = slope(p, 0.0);
+            if s < lower || s > upper {
+                break;
+            }
+            end = i;
+
+            lower = lower.max(slope(p, -tolerance));
+            upper = upper.min(slope(p, tolerance));
+            if lower > upper {
+                break;
+            }
+        }
+
+        emit(point(end));
+        anchor = end;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn reduced(values: &[f32], tolerance: f32) -> Vec<AutomationPoint> {
+        let point = |i: usize| AutomationPoint {
+            block_time: i,
+            value: values[i],
+        };
+        let mut breakpoints = Vec::new();
+        reduce(values.len(), point, tolerance, |p| breakpoints.push(p));
+        breakpoints
+    }
+
+    /// Value of the line through `breakpoints` at `time`.
+    fn interpolate(breakpoints: &[AutomationPoint], time: Samples) -> f32 {
+        let next = breakpoints
+            .iter()
+            .position(|p| p.block_time >= time)
+            .unwrap();
+        if next == 0 {
+            return breakpoints[0].value;
+        }
+        let (a, b) = (breakpoints[next - 1], breakpoints[next]);
+        let t = (time - a.block_time) as f32 / (b.block_time - a.block_time) as f32;
+        a.value + (b.value - a.value) * t
+    }
+
+    #[test]
+    fn linear_ramp_collapses_to_endpoints() {
+        let values: Vec<f32> = (0..512).map(|i| 0.2 + i as f32 * 0.001).collect();
+        let breakpoints = reduced(&values, 0.0001);
+
+        assert_eq!(
+            breakpoints,
+            vec![
+                AutomationPoint {
+                    block_time: 0,
+                    value: values[0],
+                },
+                AutomationPoint {
+                    block_time: 511,
+                    value: values[511],
+                },
+            ]
+        );
+    }
+
+    #[test]
+    fn every_point_within_tolerance() {
+        let mut seed = 0x2545f491u32;
+        let mut noise = move || {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            seed as f32 / u32::MAX as f32
+        };
+
+        let curves: Vec<Vec<f32>> = vec![
+            (0..1024)
+                .map(|i| 0.5 + 0.5 * (i as f32 * 0.02).sin())
+                .collect(),
+            (0..1024)
+                .map(|i| if i % 200 < 100 { 0.1 } else { 0.9 })
+                .collect(),
+            (0..1024).map(|_| noise()).collect(),
+            vec![0.3],
+        ];
+
+        for tolerance in [0.0, 0.001, 0.01, 0.1] {
+            for values in &curves {
+                let breakpoints = reduced(values, tolerance);
+                assert_eq!(breakpoints.first().unwrap().block_time, 0);
+                assert_eq!(breakpoints.last().unwrap().block_time, values.len() - 1);
+
+                for (time, &value) in values.iter().enumerate() {
+                    let error = (interpolate(&breakpoints, time) - value).abs();
+                    assert!(
+                        error <= tolerance + 1e-5,
+                        "Point {time} is off by {error} at tolerance {tolerance}"
+                    );
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,307 @@
+use crate::{
+    audio_bus::{AudioBus, IOConfigutaion},
+    error::{err, Error},
+    event::HostIssuedEvent,
+    plugin::PluginInstance,
+    BlockSize, ProcessDetails, Samples,
+};
+
+/// A serial insert chain: each plugin's outputs feed the next plugin's inputs.
+///
+/// Instead of every slot owning its own input and output buses, the chain plans which channels
+/// are live at each slot and assigns them from one shared pool. A slot's outputs reuse channels
+/// freed by earlier slots, and a slot whose input and output layouts match processes in place,
+/// so consecutive plugins ping-pong between as few channels as the widest slot needs.
+pub struct PluginChain {
+    plugins: Vec<PluginInstance>,
+    slots: Vec<ChainSlot>,
+    /// Every channel the slots' views point into, allocated once.
+    _pool: AudioBus<'static, f32>,
+    pool_channels: usize,
+    max_block_size: BlockSize,
+}
+
+unsafe impl Send for PluginChain {}
+
+struct ChainSlot {
+    /// Empty for slots processing in place, which only get `outputs`.
+    inputs: Vec<AudioBus<'static, f32>>,
+    outputs: Vec<AudioBus<'static, f32>>,
+    input_ptrs: Vec<*mut f32>,
+    output_ptrs: Vec<*mut f32>,
+    in_place: bool,
+}
+
+/// Pool channels assigned to one slot's inputs and outputs.
+struct SlotPlan {
+    inputs: Vec<usize>,
+    outputs: Vec<usize>,
+    in_place: bool,
+}
+
+impl PluginChain {
+    /// {UI thread} Builds a chain of `plugins`, in order. Each plugin's output buses must match
+    /// the next plugin's input buses. With `in_place`, plugins whose input and output layouts
+    /// match are handed the same channels for both. Must be recreated if a plugin's IO
+    /// configuration changes.
+    pub fn new(
+        mut plugins: Vec<PluginInstance>,
+        max_block_size: BlockSize,
+        in_place: bool,
+    ) -> Result<Self, Error> {
+        if plugins.is_empty() {
+            return err("A chain needs at least one plugin");
+        }
+
+        let ios: Vec<IOConfigutaion> = plugins
+            .iter_mut()
+            .map(|plugin| plugin.get_io_configuration())
+            .collect();
+
+        for (i, pair) in ios.windows(2).enumerate() {
+            let outputs: Vec<usize> = pair[0].audio_outputs.iter().map(|b| b.channels).collect();
+            let inputs: Vec<usize> = pair[1].audio_inputs.iter().map(|b| b.channels).collect();
+            if outputs != inputs {
+                return err(&format!(
+                    "Chain slot {} outputs {:?} channels but slot {} takes {:?}",
+                    i,
+                    outputs,
+                    i + 1,
+                    inputs
+                ));
+            }
+        }
+
+        let (plans, pool_channels) = plan(&ios, in_place);
+
+        let mut pool = AudioBus::new_alloced(max_block_size, pool_channels);
+        let pool_ptrs: Vec<*mut f32> = pool.data.iter_mut().map(|c| c.as_mut_ptr()).collect();
+
+        let slots = plans
+            .iter()
+            .zip(&ios)
+            .map(|(plan, io)| {
+                let input_ptrs: Vec<*mut f32> = plan.inputs.iter().map(|&c| pool_ptrs[c]).collect();
+                let output_ptrs: Vec<*mut f32> =
+                    plan.outputs.iter().map(|&c| pool_ptrs[c]).collect();
+
+                // The views point into `pool`, which the chain owns and never resizes. A slot
+                // processing in place shares its channels between inputs and outputs, so it only
+                // gets one set of views rather than two aliasing ones.
+                let inputs = if plan.in_place {
+                    Vec::new()
+                } else {
+                    bus_views(&input_ptrs, io.audio_inputs.iter().map(|b| b.channels))
+                };
+                let outputs =
+                    bus_views(&output_ptrs, io.audio_outputs.iter().map(|b| b.channels));
+
+                ChainSlot {
+                    inputs,
+                    outputs,
+                    input_ptrs,
+                    output_ptrs,
+                    in_place: plan.in_place,
+                }
+            })
+            .collect();
+
+        Ok(PluginChain {
+            plugins,
+            slots,
+            _pool: pool,
+            pool_channels,
+            max_block_size,
+        })
+    }
+
+    /// {Audio thread} Processes one block through every plugin in order. `inputs` must match the
+    /// first plugin's inputs and `outputs` the last plugin's outputs. `events[i]` goes to slot
+    /// `i`; missing entries mean no events.
+    pub fn process(
+        &mut self,
+        inputs: &[AudioBus<f32>],
+        outputs: &mut [AudioBus<f32>],
+        mut events: Vec<Vec<HostIssuedEvent>>,
+        process_details: &ProcessDetails,
+    ) {
+        let frames = process_details.block_size;
+        assert!(
+            frames <= self.max_block_size,
+            "Block size exceeds the chain's max block size"
+        );
+
+        let first = &self.slots[0];
+        let sources = inputs.iter().flat_map(|bus| bus.data.iter());
+        for (source, &channel) in sources.zip(&first.input_ptrs) {
+            unsafe { std::ptr::copy_nonoverlapping(source.as_ptr(), channel, frames) };
+        }
+
+        for (i, (plugin, slot)) in self.plugins.iter_mut().zip(&mut self.slots).enumerate() {
+            slot.bind(frames);
+            let slot_events = events.get_mut(i).map(std::mem::take).unwrap_or_default();
+            if slot.in_place {
+                plugin.process_in_place(&mut slot.outputs, slot_events, process_details);
+            } else {
+                plugin.process(&slot.inputs, &mut slot.outputs, slot_events, process_details);
+            }
+        }
+
+        let last = self.slots.last().unwrap();
+        let targets = outputs.iter_mut().flat_map(|bus| bus.data.iter_mut());
+        for (target, &channel) in targets.zip(&last.output_ptrs) {
+            unsafe { std::ptr::copy_nonoverlapping(channel, target.as_mut_ptr(), frames) };
+        }
+    }
+
+    /// {Any thread} Sum of every plugin's latency.
+    pub fn latency(&self) -> Samples {
+        self.plugins.iter().map(|plugin| plugin.get_latency()).sum()
+    }
+
+    /// Channels the chain allocated, shared by all slots.
+    pub fn pool_channels(&self) -> usize {
+        self.pool_channels
+    }
+
+    pub fn plugins(&self) -> &[PluginInstance] {
+        &self.plugins
+    }
+
+    /// {UI thread} E.g. for `get_events` and editors. Recreate the chain if the plugin's IO
+    /// configuration changes.
+    pub fn plugin_mut(&mut self, slot: usize) -> &mut PluginInstance {
+        &mut self.plugins[slot]
+    }
+
+    pub fn into_plugins(self) -> Vec<PluginInstance> {
+        self.plugins
+    }
+}
+
+impl ChainSlot {
+    /// Resizes the bus views to `frames` without allocating.
+    fn bind(&mut self, frames: usize) {
+        let mut ptrs = self.input_ptrs.iter();
+        for channel in self.inputs.iter_mut().flat_map(|bus| bus.data.iter_mut()) {
+            *channel = unsafe { std::slice::from_raw_parts_mut(*ptrs.next().unwrap(), frames) };
+        }
+
+        let mut ptrs = self.output_ptrs.iter();
+        for channel in self.outputs.iter_mut().flat_map(|bus| bus.data.iter_mut()) {
+            *channel = unsafe { std::slice::from_raw_parts_mut(*ptrs.next().unwrap(), frames) };
+        }
+    }
+}
+
+/// Assigns pool channels to every slot. A slot's inputs are live from the slot before it until it
+/// has processed, so its outputs must avoid them unless it processes in place. Channels are
+/// reused as soon as they die, which needs as many channels as the widest slot: inputs plus
+/// outputs, or just its inputs in place.
+fn plan(ios: &[IOConfigutaion], in_place: bool) -> (Vec<SlotPlan>, usize) {
+    let mut free: Vec<usize> = Vec::new();
+    let mut pool_channels = 0;
+    let mut take = |free: &mut Vec<usize>, count: usize| -> Vec<usize> {
+        (0..count)
+            .map(|_| {
+                free.pop().unwrap_or_else(|| {
+                    pool_channels += 1;
+                    pool_channels - 1
+                })
+            })
+            .collect()
+    };
+
+    let input_channels = |io: &IOConfigutaion| -> usize { io.audio_inputs.iter().map(|b| b.channels).sum() };
+    let mut live: Vec<usize> = take(&mut free, input_channels(&ios[0]));
+
+    let mut plans = Vec::with_capacity(ios.len());
+    for io in ios {
+        let inputs: Vec<usize> = io.audio_inputs.iter().map(|b| b.channels).collect();
+        let outputs: Vec<usize> = io.audio_outputs.iter().map(|b| b.channels).collect();
+
+        let slot_in_place = in_place && inputs == outputs;
+        let output_channels = if slot_in_place {
+            live.clone()
+        } else {
+            let taken = take(&mut free, outputs.iter().sum());
+            // The inputs die once the slot has processed
+            free.extend(&live);
+            taken
+        };
+
+        plans.push(SlotPlan {
+            inputs: std::mem::replace(&mut live, output_channels.clone()),
+            outputs: output_channels,
+            in_place: slot_in_place,
+        });
+    }
+
+    drop(take);
+    (plans, pool_channels)
+}
+
+fn bus_views(
+    ptrs: &[*mut f32],
+    channels_per_bus: impl Iterator<Item = usize>,
+) -> Vec<AudioBus<'static, f32>> {
+    let mut ptrs = ptrs.iter();
+    channels_per_bus
+        .map(|channels| {
+            AudioBus::from_channels(
+                (0..channels)
+                    .map(|_| unsafe { std::slice::from_raw_parts_mut(*ptrs.next().unwrap(), 0) })
+                    .collect(),
+            )
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{audio_bus::AudioBusDescriptor, heapless_vec::HeaplessVec};
+
+    fn stereo() -> IOConfigutaion {
+        let mut io = IOConfigutaion {
+            audio_inputs: HeaplessVec::new(),
+            audio_outputs: HeaplessVec::new(),
+            event_inputs_count: 0,
+        };
+        io.audio_inputs
+            .push(AudioBusDescriptor { channels: 2 })
+            .unwrap();
+        io.audio_outputs
+            .push(AudioBusDescriptor { channels: 2 })
+            .unwrap();
+        io
+    }
+
+    #[test]
+    fn stereo_chain_in_place() {
+        let (plans, pool_channels) = plan(&vec![stereo(); 8], true);
+
+        assert_eq!(pool_channels, 2);
+        for slot in &plans {
+            assert!(slot.in_place);
+            assert_eq!(slot.inputs, plans[0].inputs);
+            assert_eq!(slot.outputs, slot.inputs);
+        }
+    }
+
+    #[test]
+    fn stereo_chain_not_in_place() {
+        let (plans, pool_channels) = plan(&vec![stereo(); 8], false);
+
+        assert_eq!(pool_channels, 4);
+        for (i, slot) in plans.iter().enumerate() {
+            assert!(!slot.in_place);
+            assert_eq!(slot.inputs.len(), 2);
+            assert_eq!(slot.outputs.len(), 2);
+            assert!(slot.outputs.iter().all(|c| !slot.inputs.contains(c)));
+            if i > 0 {
+                assert_eq!(slot.inputs, plans[i - 1].outputs);
+            }
+        }
+    }
+}
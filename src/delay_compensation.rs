@@ -0,0 +1,161 @@
+use std::sync::{
+    atomic::{AtomicUsize, Ordering},
+    Arc,
+};
+
+use crate::{audio_bus::AudioBus, BlockSize, Samples};
+
+/// Plugin delay compensation for parallel signal paths (e.g. bus returns summed into a master).
+///
+/// Each path reports its latency, usually the sum of `PluginInstance::get_latency` over the
+/// plugins on it. Every path is delayed so that all of them line up with the slowest one. Delay
+/// lines are allocated up front for `max_delay` so latency changes never allocate on the audio
+/// thread.
+///
+/// Each block starts with `begin_block`, which fixes every path's delay for the block, followed
+/// by a `process` call per path.
+pub struct DelayCompensation {
+    paths: Vec<DelayPath>,
+    latencies: PathLatencies,
+    /// Delay of each path for the current block, taken from `latencies` by `begin_block`.
+    delays: Vec<Samples>,
+    max_delay: Samples,
+    max_block_size: BlockSize,
+}
+
+/// Shared handle for updating path latencies from another thread. Changes are picked up by the
+/// next `DelayCompensation::begin_block` call.
+#[derive(Clone)]
+pub struct PathLatencies(Arc<Vec<AtomicUsize>>);
+
+struct DelayPath {
+    channels: Vec<DelayLine>,
+}
+
+struct DelayLine {
+    buffer: Vec<f32>,
+    write_pos: usize,
+}
+
+impl DelayCompensation {
+    /// Creates compensation for `paths` paths of `channels` channels each. Latency differences
+    /// beyond `max_delay` are clamped.
+    pub fn new(
+        paths: usize,
+        channels: usize,
+        max_delay: Samples,
+        max_block_size: BlockSize,
+    ) -> Self {
+        let capacity = max_delay + max_block_size;
+
+        DelayCompensation {
+            paths: (0..paths)
+                .map(|_| DelayPath {
+                    channels: (0..channels)
+                        .map(|_| DelayLine {
+                            buffer: vec![0.0; capacity],
+                            write_pos: 0,
+                        })
+                        .collect(),
+                })
+                .collect(),
+            latencies: PathLatencies(Arc::new(
+                (0..paths).map(|_| AtomicUsize::new(0)).collect(),
+            )),
+            delays: vec![0; paths],
+            max_delay,
+            max_block_size,
+        }
+    }
+
+    /// {Any thread}
+    pub fn latencies(&self) -> PathLatencies {
+        self.latencies.clone()
+    }
+
+    /// {Any thread}
+    pub fn set_latency(&self, path: usize, latency: Samples) {
+        self.latencies.set(path, latency);
+    }
+
+    /// {Any thread} Latency of the aligned output, i.e. the latency of the slowest path.
+    pub fn total_latency(&self) -> Samples {
+        self.latencies.max()
+    }
+
+    /// {Audio thread} Reads the path latencies once for the coming block, so a concurrent
+    /// `set_latency` can't give paths of the same block delays computed from different latencies.
+    pub fn begin_block(&mut self) {
+        let target = self.latencies.max();
+        for (path, delay) in self.delays.iter_mut().enumerate() {
+            let latency = self.latencies.get(path);
+            *delay = target.saturating_sub(latency).min(self.max_delay);
+        }
+    }
+
+    /// {Audio thread} Delays `bus` in place by the compensation for `path`. All paths must be
+    /// processed every block, after `begin_block`, with the same number of `samples`.
+    pub fn process(&mut self, path: usize, bus: &mut AudioBus<f32>, samples: usize) {
+        assert!(samples <= self.max_block_size, "Block exceeds max block size");
+
+        let delay = self.delays[path];
+        let path = &mut self.paths[path];
+
+        for (line, channel) in path.channels.iter_mut().zip(bus.iter_mut()) {
+            line.process(&mut channel[..samples], delay);
+        }
+    }
+
+    /// {Audio thread} Clears the delay lines, e.g. after a transport jump.
+    pub fn reset(&mut self) {
+        for path in self.paths.iter_mut() {
+            for line in path.channels.iter_mut() {
+                line.buffer.fill(0.0);
+                line.write_pos = 0;
+            }
+        }
+    }
+}
+
+impl PathLatencies {
+    pub fn set(&self, path: usize, latency: Samples) {
+        self.0[path].store(latency, Ordering::Relaxed);
+    }
+
+    pub fn get(&self, path: usize) -> Samples {
+        self.0[path].load(Ordering::Relaxed)
+    }
+
+    fn max(&self) -> Samples {
+        self.0
+            .iter()
+            .map(|latency| latency.load(Ordering::Relaxed))
+            .max()
+            .unwrap_or(0)
+    }
+}
+
+impl DelayLine {
+    /// Writes the whole block before reading so delays shorter than the block read the samples
+    /// that were just written. The buffer holds `max_delay + max_block_size` samples so the
+    /// oldest sample needed is never overwritten by the same block.
+    fn process(&mut self, samples: &mut [f32], delay: Samples) {
+        let capacity = self.buffer.len();
+        let len = samples.len();
+
+        let start = self.write_pos;
+        let first = len.min(capacity - start);
+        self.buffer[start..start + first].copy_from_slice(&samples[..first]);
+        self.buffer[..len - first].copy_from_slice(&samples[first..]);
+        self.write_pos = (start + len) % capacity;
+
+        if delay == 0 {
+            return;
+        }
+
+        let read_pos = (start + capacity - delay) % capacity;
+        let first = len.min(capacity - read_pos);
+        samples[..first].copy_from_slice(&self.buffer[read_pos..read_pos + first]);
+        samples[first..].copy_from_slice(&self.buffer[..len - first]);
+    }
+}
@@ -1,7 +1,9 @@
+use std::sync::{Arc, RwLock};
+
 use crate::{parameter::ParameterUpdate, PpqTime, Samples};
 
 /// Events sent to the plugin from the host. Can be passed into the `process` function or queued
-/// for the next process call with `queue_event`.
+/// from any thread for a future block with `queue_event`.
 #[derive(Debug, Clone)]
 #[repr(C)]
 pub struct HostIssuedEvent {
@@ -12,6 +14,54 @@ pub struct HostIssuedEvent {
     pub bus_index: usize,
 }
 
+/// When an event queued with `queue_event` should reach the plugin.
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub enum EventTime {
+    /// Absolute sample position on the instance's own clock. See `sample_position`.
+    Samples(u64),
+    /// Musical position. Delivered once the transport reaches it.
+    Ppq(PpqTime),
+}
+
+type QueueFn = Box<dyn Fn(&HostIssuedEvent, EventTime) -> bool + Send + Sync>;
+
+/// Shared by an instance and its `EventSender`s. The instance closes it when dropped, which waits
+/// for senders already queueing and stops later ones from reaching it.
+pub(crate) struct EventLink {
+    queue: RwLock<Option<QueueFn>>,
+}
+
+impl EventLink {
+    pub(crate) fn new(queue: QueueFn) -> Arc<Self> {
+        Arc::new(EventLink {
+            queue: RwLock::new(Some(queue)),
+        })
+    }
+
+    pub(crate) fn close(&self) {
+        *self.queue.write().unwrap_or_else(|e| e.into_inner()) = None;
+    }
+}
+
+/// Queues events into a plugin instance from any thread. Queued events are merged into the
+/// block they fall in, in time order.
+#[derive(Clone)]
+pub struct EventSender {
+    pub(crate) link: Arc<EventLink>,
+}
+
+impl EventSender {
+    /// Returns false if the instance's queue is full or the instance has been dropped.
+    pub fn queue_event(&self, event: HostIssuedEvent, time: EventTime) -> bool {
+        let queue = self.link.queue.read().unwrap_or_else(|e| e.into_inner());
+        match &*queue {
+            Some(queue) => queue(&event, time),
+            None => false,
+        }
+    }
+}
+
 #[repr(C)]
 #[derive(Debug, Clone)]
 pub enum HostIssuedEventType {
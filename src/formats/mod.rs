@@ -2,7 +2,7 @@ mod clap;
 mod vst2;
 mod vst3;
 
-use std::path::Path;
+use std::{path::Path, time::Duration};
 
 use ringbuf::HeapProd;
 
@@ -10,6 +10,7 @@ use crate::discovery::*;
 use crate::error::{err, Error};
 use crate::event::PluginIssuedEvent;
 use crate::host::Host;
+use crate::logging::LogRecord;
 use crate::plugin::PluginInner;
 
 pub fn load_any(
@@ -31,6 +32,30 @@ pub fn load_any(
     err("The requested path was not a supported plugin format.")
 }
 
+/// Collects queued log records from the format wrappers that log through a ring.
+pub(crate) fn drain_log(records: &mut Vec<LogRecord>) {
+    vst3::drain_log(records);
+}
+
+/// Timeline tracing is only implemented by the VST3 wrapper.
+pub(crate) fn set_timeline_tracing(enabled: bool) {
+    vst3::set_timeline_tracing(enabled);
+}
+
+pub(crate) fn register_timeline_thread(name: &str) {
+    vst3::register_timeline_thread(name);
+}
+
+pub(crate) fn dump_timeline(path: &Path) -> Result<(), Error> {
+    vst3::dump_timeline(path)
+}
+
+/// Only VST3 plugins on Linux register with the host's run loop.
+pub(crate) fn run_loop_dispatch(timeout: Duration) {
+    let timeout_ms = timeout.as_millis().min(u32::MAX as u128) as u32;
+    vst3::run_loop_dispatch(timeout_ms);
+}
+
 /// Common data shared between all plugin formats.
 pub struct Common {
     pub host: Host,
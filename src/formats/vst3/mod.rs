@@ -1,19 +1,17 @@
-use std::collections::HashMap;
 use std::ffi::c_void;
 use std::path::Path;
+use std::sync::Arc;
 
-use ringbuf::traits::{Consumer, Producer};
-use ringbuf::{HeapProd, HeapRb};
-use vst3_wrapper_sys::{descriptor, get_parameter, set_param_in_edit_controller};
+use ringbuf::HeapProd;
+use vst3_wrapper_sys::{descriptor, get_parameter, LogRecordFFI};
 
 use crate::audio_bus::AudioBus;
 use crate::discovery::PluginDescriptor;
-use crate::error::Error;
-use crate::event::HostIssuedEventType;
-use crate::event::{HostIssuedEvent, PluginIssuedEvent};
-use crate::parameter::ParameterUpdate;
-use crate::plugin::PluginInner;
-use crate::{ProcessDetails, Samples};
+use crate::error::{err, Error};
+use crate::event::{EventLink, EventSender, HostIssuedEvent, PluginIssuedEvent};
+use crate::logging::LogRecord;
+use crate::plugin::{MemoryUsage, PluginInner};
+use crate::ProcessDetails;
 
 use super::Common;
 
@@ -22,7 +20,13 @@ mod vst3_wrapper_sys;
 struct Vst3 {
     app: *const c_void,
     _plugin_issued_events_producer: Box<HeapProd<PluginIssuedEvent>>,
-    param_updates_for_edit_controller: HeapRb<ParameterUpdate>,
+    event_link: Arc<EventLink>,
+}
+
+impl Drop for Vst3 {
+    fn drop(&mut self) {
+        self.event_link.close();
+    }
 }
 
 pub fn load(
@@ -31,36 +35,112 @@ pub fn load(
 ) -> Result<(Box<dyn PluginInner>, PluginDescriptor), Error> {
     let plugin_issued_events_producer = Box::new(common.plugin_issued_events_producer);
 
-    let app = unsafe {
-        let plugin_path = std::ffi::CString::new(path.to_str().unwrap()).unwrap();
-        vst3_wrapper_sys::load_plugin(
-            plugin_path.as_ptr(),
-            &*plugin_issued_events_producer as *const _ as *const c_void,
-        )
+    let plugin_path = std::ffi::CString::new(path.to_str().unwrap()).unwrap();
+    let producer = &*plugin_issued_events_producer as *const _ as *const c_void;
+
+    let app = match &common.host.sandbox_worker {
+        Some(worker) => {
+            let worker_path = std::ffi::CString::new(worker.to_str().unwrap()).unwrap();
+            let app = unsafe {
+                vst3_wrapper_sys::load_plugin_sandboxed(
+                    plugin_path.as_ptr(),
+                    producer,
+                    worker_path.as_ptr(),
+                )
+            };
+            if app.is_null() {
+                return err("Failed to load the plugin in the sandbox worker");
+            }
+            app
+        }
+        None => {
+            let app = unsafe { vst3_wrapper_sys::load_plugin(plugin_path.as_ptr(), producer) };
+            if app.is_null() {
+                return err("Failed to load the plugin");
+            }
+            app
+        }
     };
 
     let descriptor = unsafe { descriptor(app) }.to_plugin_descriptor(path);
+    let app_address = app as usize;
     let processor = Vst3 {
         app,
         _plugin_issued_events_producer: plugin_issued_events_producer,
-        param_updates_for_edit_controller: HeapRb::new(512),
+        event_link: EventLink::new(Box::new(move |event, time| unsafe {
+            vst3_wrapper_sys::queue_event(app_address as *const c_void, event, time)
+        })),
     };
 
     Ok((Box::new(processor), descriptor))
 }
 
+pub(super) fn drain_log(records: &mut Vec<LogRecord>) {
+    const BATCH: usize = 64;
+
+    let mut batch: [LogRecordFFI; BATCH] = unsafe { std::mem::zeroed() };
+    loop {
+        let count = unsafe { vst3_wrapper_sys::drain_log(batch.as_mut_ptr(), BATCH) };
+        records.extend(batch[..count].iter().map(|record| record.to_log_record()));
+
+        if count < BATCH {
+            break;
+        }
+    }
+}
+
+pub(super) fn set_timeline_tracing(enabled: bool) {
+    unsafe { vst3_wrapper_sys::set_timeline_tracing(enabled) };
+}
+
+pub(super) fn register_timeline_thread(name: &str) {
+    let name = std::ffi::CString::new(name).unwrap_or_default();
+    unsafe { vst3_wrapper_sys::register_timeline_thread(name.as_ptr()) };
+}
+
+pub(super) fn dump_timeline(path: &Path) -> Result<(), Error> {
+    let path = std::ffi::CString::new(path.to_str().unwrap()).unwrap();
+    if !unsafe { vst3_wrapper_sys::dump_timeline(path.as_ptr()) } {
+        return err("Failed to write the timeline");
+    }
+    Ok(())
+}
+
+pub(super) fn run_loop_dispatch(timeout_ms: u32) {
+    unsafe { vst3_wrapper_sys::run_loop_dispatch(timeout_ms) };
+}
+
+impl Vst3 {
+    /// Returns false if the block was skipped while a control call had the instance to itself,
+    /// leaving the outputs untouched.
+    fn process_ptrs(
+        &mut self,
+        input_ptrs: &mut [*mut *mut f32],
+        output_ptrs: &mut [*mut *mut f32],
+        mut events: Vec<HostIssuedEvent>,
+        process_details: &ProcessDetails,
+    ) -> bool {
+        unsafe {
+            vst3_wrapper_sys::process(
+                self.app,
+                process_details as *const ProcessDetails,
+                input_ptrs.as_mut_ptr(),
+                output_ptrs.as_mut_ptr(),
+                events.as_mut_ptr(),
+                events.len() as i32,
+            )
+        }
+    }
+}
+
 impl PluginInner for Vst3 {
     fn process(
         &mut self,
         inputs: &[AudioBus<f32>],
         outputs: &mut [AudioBus<f32>],
-        mut events: Vec<HostIssuedEvent>,
+        events: Vec<HostIssuedEvent>,
         process_details: &ProcessDetails,
     ) {
-        for update in last_param_updates(&events) {
-            let _ = self.param_updates_for_edit_controller.try_push(update);
-        }
-
         // TODO: Make real-time safe
         let mut channel_buffers = vec![];
 
@@ -85,15 +165,34 @@ impl PluginInner for Vst3 {
             output_ptrs.push(channel_buffers.last_mut().unwrap().as_mut_ptr());
         }
 
-        unsafe {
-            vst3_wrapper_sys::process(
-                self.app,
-                process_details as *const ProcessDetails,
-                input_ptrs.as_mut_ptr(),
-                output_ptrs.as_mut_ptr(),
-                events.as_mut_ptr(),
-                events.len() as i32,
-            );
+        if !self.process_ptrs(&mut input_ptrs, &mut output_ptrs, events, process_details) {
+            for channel in outputs.iter_mut().flat_map(|bus| bus.data.iter_mut()) {
+                channel.fill(0.0);
+            }
+        }
+    }
+
+    fn process_in_place(
+        &mut self,
+        buses: &mut [AudioBus<f32>],
+        events: Vec<HostIssuedEvent>,
+        process_details: &ProcessDetails,
+    ) {
+        // TODO: Make real-time safe
+        let mut channel_buffers: Vec<Vec<*mut f32>> = buses
+            .iter_mut()
+            .map(|bus| bus.data.iter_mut().map(|channel| channel.as_mut_ptr()).collect())
+            .collect();
+        let mut input_ptrs: Vec<*mut *mut f32> =
+            channel_buffers.iter_mut().map(|channels| channels.as_mut_ptr()).collect();
+        let mut output_ptrs = input_ptrs.clone();
+
+        // VST3 plugins must handle inputs and outputs sharing buffers, and the wrapper reads the
+        // inputs before anything is written
+        if !self.process_ptrs(&mut input_ptrs, &mut output_ptrs, events, process_details) {
+            for channel in buses.iter_mut().flat_map(|bus| bus.data.iter_mut()) {
+                channel.fill(0.0);
+            }
         }
     }
 
@@ -129,12 +228,26 @@ impl PluginInner for Vst3 {
         }
     }
 
-    fn get_preset_name(&mut self, _id: i32) -> Result<String, String> {
-        todo!()
+    fn get_preset_count(&mut self) -> usize {
+        unsafe { vst3_wrapper_sys::program_count(self.app) }
     }
 
-    fn set_preset(&mut self, _id: i32) -> Result<(), String> {
-        todo!()
+    fn get_preset_name(&mut self, id: i32) -> Result<String, String> {
+        let name = match usize::try_from(id) {
+            Ok(index) => unsafe { vst3_wrapper_sys::program_name(self.app, index) },
+            Err(_) => std::ptr::null(),
+        };
+        if name.is_null() {
+            return Err(format!("No preset {}", id));
+        }
+        Ok(vst3_wrapper_sys::load_and_free_c_string(name))
+    }
+
+    fn set_preset(&mut self, id: i32) -> Result<(), String> {
+        if id < 0 || !unsafe { vst3_wrapper_sys::set_program(self.app, id as usize) } {
+            return Err(format!("Failed to set preset {}", id));
+        }
+        Ok(())
     }
 
     fn get_parameter(&self, id: i32) -> crate::parameter::Parameter {
@@ -164,54 +277,84 @@ impl PluginInner for Vst3 {
     }
 
     fn get_latency(&mut self) -> crate::Samples {
-        0
+        unsafe { vst3_wrapper_sys::get_latency(self.app) }
+    }
+
+    fn prefetchable(&self) -> bool {
+        unsafe { vst3_wrapper_sys::prefetchable(self.app) }
     }
 
     fn editor_updates(&mut self) {
-        while let Some(update) = self.param_updates_for_edit_controller.try_pop() {
-            if !update.current_value.is_nan() {
-                unsafe {
-                    set_param_in_edit_controller(
-                        self.app,
-                        update.parameter_id,
-                        update.current_value,
-                    )
-                };
-            }
+        unsafe {
+            // Restarts are applied here, where processing can't run concurrently, and their
+            // events are forwarded by the flush for sandboxed plugins
+            vst3_wrapper_sys::apply_restart(self.app);
+            vst3_wrapper_sys::flush_param_updates(self.app);
         }
     }
 
     fn get_parameter_count(&self) -> usize {
         unsafe { vst3_wrapper_sys::parameter_count(self.app) }
     }
-}
 
-/// Gets param updates taking the final update at the latest sample for each parameter
-fn last_param_updates(events: &[HostIssuedEvent]) -> Vec<ParameterUpdate> {
-    struct ParamUpdate<'a> {
-        param: &'a ParameterUpdate,
-        block_time: Samples,
-    }
-
-    // FIXME: Make real-time safe
-    let mut updates: HashMap<i32, ParamUpdate> = HashMap::new();
-    for event in events {
-        if let HostIssuedEventType::Parameter(ref param) = event.event_type {
-            if let Some(existing) = updates.get_mut(&param.parameter_id) {
-                if event.block_time < existing.block_time {
-                    continue;
-                }
-            }
+    fn log_tag(&self) -> usize {
+        self.app as usize
+    }
 
-            updates.insert(
-                param.parameter_id,
-                ParamUpdate {
-                    param,
-                    block_time: event.block_time,
-                },
-            );
+    fn set_auto_sleep(&mut self, enabled: bool) {
+        unsafe { vst3_wrapper_sys::set_auto_sleep(self.app, enabled) };
+    }
+
+    fn set_fixed_block_size(&mut self, block_size: crate::BlockSize) -> Result<(), Error> {
+        if !unsafe { vst3_wrapper_sys::set_fixed_block_size(self.app, block_size as u32) } {
+            return err("Failed to set a fixed block size");
+        }
+        Ok(())
+    }
+
+    fn set_max_block_size(&mut self, max_block_size: crate::BlockSize) -> Result<(), Error> {
+        if !unsafe { vst3_wrapper_sys::set_max_block_size(self.app, max_block_size as u32) } {
+            return err("Failed to set the max block size");
+        }
+        Ok(())
+    }
+
+    fn memory_usage(&self) -> MemoryUsage {
+        unsafe { vst3_wrapper_sys::memory_usage(self.app) }
+    }
+
+    fn output_silence_flags(&self, bus: usize) -> u64 {
+        unsafe { vst3_wrapper_sys::output_silence_flags(self.app, bus) }
+    }
+
+    fn event_sender(&self) -> Option<EventSender> {
+        Some(EventSender {
+            link: self.event_link.clone(),
+        })
+    }
+
+    fn sample_position(&self) -> u64 {
+        unsafe { vst3_wrapper_sys::sample_position(self.app) }
+    }
+
+    fn start_capture(&mut self, path: &Path, include_state: bool) -> Result<(), Error> {
+        let path = std::ffi::CString::new(path.to_str().unwrap()).unwrap();
+        if !unsafe { vst3_wrapper_sys::start_capture(self.app, path.as_ptr(), include_state) } {
+            return err("Failed to start capture");
         }
+        Ok(())
     }
 
-    updates.values().map(|v| v.param.clone()).collect()
+    fn stop_capture(&mut self) {
+        unsafe { vst3_wrapper_sys::stop_capture(self.app) };
+    }
+
+    fn shared_channel_buffer(&self, output: bool, channel: usize) -> Option<*mut f32> {
+        let buffer = unsafe { vst3_wrapper_sys::sandbox_channel_buffer(self.app, output, channel) };
+        (!buffer.is_null()).then_some(buffer)
+    }
+
+    fn set_queued_control(&mut self, enabled: bool) {
+        unsafe { vst3_wrapper_sys::set_queued_control(self.app, enabled) };
+    }
 }
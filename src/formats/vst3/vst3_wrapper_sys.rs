@@ -7,23 +7,45 @@ use ringbuf::{traits::Producer, HeapProd};
 
 use crate::{
     audio_bus::IOConfigutaion,
-    event::{HostIssuedEvent, PluginIssuedEvent},
+    event::{EventTime, HostIssuedEvent, PluginIssuedEvent},
     formats::{Format, PluginDescriptor},
+    logging::{LogLevel, LogRecord},
     parameter::Parameter,
+    plugin::MemoryUsage,
     ProcessDetails,
 };
 
 #[link(name = "vst3wrapper", kind = "static")]
 extern "C" {
+    /// Returns null if the plugin fails to load.
     pub(super) fn load_plugin(
         s: *const c_char,
         plugin_sent_events_producer: *const c_void,
     ) -> *const c_void;
+    /// Loads the plugin in a worker process started from `worker_path` (the
+    /// `vst3wrapper_sandbox_worker` executable), so a crashing plugin cannot take the host down
+    /// with it. All other functions work the same on the returned instance, except the editor.
+    /// Returns null if the worker fails to start or to load the plugin.
+    pub(super) fn load_plugin_sandboxed(
+        s: *const c_char,
+        plugin_sent_events_producer: *const c_void,
+        worker_path: *const c_char,
+    ) -> *const c_void;
+    /// Shared memory buffer of a sandboxed plugin's input or output `channel`, counting channels
+    /// across buses. Audio rendered directly into these is not copied. Null for in-process plugins.
+    pub(super) fn sandbox_channel_buffer(app: *const c_void, output: bool, channel: usize)
+        -> *mut f32;
     pub(super) fn show_gui(app: *const c_void, window_id: *const c_void) -> Dims;
     pub(super) fn hide_gui(app: *const c_void);
     pub(super) fn descriptor(app: *const c_void) -> FFIPluginDescriptor;
     pub(super) fn io_config(app: *const c_void) -> IOConfigutaion;
     pub(super) fn parameter_count(app: *const c_void) -> usize;
+    pub(super) fn get_latency(app: *const c_void) -> usize;
+    /// Whether the plugin currently allows being processed ahead of the playhead, as reported by
+    /// `IPrefetchableSupport`. Plugins without the interface are assumed to allow it.
+    pub(super) fn prefetchable(app: *const c_void) -> bool;
+    /// Returns false if the block was skipped because a control call needed the instance to itself
+    /// (see `set_queued_control`). `output` is left untouched then.
     pub(super) fn process(
         app: *const c_void,
         data: *const ProcessDetails,
@@ -31,10 +53,51 @@ extern "C" {
         output: *mut *mut *mut f32,
         events: *mut HostIssuedEvent,
         events_len: i32,
-    );
-    pub(super) fn set_param_in_edit_controller(app: *const c_void, id: i32, value: f32);
+    ) -> bool;
+    pub(super) fn set_auto_sleep(app: *const c_void, enabled: bool);
+    /// Feeds the plugin constant blocks of `block_size` samples whatever block sizes `process` is
+    /// called with, adding `block_size` samples of latency, which is reported with `ChangeLatency`.
+    /// 0 disables it. Not supported for sandboxed plugins.
+    pub(super) fn set_fixed_block_size(app: *const c_void, block_size: u32) -> bool;
+    /// Tells the plugin the largest block `process` will be called with, so it can size its
+    /// buffers. Defaults to 8192, which is also the limit. The plugin is deactivated and
+    /// reactivated, so don't call it from the audio thread.
+    pub(super) fn set_max_block_size(app: *const c_void, max_block_size: u32) -> bool;
+    /// Bytes the wrapper allocated for the instance. Doesn't include the plugin's own allocations.
+    pub(super) fn memory_usage(app: *const c_void) -> MemoryUsage;
+    pub(super) fn output_silence_flags(app: *const c_void, bus: usize) -> u64;
+    /// Queues `event` for the block containing `time`. Safe to call from any thread. Returns
+    /// false if the queue is full.
+    pub(super) fn queue_event(
+        app: *const c_void,
+        event: *const HostIssuedEvent,
+        time: EventTime,
+    ) -> bool;
+    /// Number of samples processed since the plugin was loaded. The clock for
+    /// `EventTime::Samples`.
+    pub(super) fn sample_position(app: *const c_void) -> u64;
+    /// Applies the restarts the plugin requested through `restartComponent` since the last call,
+    /// then sends `IOChanged`, `ChangeLatency` and `UpdateDisplay` as needed. Changed buses are
+    /// rebuilt with processing stopped, so call it from the UI thread, not concurrently with
+    /// `process` unless queued control is enabled, and rebind buffers after `IOChanged`.
+    pub(super) fn apply_restart(app: *const c_void);
+    /// Mirrors every parameter changed by `process` since the last call to the edit controller.
+    pub(super) fn flush_param_updates(app: *const c_void);
+    /// Starts writing every block passed to `process` to a trace file at `path`, along with the
+    /// plugin's state if `include_state` is set. Replay it with `vst3wrapper_replay`.
+    pub(super) fn start_capture(app: *const c_void, path: *const c_char, include_state: bool)
+        -> bool;
+    pub(super) fn stop_capture(app: *const c_void);
     pub(super) fn get_parameter(app: *const c_void, id: i32) -> ParameterFFI;
 
+    /// Number of programs across the plugin's program lists. The lists are read once, on first use,
+    /// and cached.
+    pub(super) fn program_count(app: *const c_void) -> usize;
+    /// Name of program `index`, counting across program lists. Null if out of range.
+    pub(super) fn program_name(app: *const c_void, index: usize) -> *const c_char;
+    /// Switches to program `index` at the start of the next block, through the program change
+    /// parameter of its unit. Returns false if out of range or the unit has no such parameter.
+    pub(super) fn set_program(app: *const c_void, index: usize) -> bool;
     pub(super) fn get_data(
         app: *const c_void,
         data_len: *mut i32,
@@ -44,6 +107,27 @@ extern "C" {
     pub(super) fn set_data(app: *const c_void, data: *const c_void, data_len: i32);
     pub(super) fn set_processing(app: *const c_void, processing: bool);
 
+    /// While enabled, control calls such as `set_processing` and `set_data` are queued and applied
+    /// at the start of the next block by whichever thread calls `process`, so C callers may make
+    /// them concurrently with it. Returns false from `process` for skipped blocks.
+    pub(super) fn set_queued_control(app: *const c_void, enabled: bool);
+
+    pub(super) fn drain_log(records: *mut LogRecordFFI, max_records: usize) -> usize;
+
+    /// Starts or stops recording wrapper calls of every instance into per-thread timelines.
+    /// Registers the calling thread when enabling.
+    pub(super) fn set_timeline_tracing(enabled: bool);
+    /// Allocates a timeline for the calling thread, labelled `name` in dumps. Only registered
+    /// threads record, so call it from the audio thread before tracing it, outside of `process`.
+    pub(super) fn register_timeline_thread(name: *const c_char);
+    /// Writes the recorded timelines to `path` as Chrome trace JSON.
+    pub(super) fn dump_timeline(path: *const c_char) -> bool;
+
+    /// Calls the timer and file descriptor handlers plugins registered with the host's run loop,
+    /// waiting up to `timeout_ms` for one to become ready. Linux plugins rely on it for their
+    /// timers and editors, so call it regularly from the UI thread.
+    pub(super) fn run_loop_dispatch(timeout_ms: u32);
+
     fn free_string(str: *const c_char);
 }
 
@@ -122,7 +206,32 @@ impl ParameterFFI {
     }
 }
 
-fn load_and_free_c_string(s: *const c_char) -> String {
+/// A diagnostic message logged by the wrapper. `tag` identifies the plugin instance that logged
+/// it, or is 0 for messages not tied to an instance.
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub(super) struct LogRecordFFI {
+    level: LogLevel,
+    tag: usize,
+    /// Number of identical messages that were dropped by rate limiting before this one.
+    suppressed: u32,
+    message: [c_char; 128],
+}
+
+impl LogRecordFFI {
+    pub fn to_log_record(self) -> LogRecord {
+        let message = unsafe { std::ffi::CStr::from_ptr(self.message.as_ptr()) };
+
+        LogRecord {
+            level: self.level,
+            tag: self.tag,
+            suppressed: self.suppressed,
+            message: message.to_string_lossy().into_owned(),
+        }
+    }
+}
+
+pub(super) fn load_and_free_c_string(s: *const c_char) -> String {
     if s.is_null() {
         return "?".to_string();
     }
@@ -5,6 +5,9 @@ pub struct Host {
     pub vendor: &'static str,
     pub knob_preference: Option<KnobPreference>,
     pub language: Option<Language>,
+    /// Path to the `vst3wrapper_sandbox_worker` executable. When set, VST3 plugins are loaded
+    /// in a separate worker process so a crashing plugin can't take the host down with it.
+    pub sandbox_worker: Option<std::path::PathBuf>,
 }
 
 impl Host {
@@ -0,0 +1,316 @@
+use crate::{
+    audio_bus::{AudioBus, BufferArena},
+    event::HostIssuedEvent,
+    plugin::PluginInstance,
+    BlockSize, ProcessDetails,
+};
+
+/// How the host's audio is laid out when handed to an `IoAdapter`. Channels are numbered across
+/// buses: all channels of bus 0, then bus 1, etc.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum HostBufferLayout {
+    /// Frames of samples, e.g. `L0 R0 L1 R1 ...`.
+    Interleaved,
+    /// Each channel's block stored back to back, e.g. `L0 L1 ... R0 R1 ...`.
+    PlanarContiguous,
+}
+
+/// Converts between the host's buffer layout and a plugin's per-channel buses. The channel
+/// buffers live in a `BufferArena` owned by the adapter, so each instance gets its own.
+/// Conversions use AVX2 or SSE kernels where available.
+pub struct IoAdapter {
+    inputs: Vec<AudioBus<'static, f32>>,
+    outputs: Vec<AudioBus<'static, f32>>,
+    input_ptrs: Vec<*mut f32>,
+    output_ptrs: Vec<*mut f32>,
+    layout: HostBufferLayout,
+    _arena: BufferArena<f32>,
+}
+
+unsafe impl Send for IoAdapter {}
+
+impl IoAdapter {
+    /// {UI thread} Must be recreated if the plugin's IO configuration changes.
+    pub fn new(
+        plugin: &PluginInstance,
+        layout: HostBufferLayout,
+        max_block_size: BlockSize,
+    ) -> Self {
+        let mut arena = plugin.create_buffer_arena(max_block_size, 0);
+        let buses = arena.buses(max_block_size);
+
+        // The views point into the arena's heap allocation, which the adapter owns and never
+        // resizes, so they stay valid for the adapter's lifetime.
+        let inputs: Vec<AudioBus<'static, f32>> = unsafe { std::mem::transmute(buses.inputs) };
+        let outputs: Vec<AudioBus<'static, f32>> = unsafe { std::mem::transmute(buses.outputs) };
+
+        let input_ptrs = channel_ptrs(&inputs);
+        let output_ptrs = channel_ptrs(&outputs);
+
+        IoAdapter {
+            inputs,
+            outputs,
+            input_ptrs,
+            output_ptrs,
+            layout,
+            _arena: arena,
+        }
+    }
+
+    pub fn layout(&self) -> HostBufferLayout {
+        self.layout
+    }
+
+    pub fn set_layout(&mut self, layout: HostBufferLayout) {
+        self.layout = layout;
+    }
+
+    /// {Audio thread} Converts `input` into the plugin's input buses, processes one block of
+    /// `process_details.block_size` frames and converts the plugin's outputs into `output`.
+    pub fn process(
+        &mut self,
+        plugin: &mut PluginInstance,
+        input: &[f32],
+        output: &mut [f32],
+        events: Vec<HostIssuedEvent>,
+        process_details: &ProcessDetails,
+    ) {
+        let frames = process_details.block_size;
+        assert!(input.len() >= frames * self.input_ptrs.len(), "Input buffer too short");
+        assert!(output.len() >= frames * self.output_ptrs.len(), "Output buffer too short");
+
+        self.bind(frames);
+
+        unsafe {
+            match self.layout {
+                HostBufferLayout::Interleaved => {
+                    deinterleave_raw(input, &self.input_ptrs, frames);
+                }
+                HostBufferLayout::PlanarContiguous => {
+                    for (c, &channel) in self.input_ptrs.iter().enumerate() {
+                        let src = &input[c * frames..(c + 1) * frames];
+                        std::ptr::copy_nonoverlapping(src.as_ptr(), channel, frames);
+                    }
+                }
+            }
+        }
+
+        plugin.process(&self.inputs, &mut self.outputs, events, process_details);
+
+        unsafe {
+            match self.layout {
+                HostBufferLayout::Interleaved => {
+                    interleave_raw(&self.output_ptrs, output, frames);
+                }
+                HostBufferLayout::PlanarContiguous => {
+                    for (c, &channel) in self.output_ptrs.iter().enumerate() {
+                        let dst = &mut output[c * frames..(c + 1) * frames];
+                        std::ptr::copy_nonoverlapping(channel, dst.as_mut_ptr(), frames);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Resizes the bus views to `frames` without allocating.
+    fn bind(&mut self, frames: usize) {
+        let mut ptrs = self.input_ptrs.iter();
+        for bus in self.inputs.iter_mut() {
+            for channel in bus.data.iter_mut() {
+                *channel = unsafe { std::slice::from_raw_parts_mut(*ptrs.next().unwrap(), frames) };
+            }
+        }
+
+        let mut ptrs = self.output_ptrs.iter();
+        for bus in self.outputs.iter_mut() {
+            for channel in bus.data.iter_mut() {
+                *channel = unsafe { std::slice::from_raw_parts_mut(*ptrs.next().unwrap(), frames) };
+            }
+        }
+    }
+}
+
+fn channel_ptrs(buses: &[AudioBus<'static, f32>]) -> Vec<*mut f32> {
+    buses
+        .iter()
+        .flat_map(|bus| bus.data.iter().map(|channel| channel.as_ptr() as *mut f32))
+        .collect()
+}
+
+/// Splits interleaved frames in `src` into one slice per channel.
+pub fn deinterleave(src: &[f32], dst: &mut [&mut [f32]]) {
+    let frames = dst.iter().map(|channel| channel.len()).min().unwrap_or(0);
+    assert!(src.len() >= frames * dst.len(), "Source buffer too short");
+
+    let ptrs: Vec<*mut f32> = dst.iter_mut().map(|channel| channel.as_mut_ptr()).collect();
+    unsafe { deinterleave_raw(src, &ptrs, frames) };
+}
+
+/// Interleaves one slice per channel into frames in `dst`.
+pub fn interleave(src: &[&[f32]], dst: &mut [f32]) {
+    let frames = src.iter().map(|channel| channel.len()).min().unwrap_or(0);
+    assert!(dst.len() >= frames * src.len(), "Destination buffer too short");
+
+    let ptrs: Vec<*mut f32> = src.iter().map(|channel| channel.as_ptr() as *mut f32).collect();
+    unsafe { interleave_raw(&ptrs, dst, frames) };
+}
+
+/// # Safety
+/// Every pointer in `dst` must be valid for `frames` writes and `src` must hold
+/// `frames * dst.len()` samples.
+unsafe fn deinterleave_raw(src: &[f32], dst: &[*mut f32], frames: usize) {
+    match dst.len() {
+        0 => {}
+        1 => std::ptr::copy_nonoverlapping(src.as_ptr(), dst[0], frames),
+        2 => deinterleave_stereo(src.as_ptr(), dst[0], dst[1], frames),
+        channels => {
+            for (c, &channel) in dst.iter().enumerate() {
+                for i in 0..frames {
+                    *channel.add(i) = *src.get_unchecked(i * channels + c);
+                }
+            }
+        }
+    }
+}
+
+/// # Safety
+/// Every pointer in `src` must be valid for `frames` reads and `dst` must hold
+/// `frames * src.len()` samples.
+unsafe fn interleave_raw(src: &[*mut f32], dst: &mut [f32], frames: usize) {
+    match src.len() {
+        0 => {}
+        1 => std::ptr::copy_nonoverlapping(src[0], dst.as_mut_ptr(), frames),
+        2 => interleave_stereo(src[0], src[1], dst.as_mut_ptr(), frames),
+        channels => {
+            for (c, &channel) in src.iter().enumerate() {
+                for i in 0..frames {
+                    *dst.get_unchecked_mut(i * channels + c) = *channel.add(i);
+                }
+            }
+        }
+    }
+}
+
+unsafe fn deinterleave_stereo(src: *const f32, left: *mut f32, right: *mut f32, frames: usize) {
+    #[cfg(target_arch = "x86_64")]
+    let mut i = if is_x86_feature_detected!("avx2") {
+        x86::deinterleave_stereo_avx2(src, left, right, frames)
+    } else {
+        x86::deinterleave_stereo_sse(src, left, right, frames)
+    };
+    #[cfg(not(target_arch = "x86_64"))]
+    let mut i = 0;
+
+    while i < frames {
+        *left.add(i) = *src.add(i * 2);
+        *right.add(i) = *src.add(i * 2 + 1);
+        i += 1;
+    }
+}
+
+unsafe fn interleave_stereo(left: *const f32, right: *const f32, dst: *mut f32, frames: usize) {
+    #[cfg(target_arch = "x86_64")]
+    let mut i = if is_x86_feature_detected!("avx2") {
+        x86::interleave_stereo_avx2(left, right, dst, frames)
+    } else {
+        x86::interleave_stereo_sse(left, right, dst, frames)
+    };
+    #[cfg(not(target_arch = "x86_64"))]
+    let mut i = 0;
+
+    while i < frames {
+        *dst.add(i * 2) = *left.add(i);
+        *dst.add(i * 2 + 1) = *right.add(i);
+        i += 1;
+    }
+}
+
+/// Stereo kernels. Each returns the number of frames it handled; the caller finishes the rest.
+#[cfg(target_arch = "x86_64")]
+mod x86 {
+    use std::arch::x86_64::*;
+
+    #[target_feature(enable = "avx2")]
+    pub(super) unsafe fn deinterleave_stereo_avx2(
+        src: *const f32,
+        left: *mut f32,
+        right: *mut f32,
+        frames: usize,
+    ) -> usize {
+        let mut i = 0;
+        while i + 8 <= frames {
+            let a = _mm256_loadu_ps(src.add(i * 2));
+            let b = _mm256_loadu_ps(src.add(i * 2 + 8));
+
+            // Per 128 bit lane: [L0 L1 L4 L5 | L2 L3 L6 L7], then fix the lane order.
+            let l = _mm256_shuffle_ps::<0b10_00_10_00>(a, b);
+            let r = _mm256_shuffle_ps::<0b11_01_11_01>(a, b);
+            let l = _mm256_castpd_ps(_mm256_permute4x64_pd::<0b11_01_10_00>(_mm256_castps_pd(l)));
+            let r = _mm256_castpd_ps(_mm256_permute4x64_pd::<0b11_01_10_00>(_mm256_castps_pd(r)));
+
+            _mm256_storeu_ps(left.add(i), l);
+            _mm256_storeu_ps(right.add(i), r);
+            i += 8;
+        }
+        i
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub(super) unsafe fn interleave_stereo_avx2(
+        left: *const f32,
+        right: *const f32,
+        dst: *mut f32,
+        frames: usize,
+    ) -> usize {
+        let mut i = 0;
+        while i + 8 <= frames {
+            let l = _mm256_loadu_ps(left.add(i));
+            let r = _mm256_loadu_ps(right.add(i));
+
+            // Per 128 bit lane: lo = [L0 R0 L1 R1 | L4 R4 L5 R5], hi = [L2 R2 L3 R3 | L6 R6 L7 R7]
+            let lo = _mm256_unpacklo_ps(l, r);
+            let hi = _mm256_unpackhi_ps(l, r);
+
+            _mm256_storeu_ps(dst.add(i * 2), _mm256_permute2f128_ps::<0x20>(lo, hi));
+            _mm256_storeu_ps(dst.add(i * 2 + 8), _mm256_permute2f128_ps::<0x31>(lo, hi));
+            i += 8;
+        }
+        i
+    }
+
+    pub(super) unsafe fn deinterleave_stereo_sse(
+        src: *const f32,
+        left: *mut f32,
+        right: *mut f32,
+        frames: usize,
+    ) -> usize {
+        let mut i = 0;
+        while i + 4 <= frames {
+            let a = _mm_loadu_ps(src.add(i * 2));
+            let b = _mm_loadu_ps(src.add(i * 2 + 4));
+
+            _mm_storeu_ps(left.add(i), _mm_shuffle_ps::<0b10_00_10_00>(a, b));
+            _mm_storeu_ps(right.add(i), _mm_shuffle_ps::<0b11_01_11_01>(a, b));
+            i += 4;
+        }
+        i
+    }
+
+    pub(super) unsafe fn interleave_stereo_sse(
+        left: *const f32,
+        right: *const f32,
+        dst: *mut f32,
+        frames: usize,
+    ) -> usize {
+        let mut i = 0;
+        while i + 4 <= frames {
+            let l = _mm_loadu_ps(left.add(i));
+            let r = _mm_loadu_ps(right.add(i));
+
+            _mm_storeu_ps(dst.add(i * 2), _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(dst.add(i * 2 + 4), _mm_unpackhi_ps(l, r));
+            i += 4;
+        }
+        i
+    }
+}
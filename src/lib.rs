@@ -1,14 +1,21 @@
 #![doc = include_str!("../README.md")]
 
+pub mod anticipative;
 pub mod audio_bus;
+pub mod automation;
+pub mod chain;
+pub mod delay_compensation;
 pub mod discovery;
 pub mod error;
 pub mod event;
 pub mod host;
+pub mod io_adapter;
+pub mod logging;
 pub mod parameter;
 pub mod plugin;
+pub mod render_cache;
 
-pub use plugin::load;
+pub use plugin::{load, load_plugins, run_loop_dispatch};
 
 mod formats;
 pub mod heapless_vec;
@@ -57,6 +64,32 @@ impl Default for ProcessDetails {
     }
 }
 
+impl ProcessDetails {
+    /// Moves the transport on by `frames` samples at the current tempo, wrapping around the
+    /// cycle like a host would.
+    pub(crate) fn advance(&mut self, frames: usize) {
+        let seconds = frames as f64 / self.sample_rate as f64;
+        self.nanos += seconds * 1e9;
+
+        if self.playing_state == PlayingState::Stopped {
+            return;
+        }
+
+        self.player_time += seconds * self.tempo / 60.0;
+
+        let cycle_length = self.cycle_end - self.cycle_start;
+        if self.cycle_enabled && cycle_length > 0.0 && self.player_time >= self.cycle_end {
+            self.player_time -= cycle_length;
+        }
+
+        let bar_length = self.time_signature_numerator as f64 * 4.0
+            / self.time_signature_denominator.max(1) as f64;
+        if bar_length > 0.0 {
+            self.bar_start_pos = (self.player_time / bar_length).floor() * bar_length;
+        }
+    }
+}
+
 #[derive(Default, PartialEq, Eq, Clone, Copy, Debug)]
 #[repr(u8)]
 pub enum PlayingState {
@@ -0,0 +1,53 @@
+/// Severity of a message logged by a plugin wrapper.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+#[repr(u8)]
+pub enum LogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error,
+}
+
+/// A diagnostic message logged by a plugin wrapper. Wrappers never print on the audio thread;
+/// instead messages are queued in a fixed-size ring and handed out by `drain_log`.
+#[derive(Debug, Clone)]
+pub struct LogRecord {
+    pub level: LogLevel,
+    /// Identifies the plugin instance that logged the message. Compare with
+    /// `PluginInstance::log_tag`. 0 if the message isn't tied to an instance.
+    pub tag: usize,
+    /// Number of identical messages from the same instance that were dropped by rate limiting
+    /// before this one.
+    pub suppressed: u32,
+    pub message: String,
+}
+
+/// {UI thread} Takes all queued log records from every loaded plugin. Should be called routinely
+/// (e.g. alongside `PluginInstance::get_events`) so the ring doesn't fill up and drop messages.
+pub fn drain_log() -> Vec<LogRecord> {
+    let mut records = Vec::new();
+    crate::formats::drain_log(&mut records);
+    records
+}
+
+/// {Any thread} Starts or stops recording a timeline of wrapper calls (loading, processing,
+/// state, editor and controller callbacks) with timestamps and thread IDs. Each registered thread
+/// records into its own lock-free buffer, keeping its most recent spans. Enabling registers the
+/// calling thread.
+pub fn set_timeline_tracing(enabled: bool) {
+    crate::formats::set_timeline_tracing(enabled);
+}
+
+/// {Any thread} Allocates the calling thread's timeline buffer and labels it `name` in dumps.
+/// Calls on threads that never registered aren't recorded, so the audio thread should register
+/// once outside of `process`, e.g. when the audio device starts.
+pub fn register_timeline_thread(name: &str) {
+    crate::formats::register_timeline_thread(name);
+}
+
+/// {UI thread} Writes the recorded timeline to `path` as Chrome trace JSON, which can be opened in
+/// `chrome://tracing` or Perfetto to see e.g. a controller callback on the UI thread overlapping a
+/// slow audio block.
+pub fn dump_timeline<P: AsRef<std::path::Path>>(path: P) -> Result<(), crate::error::Error> {
+    crate::formats::dump_timeline(path.as_ref())
+}
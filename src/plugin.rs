@@ -1,12 +1,20 @@
-use std::{any::Any, path::Path, sync::atomic::AtomicUsize};
+use std::{
+    any::Any,
+    path::Path,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Mutex,
+    },
+    time::Duration,
+};
 
 use ringbuf::{traits::*, HeapCons, HeapRb};
 
 use crate::{
-    audio_bus::{AudioBus, IOConfigutaion},
+    audio_bus::{AudioBus, BufferArena, IOConfigutaion},
     discovery::PluginDescriptor,
     error::{err, Error},
-    event::{HostIssuedEvent, PluginIssuedEvent},
+    event::{EventSender, HostIssuedEvent, PluginIssuedEvent},
     heapless_vec::HeaplessVec,
     host::Host,
     parameter::Parameter,
@@ -43,6 +51,79 @@ pub fn load<P: AsRef<Path>>(path: P, host: &Host) -> Result<PluginInstance, Erro
     })
 }
 
+/// Loads many plugins at once, e.g. when opening a project, spread over a thread per core.
+/// `states[i]`, where given, is restored into plugin `i` with `set_preset_data`. Results are in
+/// the order of `paths`.
+///
+/// Plugins may keep unsynchronised state per module, so instances of one module are created one
+/// at a time. Loads are interleaved across modules to keep every thread busy.
+pub fn load_plugins<P: AsRef<Path> + Sync>(
+    paths: &[P],
+    states: &[Option<Vec<u8>>],
+    host: &Host,
+) -> Vec<Result<PluginInstance, Error>> {
+    let order = interleave_by_module(paths);
+    let next = AtomicUsize::new(0);
+    let results: Vec<Mutex<Option<Result<PluginInstance, Error>>>> =
+        paths.iter().map(|_| Mutex::new(None)).collect();
+
+    let threads = std::thread::available_parallelism()
+        .map_or(1, |n| n.get())
+        .min(paths.len());
+
+    std::thread::scope(|scope| {
+        for _ in 0..threads {
+            scope.spawn(|| {
+                while let Some(&index) = order.get(next.fetch_add(1, Ordering::Relaxed)) {
+                    let result = load(&paths[index], host).and_then(|mut plugin| {
+                        if let Some(Some(state)) = states.get(index) {
+                            plugin.set_preset_data(state.clone()).or_else(err)?;
+                        }
+                        Ok(plugin)
+                    });
+                    *results[index].lock().unwrap() = Some(result);
+                }
+            });
+        }
+    });
+
+    results
+        .into_iter()
+        .map(|result| result.into_inner().unwrap().unwrap())
+        .collect()
+}
+
+/// {UI thread} Runs the timers and file descriptor handlers plugins registered with the host,
+/// waiting up to `timeout` for one to become ready. On Linux there is no system event loop for
+/// plugins to hook into, so this is what drives their timers, deferred work and editors; call it
+/// regularly, e.g. every 10 ms, even without a display.
+pub fn run_loop_dispatch(timeout: Duration) {
+    crate::formats::run_loop_dispatch(timeout);
+}
+
+/// Round robin over modules in order of first use, so each module's first instance, which loads
+/// the module, comes first and consecutive loads rarely wait on the same module.
+fn interleave_by_module<P: AsRef<Path>>(paths: &[P]) -> Vec<usize> {
+    let mut modules: Vec<(&Path, Vec<usize>)> = Vec::new();
+    for (index, path) in paths.iter().enumerate() {
+        let path = path.as_ref();
+        match modules.iter_mut().find(|(module, _)| *module == path) {
+            Some((_, indices)) => indices.push(index),
+            None => modules.push((path, vec![index])),
+        }
+    }
+
+    let mut order = Vec::with_capacity(paths.len());
+    for round in 0.. {
+        let before = order.len();
+        order.extend(modules.iter().filter_map(|(_, indices)| indices.get(round)));
+        if order.len() == before {
+            break;
+        }
+    }
+    order
+}
+
 pub struct PluginInstance {
     pub descriptor: PluginDescriptor,
     /// `Box` to store a window object for convenience. This isn't used by this
@@ -82,6 +163,26 @@ impl PluginInstance {
         self.inner.process(inputs, outputs, events, process_details);
     }
 
+    /// {Audio thread} Like `process` for plugins whose input and output buses have the same
+    /// layout: `buses` holds the inputs and is overwritten with the outputs. Formats that support
+    /// it are handed the same channels for both, others process from a copy of the inputs.
+    pub fn process_in_place(
+        &mut self,
+        buses: &mut Vec<AudioBus<f32>>,
+        events: Vec<HostIssuedEvent>,
+        process_details: &ProcessDetails,
+    ) {
+        if let Err(e) = self.io_configuration.matches(buses, buses) {
+            panic!("Buses do not match the plugin's IO configuration:\n{}", e);
+        }
+
+        self.resume();
+
+        self.fix_configuration(process_details);
+
+        self.inner.process_in_place(buses, events, process_details);
+    }
+
     /// {UI Thread} Must be called routinely by the UI thread. Consume `PluginIssuedEvent`s
     /// queued by the plugin. Informs the host of parameter changes in the editor, latency
     /// changes, etc.
@@ -110,6 +211,30 @@ impl PluginInstance {
         io
     }
 
+    /// {UI thread} Allocates every input and output channel for the current IO configuration,
+    /// plus `scratch_channels` extra channels, as one aligned block sized for `max_block_size`.
+    /// Take per-block bus views with `BufferArena::buses`. Must be recreated if the IO
+    /// configuration changes.
+    pub fn create_buffer_arena(
+        &self,
+        max_block_size: BlockSize,
+        scratch_channels: usize,
+    ) -> BufferArena<f32> {
+        BufferArena::new(&self.io_configuration, max_block_size, scratch_channels)
+    }
+
+    /// {UI thread} Like `create_buffer_arena` without scratch channels, but for a sandboxed plugin
+    /// the arena points straight at the buffers shared with the worker, so processing it copies
+    /// no audio. Other plugins get an allocated arena.
+    ///
+    /// # Safety
+    /// The shared buffers are unmapped when the instance is dropped, so the arena and every view
+    /// taken from it must be dropped before the instance.
+    pub unsafe fn create_shared_buffer_arena(&self, max_block_size: BlockSize) -> BufferArena<f32> {
+        self.shared_buffer_arena(max_block_size)
+            .unwrap_or_else(|| BufferArena::new(&self.io_configuration, max_block_size, 0))
+    }
+
     pub fn resume(&mut self) {
         if self.resumed {
             return;
@@ -140,10 +265,19 @@ impl PluginInstance {
         self.inner.set_preset_data(data)
     }
 
+    /// {UI thread} Number of factory presets. For VST3 these are the programs of every unit's
+    /// program list, read once and cached, so browsing them doesn't call into the plugin.
+    pub fn get_preset_count(&mut self) -> usize {
+        self.inner.get_preset_count()
+    }
+
+    /// {UI thread} `id` counts from 0 to `get_preset_count`.
     pub fn get_preset_name(&mut self, id: i32) -> Result<String, String> {
         self.inner.get_preset_name(id)
     }
 
+    /// {UI thread} Switches preset at the start of the next processed block, sample accurately
+    /// for VST3 where it is applied through the unit's program change parameter.
     pub fn set_preset(&mut self, id: i32) -> Result<(), String> {
         self.inner.set_preset(id)
     }
@@ -193,6 +327,131 @@ impl PluginInstance {
         self.showing_editor
     }
 
+    /// {UI thread} Enables or disables auto sleep (off by default). While sleeping, `process`
+    /// skips the plugin entirely and outputs silence. A plugin falls asleep once its inputs have
+    /// been silent for longer than its tail, no notes are held and it has output silence itself.
+    /// Any input, event or change of playing state or tempo wakes it up. Only enable it for
+    /// instruments that don't sound without notes.
+    pub fn set_auto_sleep(&mut self, enabled: bool) {
+        self.inner.set_auto_sleep(enabled);
+    }
+
+    /// {UI thread} Feeds the plugin constant blocks of `block_size` samples whatever block sizes
+    /// `process` is called with, e.g. so FFT based plugins run at their efficient size. Audio is
+    /// buffered through preallocated FIFOs, which adds `block_size` samples of latency, reported
+    /// through `get_latency` and a `ChangeLatency` event. `None` turns it off.
+    pub fn set_fixed_block_size(&mut self, block_size: Option<BlockSize>) -> Result<(), Error> {
+        let resumed = self.resumed;
+        self.suspend();
+        let result = self.inner.set_fixed_block_size(block_size.unwrap_or(0));
+        if resumed {
+            self.resume();
+        }
+        result
+    }
+
+    /// {UI thread} Tells the plugin the largest block `process` will be called with, so it sizes
+    /// its buffers for it instead of for the 8192 sample default. Blocks passed to `process` must
+    /// not exceed it. A block takes up to one MIDI event per sample of this size (at most 1024);
+    /// further events are dropped and logged.
+    pub fn set_max_block_size(&mut self, max_block_size: BlockSize) -> Result<(), Error> {
+        let resumed = self.resumed;
+        self.suspend();
+        let result = self.inner.set_max_block_size(max_block_size);
+        if resumed {
+            self.resume();
+        }
+        result
+    }
+
+    /// {UI thread} Bytes the wrapper allocated for this instance, by structure.
+    pub fn memory_usage(&self) -> MemoryUsage {
+        self.inner.memory_usage()
+    }
+
+    /// {Audio thread} Bit mask of the channels of output bus `bus` that were silent in the last
+    /// `process` call. Bit `n` is channel `n`. Always 0 for formats that don't report silence.
+    pub fn output_silence_flags(&self, bus: usize) -> u64 {
+        self.inner.output_silence_flags(bus)
+    }
+
+    /// {UI thread} While enabled, where supported, control calls such as `suspend`, `resume` and
+    /// `set_preset_data` are queued and applied at the start of the next block on whichever
+    /// thread processes. Calls that need the plugin to themselves, like `set_max_block_size`,
+    /// make `process` output silence for the blocks they overlap rather than block the audio
+    /// thread.
+    ///
+    /// Every method here takes `&mut self`, so safe Rust never makes a control call while
+    /// `process` runs; through this API the mode only moves control work onto the processing
+    /// thread. It is meant for the wrapper's C ABI, where hosts and the sandbox worker do call
+    /// into an instance from several threads at once.
+    pub fn set_queued_control(&mut self, enabled: bool) {
+        self.inner.set_queued_control(enabled);
+    }
+
+    /// {Any thread} Handle for queueing events from other threads, for formats that support it.
+    pub fn event_sender(&self) -> Option<EventSender> {
+        self.inner.event_sender()
+    }
+
+    /// {Any thread} Samples processed since the plugin was loaded. The clock that
+    /// `EventTime::Samples` is measured against.
+    pub fn sample_position(&self) -> u64 {
+        self.inner.sample_position()
+    }
+
+    /// {UI thread} Starts recording every `process` call (transport, events and input audio) to
+    /// a trace file at `path`, optionally with the plugin's current state. Traces are replayed
+    /// with the `vst3wrapper_replay` tool, e.g. to reproduce a CPU spike under a profiler.
+    pub fn start_capture<P: AsRef<Path>>(
+        &mut self,
+        path: P,
+        include_state: bool,
+    ) -> Result<(), Error> {
+        self.inner.start_capture(path.as_ref(), include_state)
+    }
+
+    /// {UI thread} Stops the capture and flushes the trace file.
+    pub fn stop_capture(&mut self) {
+        self.inner.stop_capture();
+    }
+
+    /// {UI thread} Whether the plugin can currently be rendered ahead of the playhead by an
+    /// `AnticipativeTrack`. Plugins that depend on live timing or external input opt out, through
+    /// `IPrefetchableSupport` for VST3.
+    pub fn prefetchable(&self) -> bool {
+        self.inner.prefetchable()
+    }
+
+    /// {Any thread} Tag attached to `LogRecord`s logged by this instance.
+    pub fn log_tag(&self) -> usize {
+        self.inner.log_tag()
+    }
+
+    fn shared_buffer_arena(&self, max_block_size: BlockSize) -> Option<BufferArena<f32>> {
+        let inputs = self.inner.shared_channel_buffer(false, 0)?;
+        let outputs = self.inner.shared_channel_buffer(true, 0)?;
+        let stride = unsafe { self.inner.shared_channel_buffer(false, 1)?.offset_from(inputs) };
+
+        let io = &self.io_configuration;
+        let input_channels: usize = io.audio_inputs.iter().map(|b| b.channels).sum();
+        let output_channels: usize = io.audio_outputs.iter().map(|b| b.channels).sum();
+
+        let fits = stride > 0
+            && max_block_size <= stride as usize
+            && (input_channels == 0
+                || self.inner.shared_channel_buffer(false, input_channels - 1).is_some())
+            && (output_channels == 0
+                || self.inner.shared_channel_buffer(true, output_channels - 1).is_some());
+        if !fits {
+            return None;
+        }
+
+        Some(unsafe {
+            BufferArena::from_shared(io, max_block_size, inputs, outputs, stride as usize)
+        })
+    }
+
     fn fix_configuration(&mut self, process_details: &ProcessDetails) {
         if self.sample_rate != process_details.sample_rate {
             self.sample_rate = process_details.sample_rate;
@@ -212,11 +471,19 @@ impl PluginInstance {
                 self.io_configuration = self.inner.get_io_configuration();
 
                 let latency = self.inner.get_latency();
+                let previous = self.latency.swap(latency, Ordering::Relaxed);
 
+                if latency != previous {
+                    vec![PluginIssuedEvent::ChangeLatency(latency)]
+                } else {
+                    vec![]
+                }
+            }
+            PluginIssuedEvent::ChangeLatency(latency) => {
                 self.latency
-                    .store(latency, std::sync::atomic::Ordering::Relaxed);
+                    .store(*latency, std::sync::atomic::Ordering::Relaxed);
 
-                vec![PluginIssuedEvent::ChangeLatency(latency)]
+                vec![]
             }
             _ => {
                 vec![]
@@ -225,6 +492,32 @@ impl PluginInstance {
     }
 }
 
+/// Bytes the wrapper allocated for one plugin instance, by structure. The plugin's own
+/// allocations are not included.
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct MemoryUsage {
+    /// The instance itself, including its fixed-capacity command queues.
+    pub instance: usize,
+    /// Bus and channel pointer arrays handed to the plugin. Channels point at the host's buffers.
+    pub process_data: usize,
+    /// MIDI passed to the plugin, sized for one block.
+    pub event_lists: usize,
+    /// Automation passed to the plugin, one queue per parameter.
+    pub parameter_changes: usize,
+    /// Parameter ids and edit state mirrored between the processor and the edit controller.
+    pub parameter_tables: usize,
+    /// Events queued with `queue_event` and the buffers merging them into blocks.
+    pub event_scheduler: usize,
+    /// FIFOs of a fixed block size.
+    pub block_adapter: usize,
+    /// Ring buffer of a running capture.
+    pub capture: usize,
+    /// Memory shared with a sandboxed plugin's worker process.
+    pub sandbox: usize,
+    pub total: usize,
+}
+
 pub(crate) trait PluginInner {
     fn process(
         &mut self,
@@ -234,8 +527,32 @@ pub(crate) trait PluginInner {
         process_details: &ProcessDetails,
     );
 
+    fn process_in_place(
+        &mut self,
+        buses: &mut [AudioBus<f32>],
+        events: Vec<HostIssuedEvent>,
+        process_details: &ProcessDetails,
+    ) {
+        let mut copies: Vec<Vec<f32>> =
+            buses.iter().flat_map(|bus| bus.data.iter().map(|channel| channel.to_vec())).collect();
+        let mut copies = copies.iter_mut();
+        let inputs: Vec<AudioBus<f32>> = buses
+            .iter()
+            .map(|bus| {
+                AudioBus::from_channels(
+                    copies.by_ref().take(bus.channels()).map(|c| c.as_mut_slice()).collect(),
+                )
+            })
+            .collect();
+
+        self.process(&inputs, buses, events, process_details);
+    }
+
     fn set_preset_data(&mut self, data: Vec<u8>) -> Result<(), String>;
     fn get_preset_data(&mut self) -> Result<Vec<u8>, String>;
+    fn get_preset_count(&mut self) -> usize {
+        0
+    }
     fn get_preset_name(&mut self, id: i32) -> Result<String, String>;
     fn set_preset(&mut self, id: i32) -> Result<(), String>;
 
@@ -256,4 +573,51 @@ pub(crate) trait PluginInner {
     fn editor_updates(&mut self) {}
 
     fn get_parameter_count(&self) -> usize;
+
+    fn log_tag(&self) -> usize {
+        0
+    }
+
+    fn set_auto_sleep(&mut self, _enabled: bool) {}
+
+    fn set_fixed_block_size(&mut self, _block_size: BlockSize) -> Result<(), Error> {
+        err("Fixed block sizes are not supported for this format")
+    }
+
+    fn set_max_block_size(&mut self, _max_block_size: BlockSize) -> Result<(), Error> {
+        Ok(())
+    }
+
+    fn memory_usage(&self) -> MemoryUsage {
+        MemoryUsage::default()
+    }
+
+    fn output_silence_flags(&self, _bus: usize) -> u64 {
+        0
+    }
+
+    fn set_queued_control(&mut self, _enabled: bool) {}
+
+    fn event_sender(&self) -> Option<EventSender> {
+        None
+    }
+
+    fn sample_position(&self) -> u64 {
+        0
+    }
+
+    fn start_capture(&mut self, _path: &Path, _include_state: bool) -> Result<(), Error> {
+        err("Capture is not supported for this format")
+    }
+
+    fn stop_capture(&mut self) {}
+
+    fn prefetchable(&self) -> bool {
+        true
+    }
+
+    /// Channel `channel` of the buffers a sandboxed plugin processes in place.
+    fn shared_channel_buffer(&self, _output: bool, _channel: usize) -> Option<*mut f32> {
+        None
+    }
 }
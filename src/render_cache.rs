@@ -0,0 +1,605 @@
+use std::{
+    collections::HashMap,
+    fs::{File, OpenOptions},
+    io::{Read, Seek, SeekFrom, Write},
+    path::Path,
+};
+
+use crate::{
+    error::{err, Error},
+    event::{HostIssuedEvent, HostIssuedEventType},
+    plugin::PluginInstance,
+    ProcessDetails, Samples,
+};
+
+/// One offline render of a span of audio through a plugin.
+pub struct RenderJob<'a> {
+    /// One slice per input channel, numbered across buses. Each must hold `length` samples.
+    pub inputs: &'a [&'a [f32]],
+    /// Sorted by `block_time`, which counts samples from the start of the render.
+    pub events: &'a [HostIssuedEvent],
+    /// Transport at the start of the render. Advanced block by block while rendering. Its
+    /// `block_size` is the block size used for processing.
+    pub start: ProcessDetails,
+    pub length: Samples,
+    /// Samples per cached segment. Rounded up to a whole number of blocks.
+    pub segment_size: Samples,
+    /// How many segments before a segment can affect its output, e.g. enough to cover the
+    /// plugin's tail. A segment is only reused if these are unchanged too, and they are rendered
+    /// again to settle the plugin before rendering a segment that follows a reused one. Use
+    /// `usize::MAX` for plugins whose output can depend on everything before it.
+    pub preroll_segments: usize,
+}
+
+#[derive(Debug, Default, Clone, Copy)]
+pub struct RenderStats {
+    pub segments: usize,
+    /// Segments copied from the cache instead of being processed.
+    pub hits: usize,
+}
+
+/// Cache of rendered segments, persisted in a file so batch renders can skip the parts of a
+/// project that haven't changed since the last run.
+///
+/// Each segment is keyed on the plugin and its state, the input audio, events and transport of
+/// the segment and of the `preroll_segments` before it. Only correct for deterministic plugins.
+pub struct RenderCache {
+    file: File,
+    index: HashMap<CacheKey, CacheEntry>,
+    scratch: Vec<u8>,
+}
+
+type CacheKey = (u64, u64);
+
+struct CacheEntry {
+    /// Offset of the samples in the file
+    offset: u64,
+    channels: usize,
+    frames: usize,
+}
+
+const MAGIC: &[u8; 8] = b"APHRC001";
+/// Key, channel count and frame count
+const ENTRY_HEADER_SIZE: usize = 16 + 4 + 4;
+
+impl RenderCache {
+    /// Opens the cache file at `path`, creating it if it doesn't exist. An entry left incomplete
+    /// by an interrupted render is discarded.
+    pub fn open<P: AsRef<Path>>(path: P) -> Result<Self, Error> {
+        let io_err = |e: std::io::Error| Error {
+            message: format!("Render cache: {}", e),
+        };
+
+        let mut file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(false)
+            .open(path)
+            .map_err(io_err)?;
+        let len = file.metadata().map_err(io_err)?.len();
+
+        if len == 0 {
+            file.write_all(MAGIC).map_err(io_err)?;
+        } else {
+            let mut magic = [0u8; 8];
+            if file.read_exact(&mut magic).is_err() || &magic != MAGIC {
+                return err("Render cache: not a render cache file");
+            }
+        }
+
+        // Only the headers are read up front. Samples are read when a segment is reused.
+        let mut index = HashMap::new();
+        let mut pos = MAGIC.len() as u64;
+        let mut reader = std::io::BufReader::new(&mut file);
+        reader.seek(SeekFrom::Start(pos)).map_err(io_err)?;
+        loop {
+            let mut header = [0u8; ENTRY_HEADER_SIZE];
+            if reader.read_exact(&mut header).is_err() {
+                break;
+            }
+
+            let word = |i: usize| u64::from_le_bytes(header[i..i + 8].try_into().unwrap());
+            let key = (word(0), word(8));
+            let channels = u32::from_le_bytes(header[16..20].try_into().unwrap()) as usize;
+            let frames = u32::from_le_bytes(header[20..24].try_into().unwrap()) as usize;
+
+            let offset = pos + ENTRY_HEADER_SIZE as u64;
+            let end = offset + (channels * frames * 4) as u64;
+            if end > len {
+                break;
+            }
+
+            index.insert(
+                key,
+                CacheEntry {
+                    offset,
+                    channels,
+                    frames,
+                },
+            );
+            pos = end;
+            reader.seek(SeekFrom::Start(pos)).map_err(io_err)?;
+        }
+        drop(reader);
+
+        file.set_len(pos).map_err(io_err)?;
+
+        Ok(RenderCache {
+            file,
+            index,
+            scratch: Vec::new(),
+        })
+    }
+
+    /// Number of cached segments.
+    pub fn len(&self) -> usize {
+        self.index.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.index.is_empty()
+    }
+
+    /// {UI thread} Renders `job` into `outputs`, one slice per output channel numbered across
+    /// buses, each at least `job.length` long. Segments found in the cache are copied instead of
+    /// processed, everything else is processed and added to the cache.
+    ///
+    /// Processing may be skipped or restarted from the plugin's state at the start of the
+    /// render, so the plugin's internal state afterwards is unspecified. Reload its state before
+    /// using it for anything else.
+    pub fn render(
+        &mut self,
+        plugin: &mut PluginInstance,
+        job: &RenderJob,
+        outputs: &mut [&mut [f32]],
+    ) -> Result<RenderStats, Error> {
+        let io = plugin.get_io_configuration();
+        let input_channels: usize = io.audio_inputs.iter().map(|b| b.channels).sum();
+        let output_channels: usize = io.audio_outputs.iter().map(|b| b.channels).sum();
+
+        if job.inputs.len() != input_channels || outputs.len() != output_channels {
+            return err("Render cache: channel count doesn't match the plugin's IO configuration");
+        }
+        if job.inputs.iter().any(|c| c.len() < job.length)
+            || outputs.iter().any(|c| c.len() < job.length)
+        {
+            return err("Render cache: buffers are shorter than the render");
+        }
+
+        let block_size = job.start.block_size;
+        if block_size == 0 {
+            return err("Render cache: block size is 0");
+        }
+
+        let state = plugin.get_preset_data().map_err(|e| Error {
+            message: format!("Render cache: can't key a plugin without its state: {}", e),
+        })?;
+
+        let segment_size = job.segment_size.max(1).div_ceil(block_size) * block_size;
+        let segment_count = job.length.div_ceil(segment_size);
+        let segment_range =
+            |k: usize| k * segment_size..((k + 1) * segment_size).min(job.length);
+
+        let mut base = StableHasher::new();
+        let descriptor = &plugin.descriptor;
+        base.bytes(descriptor.id.as_bytes());
+        base.bytes(descriptor.version.as_bytes());
+        base.word(input_channels as u64);
+        base.word(output_channels as u64);
+        base.word(job.start.sample_rate as u64);
+        base.word(block_size as u64);
+        base.word(segment_size as u64);
+        base.word(job.preroll_segments as u64);
+        base.bytes(&state);
+        let base = base.finish();
+
+        let mut starts = Vec::with_capacity(segment_count);
+        let mut contents = Vec::with_capacity(segment_count);
+        let mut details = job.start.clone();
+        for k in 0..segment_count {
+            let range = segment_range(k);
+            contents.push(segment_hash(job, range.clone(), &details));
+            starts.push(details.clone());
+
+            let mut block_start = range.start;
+            while block_start < range.end {
+                let frames = block_size.min(range.end - block_start);
+                details.advance(frames);
+                block_start += frames;
+            }
+        }
+
+        let keys: Vec<CacheKey> = (0..segment_count)
+            .map(|k| {
+                let mut hasher = StableHasher::new();
+                hasher.word(base.0);
+                hasher.word(base.1);
+                for content in &contents[k.saturating_sub(job.preroll_segments)..=k] {
+                    hasher.word(content.0);
+                    hasher.word(content.1);
+                }
+                hasher.finish()
+            })
+            .collect();
+
+        let mut renderer = SegmentRenderer {
+            plugin,
+            arena: None,
+            job,
+            block_size,
+        };
+
+        let mut stats = RenderStats {
+            segments: segment_count,
+            hits: 0,
+        };
+        // Segment the plugin's internal state is ready to continue from
+        let mut next_segment = 0;
+
+        for k in 0..segment_count {
+            let range = segment_range(k);
+
+            if self.read(&keys[k], outputs, range.clone())? {
+                stats.hits += 1;
+                continue;
+            }
+
+            if next_segment != k {
+                let first = k.saturating_sub(job.preroll_segments);
+                if next_segment != first {
+                    renderer.reset(&state)?;
+                }
+                for p in first..k {
+                    renderer.render(segment_range(p), &starts[p], None);
+                }
+            }
+
+            renderer.render(range.clone(), &starts[k], Some(&mut *outputs));
+            self.write(keys[k], outputs, range)?;
+            next_segment = k + 1;
+        }
+
+        self.file.flush().map_err(|e| Error {
+            message: format!("Render cache: {}", e),
+        })?;
+
+        Ok(stats)
+    }
+
+    /// Copies the segment cached under `key` into `outputs`. Returns false if there is none.
+    fn read(
+        &mut self,
+        key: &CacheKey,
+        outputs: &mut [&mut [f32]],
+        range: std::ops::Range<usize>,
+    ) -> Result<bool, Error> {
+        let Some(entry) = self.index.get(key) else {
+            return Ok(false);
+        };
+        if entry.channels != outputs.len() || entry.frames != range.len() {
+            return Ok(false);
+        }
+
+        self.scratch.resize(entry.channels * entry.frames * 4, 0);
+        self.file
+            .seek(SeekFrom::Start(entry.offset))
+            .and_then(|_| self.file.read_exact(&mut self.scratch))
+            .map_err(|e| Error {
+                message: format!("Render cache: {}", e),
+            })?;
+
+        let mut samples = self.scratch.chunks_exact(4);
+        for channel in outputs.iter_mut() {
+            for sample in channel[range.clone()].iter_mut() {
+                *sample = f32::from_le_bytes(samples.next().unwrap().try_into().unwrap());
+            }
+        }
+
+        Ok(true)
+    }
+
+    fn write(
+        &mut self,
+        key: CacheKey,
+        outputs: &[&mut [f32]],
+        range: std::ops::Range<usize>,
+    ) -> Result<(), Error> {
+        self.scratch.clear();
+        self.scratch.extend_from_slice(&key.0.to_le_bytes());
+        self.scratch.extend_from_slice(&key.1.to_le_bytes());
+        self.scratch
+            .extend_from_slice(&(outputs.len() as u32).to_le_bytes());
+        self.scratch
+            .extend_from_slice(&(range.len() as u32).to_le_bytes());
+        for channel in outputs {
+            for sample in &channel[range.clone()] {
+                self.scratch.extend_from_slice(&sample.to_le_bytes());
+            }
+        }
+
+        let io_err = |e: std::io::Error| Error {
+            message: format!("Render cache: {}", e),
+        };
+        let pos = self.file.seek(SeekFrom::End(0)).map_err(io_err)?;
+        self.file.write_all(&self.scratch).map_err(io_err)?;
+
+        self.index.insert(
+            key,
+            CacheEntry {
+                offset: pos + ENTRY_HEADER_SIZE as u64,
+                channels: outputs.len(),
+                frames: range.len(),
+            },
+        );
+
+        Ok(())
+    }
+}
+
+struct SegmentRenderer<'a, 'b> {
+    plugin: &'a mut PluginInstance,
+    arena: Option<crate::audio_bus::BufferArena<f32>>,
+    job: &'a RenderJob<'b>,
+    block_size: usize,
+}
+
+impl SegmentRenderer<'_, '_> {
+    /// Puts the plugin back into its state at the start of the render.
+    fn reset(&mut self, state: &[u8]) -> Result<(), Error> {
+        self.plugin.suspend();
+        self.plugin
+            .set_preset_data(state.to_vec())
+            .map_err(|e| Error {
+                message: format!("Render cache: failed to restore the plugin's state: {}", e),
+            })?;
+        self.plugin.resume();
+        Ok(())
+    }
+
+    /// Processes `range` block by block. Output is discarded when `outputs` is `None`.
+    fn render(
+        &mut self,
+        range: std::ops::Range<usize>,
+        start: &ProcessDetails,
+        mut outputs: Option<&mut [&mut [f32]]>,
+    ) {
+        // The renderer only borrows the plugin, so the arena can't outlive it
+        let arena = self.arena.get_or_insert_with(|| unsafe {
+            self.plugin.create_shared_buffer_arena(self.block_size)
+        });
+        let events = self.job.events;
+
+        let mut details = start.clone();
+        let mut block_start = range.start;
+        while block_start < range.end {
+            let frames = self.block_size.min(range.end - block_start);
+            let block = block_start..block_start + frames;
+            details.block_size = frames;
+
+            let first = events.partition_point(|e| e.block_time < block.start);
+            let last = events.partition_point(|e| e.block_time < block.end);
+            let block_events = events[first..last]
+                .iter()
+                .map(|e| HostIssuedEvent {
+                    block_time: e.block_time - block.start,
+                    ..e.clone()
+                })
+                .collect();
+
+            let mut buses = arena.buses(frames);
+            let mut inputs = self.job.inputs.iter();
+            for channel in buses.inputs.iter_mut().flat_map(|b| b.data.iter_mut()) {
+                channel.copy_from_slice(&inputs.next().unwrap()[block.clone()]);
+            }
+
+            self.plugin
+                .process(&buses.inputs, &mut buses.outputs, block_events, &details);
+
+            if let Some(outputs) = outputs.as_deref_mut() {
+                let mut outputs = outputs.iter_mut();
+                for channel in buses.outputs.iter().flat_map(|b| b.data.iter()) {
+                    outputs.next().unwrap()[block.clone()].copy_from_slice(channel);
+                }
+            }
+
+            details.advance(frames);
+            block_start += frames;
+        }
+    }
+}
+
+/// Hash of everything in a segment that can change its output.
+fn segment_hash(
+    job: &RenderJob,
+    range: std::ops::Range<usize>,
+    details: &ProcessDetails,
+) -> CacheKey {
+    let mut hasher = StableHasher::new();
+
+    hasher.f64(details.tempo);
+    hasher.f64(details.player_time);
+    hasher.word(details.time_signature_numerator as u64);
+    hasher.word(details.time_signature_denominator as u64);
+    hasher.word(details.cycle_enabled as u64);
+    hasher.f64(details.cycle_start);
+    hasher.f64(details.cycle_end);
+    hasher.word(details.playing_state as u64);
+    hasher.f64(details.bar_start_pos);
+
+    for channel in job.inputs {
+        hasher.samples(&channel[range.clone()]);
+    }
+
+    let first = job.events.partition_point(|e| e.block_time < range.start);
+    let last = job.events.partition_point(|e| e.block_time < range.end);
+    for event in &job.events[first..last] {
+        hasher.word((event.block_time - range.start) as u64);
+        hasher.f64(event.ppq_time);
+        hasher.word(event.bus_index as u64);
+        match &event.event_type {
+            HostIssuedEventType::Midi(midi) => {
+                hasher.word(0);
+                hasher.word(midi.note_length as u64);
+                hasher.bytes(&midi.midi_data);
+                hasher.word(midi.detune.to_bits() as u64);
+            }
+            HostIssuedEventType::Parameter(update) => {
+                hasher.word(1);
+                hasher.word(update.parameter_id as u64);
+                hasher.word(update.parameter_index as u64);
+                hasher.word(update.current_value.to_bits() as u64);
+                hasher.word(update.end_edit as u64);
+            }
+        }
+    }
+
+    hasher.finish()
+}
+
+/// 128 bit hash that, unlike `DefaultHasher`, is the same across runs, platforms and Rust
+/// versions, since keys are persisted.
+struct StableHasher {
+    a: u64,
+    b: u64,
+    words: u64,
+}
+
+impl StableHasher {
+    fn new() -> Self {
+        StableHasher {
+            a: 0x243F_6A88_85A3_08D3,
+            b: 0x1319_8A2E_0370_7344,
+            words: 0,
+        }
+    }
+
+    fn word(&mut self, word: u64) {
+        self.a = (self.a ^ word)
+            .wrapping_mul(0x9E37_79B9_7F4A_7C15)
+            .rotate_left(29);
+        self.b = (self.b.rotate_left(23) ^ word).wrapping_mul(0xC2B2_AE3D_27D4_EB4F);
+        self.words += 1;
+    }
+
+    fn f64(&mut self, value: f64) {
+        self.word(value.to_bits());
+    }
+
+    fn bytes(&mut self, bytes: &[u8]) {
+        self.word(bytes.len() as u64);
+        let mut chunks = bytes.chunks_exact(8);
+        for chunk in chunks.by_ref() {
+            self.word(u64::from_le_bytes(chunk.try_into().unwrap()));
+        }
+        let mut rest = [0u8; 8];
+        rest[..chunks.remainder().len()].copy_from_slice(chunks.remainder());
+        self.word(u64::from_le_bytes(rest));
+    }
+
+    fn samples(&mut self, samples: &[f32]) {
+        self.word(samples.len() as u64);
+        let mut pairs = samples.chunks_exact(2);
+        for pair in pairs.by_ref() {
+            self.word(pair[0].to_bits() as u64 | (pair[1].to_bits() as u64) << 32);
+        }
+        if let [last] = pairs.remainder() {
+            self.word(last.to_bits() as u64);
+        }
+    }
+
+    fn finish(&self) -> CacheKey {
+        (
+            mix(self.a ^ mix(self.b ^ self.words)),
+            mix(self.b ^ self.a.rotate_left(17)),
+        )
+    }
+}
+
+/// splitmix64 finalizer
+fn mix(mut x: u64) -> u64 {
+    x = (x ^ (x >> 30)).wrapping_mul(0xBF58_476D_1CE4_E5B9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94D0_49BB_1331_11EB);
+    x ^ (x >> 31)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{event::MidiEvent, PlayingState};
+
+    // Keys are persisted in cache files, so these must never change. If they do, old caches
+    // silently stop hitting.
+
+    #[test]
+    fn stable_hasher_vector() {
+        assert_eq!(
+            StableHasher::new().finish(),
+            (0x8DAC_204D_DC9B_FCCC, 0x51A5_66ED_BE5C_69BD)
+        );
+
+        let mut hasher = StableHasher::new();
+        hasher.word(0);
+        hasher.word(u64::MAX);
+        hasher.f64(120.0);
+        hasher.bytes(b"audio-plugin-host");
+        hasher.samples(&[0.0, 0.5, -1.0]);
+        assert_eq!(
+            hasher.finish(),
+            (0x4A0F_9090_98EF_29CB, 0x8EC4_B30D_D2C7_8425)
+        );
+    }
+
+    #[test]
+    fn segment_hash_vector() {
+        let left: Vec<f32> = (0..16).map(|i| i as f32 / 16.0).collect();
+        let right: Vec<f32> = left.iter().map(|s| -s).collect();
+        let events = [HostIssuedEvent {
+            event_type: HostIssuedEventType::Midi(MidiEvent {
+                note_length: 4,
+                midi_data: [0x90, 60, 100],
+                detune: 0.0,
+            }),
+            block_time: 10,
+            ppq_time: 0.0,
+            bus_index: 0,
+        }];
+        let details = ProcessDetails {
+            sample_rate: 48000,
+            block_size: 8,
+            tempo: 120.0,
+            player_time: 2.0,
+            time_signature_numerator: 4,
+            time_signature_denominator: 4,
+            cycle_enabled: false,
+            cycle_start: 0.0,
+            cycle_end: 0.0,
+            playing_state: PlayingState::Playing,
+            bar_start_pos: 0.0,
+            nanos: 0.0,
+        };
+        let job = RenderJob {
+            inputs: &[&left, &right],
+            events: &events,
+            start: details.clone(),
+            length: 16,
+            segment_size: 8,
+            preroll_segments: 0,
+        };
+
+        let first = segment_hash(&job, 0..8, &details);
+        let second = segment_hash(&job, 8..16, &details);
+        assert_eq!(first, (0x6169_F23D_2BDD_109A, 0x1B08_523B_D6BE_32F5));
+        assert_eq!(second, (0xB7B7_106B_BA59_5479, 0xEF40_0C64_22FD_0942));
+
+        // A changed sample only changes the key of its own segment
+        let mut edited = left.clone();
+        edited[12] = 0.0;
+        let job = RenderJob {
+            inputs: &[&edited, &right],
+            ..job
+        };
+        assert_eq!(segment_hash(&job, 0..8, &details), first);
+        assert_ne!(segment_hash(&job, 8..16, &details), second);
+    }
+}
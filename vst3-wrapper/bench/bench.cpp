@@ -0,0 +1,338 @@
+// Headless benchmarks for the VST3 hosting path. Measures the cost of the
+// wrapper itself using the trivial plugins built from `benchplugin.cpp` and
+// prints one JSON object per line so results can be diffed between builds.
+//
+// Usage: vst3wrapper_bench [plugin_dir] [--quick]
+
+#include "vst3wrapper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The Rust side normally provides this. Plugin issued events are not
+// interesting for benchmarking so they are dropped.
+void send_event_to_host(const PluginIssuedEvent *event,
+                        const void *plugin_sent_events_producer) {}
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchPlugin {
+  const char *name;
+  // The module on Windows, the bundle directory elsewhere
+  const char *file;
+  bool has_audio_input;
+};
+
+const BenchPlugin BENCH_PLUGINS[] = {
+    {"pass_through", "vst3wrapper_bench_pass_through.vst3", true},
+    {"gain", "vst3wrapper_bench_gain.vst3", true},
+    {"synth", "vst3wrapper_bench_synth.vst3", false},
+};
+
+const int BENCH_CHANNELS = 2;
+const int BENCH_MAX_BLOCK_SIZE = 8192;
+
+struct Stats {
+  double mean_ns;
+  double min_ns;
+  double p50_ns;
+  double p99_ns;
+};
+
+Stats summarise(std::vector<double> &samples) {
+  Stats stats = {};
+  if (samples.empty()) {
+    return stats;
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  double total = 0.0;
+  for (double s : samples) {
+    total += s;
+  }
+
+  stats.mean_ns = total / samples.size();
+  stats.min_ns = samples.front();
+  stats.p50_ns = samples[samples.size() / 2];
+  stats.p99_ns = samples[std::min(samples.size() - 1,
+                                  (size_t)(samples.size() * 0.99))];
+  return stats;
+}
+
+double elapsed_ns(Clock::time_point start) {
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now() - start)
+      .count();
+}
+
+void print_stats(const Stats &stats) {
+  printf("\"mean_ns\":%.1f,\"min_ns\":%.1f,\"p50_ns\":%.1f,\"p99_ns\":%.1f",
+         stats.mean_ns, stats.min_ns, stats.p50_ns, stats.p99_ns);
+}
+
+// Owns the channel buffers handed to `process` for one plugin.
+struct BenchBuffers {
+  std::vector<std::vector<float>> input_channels;
+  std::vector<std::vector<float>> output_channels;
+  std::vector<float *> input_ptrs;
+  std::vector<float *> output_ptrs;
+  float **input_bus = nullptr;
+  float **output_bus = nullptr;
+
+  BenchBuffers() {
+    input_channels.assign(BENCH_CHANNELS,
+                          std::vector<float>(BENCH_MAX_BLOCK_SIZE, 0.25f));
+    output_channels.assign(BENCH_CHANNELS,
+                           std::vector<float>(BENCH_MAX_BLOCK_SIZE, 0.0f));
+
+    for (int c = 0; c < BENCH_CHANNELS; c++) {
+      input_ptrs.push_back(input_channels[c].data());
+      output_ptrs.push_back(output_channels[c].data());
+    }
+
+    input_bus = input_ptrs.data();
+    output_bus = output_ptrs.data();
+  }
+};
+
+ProcessDetails bench_process_details(int block_size) {
+  ProcessDetails details = {};
+  details.sample_rate = 44100;
+  details.block_size = block_size;
+  details.tempo = 120.0;
+  details.player_time = 0.0;
+  details.time_signature_numerator = 4;
+  details.time_signature_denominator = 4;
+  details.playing_state = PlayingState::Playing;
+  return details;
+}
+
+const void *load_bench_plugin(const std::string &dir,
+                              const BenchPlugin &plugin) {
+  std::string path = dir + "/" + plugin.file;
+  const void *app = load_plugin(path.c_str(), nullptr);
+  if (!app) {
+    fprintf(stderr, "Failed to load %s\n", path.c_str());
+    exit(1);
+  }
+  return app;
+}
+
+void unload_bench_plugin(const void *app) {
+  delete (PluginInstance *)app;
+}
+
+// Runs `process` enough times to cover roughly `total_samples` and returns
+// per-call timings.
+std::vector<double> time_process(const void *app, BenchBuffers &buffers,
+                                 int block_size, long total_samples,
+                                 std::vector<HostIssuedEvent> &events) {
+  ProcessDetails details = bench_process_details(block_size);
+
+  long iterations = std::max(64L, total_samples / block_size);
+  std::vector<double> samples;
+  samples.reserve(iterations);
+
+  float **inputs[] = {buffers.input_bus};
+  float **outputs[] = {buffers.output_bus};
+
+  for (long i = 0; i < iterations; i++) {
+    auto start = Clock::now();
+    process(app, &details, inputs, outputs, events.data(),
+            (int32_t)events.size());
+    samples.push_back(elapsed_ns(start));
+
+    details.player_time += block_size / 44100.0 * 2.0;
+  }
+
+  return samples;
+}
+
+void bench_load(const std::string &dir, int runs) {
+  for (const BenchPlugin &plugin : BENCH_PLUGINS) {
+    std::vector<double> samples;
+    for (int i = 0; i < runs; i++) {
+      auto start = Clock::now();
+      const void *app = load_bench_plugin(dir, plugin);
+      samples.push_back(elapsed_ns(start));
+      unload_bench_plugin(app);
+    }
+
+    Stats stats = summarise(samples);
+    printf("{\"bench\":\"load_plugin\",\"plugin\":\"%s\",\"runs\":%d,",
+           plugin.name, runs);
+    print_stats(stats);
+    printf("}\n");
+  }
+}
+
+void bench_block_sizes(const std::string &dir, long total_samples) {
+  BenchBuffers buffers;
+  std::vector<HostIssuedEvent> no_events;
+
+  for (const BenchPlugin &plugin : BENCH_PLUGINS) {
+    const void *app = load_bench_plugin(dir, plugin);
+
+    for (int block_size = 16; block_size <= BENCH_MAX_BLOCK_SIZE;
+         block_size *= 2) {
+      std::vector<double> samples =
+          time_process(app, buffers, block_size, total_samples, no_events);
+      size_t iterations = samples.size();
+      Stats stats = summarise(samples);
+
+      printf("{\"bench\":\"process\",\"plugin\":\"%s\",\"block_size\":%d,"
+             "\"iterations\":%zu,\"ns_per_sample\":%.3f,",
+             plugin.name, block_size, iterations, stats.mean_ns / block_size);
+      print_stats(stats);
+      printf("}\n");
+    }
+
+    unload_bench_plugin(app);
+  }
+}
+
+void bench_midi_density(const std::string &dir, long total_samples) {
+  const int block_size = 512;
+  const int densities[] = {0, 1, 4, 16, 48, 128};
+
+  BenchBuffers buffers;
+  const void *app = load_bench_plugin(dir, BENCH_PLUGINS[2]);
+
+  for (int density : densities) {
+    std::vector<HostIssuedEvent> events;
+    for (int i = 0; i < density; i++) {
+      HostIssuedEvent event = {};
+      event.event_type.tag = HostIssuedEventType::Tag::Midi;
+      event.event_type.midi._0 = {};
+      event.event_type.midi._0.midi_data[0] = i % 2 == 0 ? 0x90 : 0x80;
+      event.event_type.midi._0.midi_data[1] = (uint8_t)(48 + (i / 2) % 24);
+      event.event_type.midi._0.midi_data[2] = 100;
+      event.block_time = (uintptr_t)i * block_size / density;
+      events.push_back(event);
+    }
+
+    std::vector<double> samples =
+        time_process(app, buffers, block_size, total_samples, events);
+    Stats stats = summarise(samples);
+
+    printf("{\"bench\":\"midi_density\",\"plugin\":\"synth\",\"block_size\":%d,"
+           "\"events_per_block\":%d,",
+           block_size, density);
+    print_stats(stats);
+    printf("}\n");
+  }
+
+  unload_bench_plugin(app);
+}
+
+void bench_parameter_density(const std::string &dir, long total_samples) {
+  const int block_size = 512;
+  const int densities[] = {0, 1, 4, 16, 64, 256};
+  const int parameter_count = 64;
+
+  BenchBuffers buffers;
+  const void *app = load_bench_plugin(dir, BENCH_PLUGINS[1]);
+
+  for (int density : densities) {
+    std::vector<HostIssuedEvent> events;
+    for (int i = 0; i < density; i++) {
+      HostIssuedEvent event = {};
+      event.event_type.tag = HostIssuedEventType::Tag::Parameter;
+      event.event_type.parameter._0 = {};
+      event.event_type.parameter._0.parameter_id = i % parameter_count;
+      event.event_type.parameter._0.parameter_index = i % parameter_count;
+      event.event_type.parameter._0.current_value = (float)(i % 10) / 10.0f;
+      event.event_type.parameter._0.initial_value = NAN;
+      event.block_time = (uintptr_t)i * block_size / density;
+      events.push_back(event);
+    }
+
+    std::vector<double> samples =
+        time_process(app, buffers, block_size, total_samples, events);
+    Stats stats = summarise(samples);
+
+    printf("{\"bench\":\"parameter_density\",\"plugin\":\"gain\","
+           "\"block_size\":%d,\"events_per_block\":%d,",
+           block_size, density);
+    print_stats(stats);
+    printf("}\n");
+  }
+
+  unload_bench_plugin(app);
+}
+
+void bench_state(const std::string &dir, int runs) {
+  const int32_t sizes[] = {64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024};
+
+  const void *app = load_bench_plugin(dir, BENCH_PLUGINS[1]);
+
+  for (int32_t size : sizes) {
+    std::vector<char> blob(size);
+    for (int32_t i = 0; i < size; i++) {
+      blob[i] = (char)(i * 31);
+    }
+
+    std::vector<double> set_samples;
+    std::vector<double> get_samples;
+
+    for (int i = 0; i < runs; i++) {
+      auto start = Clock::now();
+      set_data(app, blob.data(), size);
+      set_samples.push_back(elapsed_ns(start));
+
+      int32_t len = 0;
+      const void *stream = nullptr;
+      start = Clock::now();
+      get_data(app, &len, &stream);
+      free_data_stream(stream);
+      get_samples.push_back(elapsed_ns(start));
+    }
+
+    Stats set_stats = summarise(set_samples);
+    Stats get_stats = summarise(get_samples);
+
+    printf("{\"bench\":\"set_data\",\"plugin\":\"gain\",\"state_bytes\":%d,"
+           "\"mb_per_s\":%.1f,",
+           size, size / set_stats.p50_ns * 1e3);
+    print_stats(set_stats);
+    printf("}\n");
+
+    printf("{\"bench\":\"get_data\",\"plugin\":\"gain\",\"state_bytes\":%d,"
+           "\"mb_per_s\":%.1f,",
+           size, size / get_stats.p50_ns * 1e3);
+    print_stats(get_stats);
+    printf("}\n");
+  }
+
+  unload_bench_plugin(app);
+}
+
+int main(int argc, char **argv) {
+  std::string dir = BENCH_PLUGIN_DIR;
+  bool quick = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      quick = true;
+    } else {
+      dir = argv[i];
+    }
+  }
+
+  long total_samples = quick ? 1 << 16 : 1 << 22;
+  int runs = quick ? 4 : 32;
+
+  bench_load(dir, runs);
+  bench_block_sizes(dir, total_samples);
+  bench_midi_density(dir, total_samples);
+  bench_parameter_density(dir, total_samples);
+  bench_state(dir, runs);
+
+  return 0;
+}
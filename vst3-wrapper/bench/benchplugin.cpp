@@ -0,0 +1,223 @@
+// Minimal plugin used by `vst3wrapper_bench`. The same source is built once
+// per `BENCH_PLUGIN_KIND` so each module exposes a single audio effect class,
+// which is the one `load_plugin` picks.
+
+#include "pluginterfaces/base/ibstream.h"
+#include "pluginterfaces/vst/ivstevents.h"
+#include "pluginterfaces/vst/ivstparameterchanges.h"
+#include "public.sdk/source/main/pluginfactory.h"
+#include "public.sdk/source/vst/vstsinglecomponenteffect.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define BENCH_PLUGIN_PASS_THROUGH 0
+#define BENCH_PLUGIN_GAIN 1
+#define BENCH_PLUGIN_SYNTH 2
+
+#ifndef BENCH_PLUGIN_KIND
+#define BENCH_PLUGIN_KIND BENCH_PLUGIN_PASS_THROUGH
+#endif
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+
+// Enough parameters to spread parameter-density benchmarks over distinct
+// queues. Parameter 0 is the gain.
+const int32 BENCH_PARAMETER_COUNT = 64;
+
+class BenchEffect : public SingleComponentEffect {
+public:
+  static FUnknown *createInstance(void * /*context*/) {
+    return (IAudioProcessor *)new BenchEffect();
+  }
+
+  tresult PLUGIN_API initialize(FUnknown *context) override {
+    tresult result = SingleComponentEffect::initialize(context);
+    if (result != kResultOk) {
+      return result;
+    }
+
+    if (BENCH_PLUGIN_KIND == BENCH_PLUGIN_SYNTH) {
+      addEventInput(STR16("Event In"), 1);
+    } else {
+      addAudioInput(STR16("Stereo In"), SpeakerArr::kStereo);
+    }
+    addAudioOutput(STR16("Stereo Out"), SpeakerArr::kStereo);
+
+    for (int32 i = 0; i < BENCH_PARAMETER_COUNT; i++) {
+      String128 title = {};
+      title[0] = 'P';
+      int32 len = 1;
+      char digits[16];
+      int32 digit_count = snprintf(digits, sizeof(digits), "%d", i);
+      for (int32 d = 0; d < digit_count; d++) {
+        title[len++] = digits[d];
+      }
+
+      parameters.addParameter(title, nullptr, 0, 0.5,
+                              ParameterInfo::kCanAutomate, i);
+    }
+
+    return kResultOk;
+  }
+
+  tresult PLUGIN_API setState(IBStream *state) override {
+    if (!state) {
+      return kResultFalse;
+    }
+
+    blob.clear();
+
+    char chunk[4096];
+    int32 read = 0;
+    while (state->read(chunk, sizeof(chunk), &read) == kResultTrue &&
+           read > 0) {
+      blob.insert(blob.end(), chunk, chunk + read);
+    }
+
+    return kResultOk;
+  }
+
+  tresult PLUGIN_API getState(IBStream *state) override {
+    if (!state) {
+      return kResultFalse;
+    }
+
+    if (blob.empty()) {
+      return kResultOk;
+    }
+
+    int32 written = 0;
+    return state->write(blob.data(), (int32)blob.size(), &written);
+  }
+
+  tresult PLUGIN_API process(ProcessData &data) override {
+    read_parameter_changes(data);
+    read_events(data);
+
+    if (data.numOutputs == 0 || data.numSamples <= 0) {
+      return kResultOk;
+    }
+
+    AudioBusBuffers &out = data.outputs[0];
+    for (int32 c = 0; c < out.numChannels; c++) {
+      float *dst = out.channelBuffers32[c];
+      const float *src = nullptr;
+      if (data.numInputs > 0 && c < data.inputs[0].numChannels) {
+        src = data.inputs[0].channelBuffers32[c];
+      }
+
+      switch (BENCH_PLUGIN_KIND) {
+      case BENCH_PLUGIN_PASS_THROUGH:
+        if (!src) {
+          memset(dst, 0, data.numSamples * sizeof(float));
+        } else if (src != dst) {
+          memcpy(dst, src, data.numSamples * sizeof(float));
+        }
+        break;
+      case BENCH_PLUGIN_GAIN:
+        for (int32 i = 0; i < data.numSamples; i++) {
+          dst[i] = (src ? src[i] : 0.0f) * (float)gain;
+        }
+        break;
+      case BENCH_PLUGIN_SYNTH:
+        render_synth(dst, data.numSamples, c == 0);
+        break;
+      }
+    }
+
+    return kResultOk;
+  }
+
+private:
+  void read_parameter_changes(ProcessData &data) {
+    if (!data.inputParameterChanges) {
+      return;
+    }
+
+    int32 count = data.inputParameterChanges->getParameterCount();
+    for (int32 i = 0; i < count; i++) {
+      IParamValueQueue *queue = data.inputParameterChanges->getParameterData(i);
+      if (!queue || queue->getParameterId() != 0) {
+        continue;
+      }
+
+      int32 points = queue->getPointCount();
+      int32 offset = 0;
+      ParamValue value = 0;
+      if (points > 0 &&
+          queue->getPoint(points - 1, offset, value) == kResultTrue) {
+        gain = value;
+      }
+    }
+  }
+
+  void read_events(ProcessData &data) {
+    if (!data.inputEvents) {
+      return;
+    }
+
+    int32 count = data.inputEvents->getEventCount();
+    for (int32 i = 0; i < count; i++) {
+      Event event = {};
+      if (data.inputEvents->getEvent(i, event) != kResultTrue) {
+        continue;
+      }
+
+      if (event.type == Event::kNoteOnEvent) {
+        active_notes++;
+        pitch = event.noteOn.pitch;
+      } else if (event.type == Event::kNoteOffEvent && active_notes > 0) {
+        active_notes--;
+      }
+    }
+  }
+
+  // Naive saw so the synth stub costs roughly what a trivial voice would.
+  void render_synth(float *dst, int32 samples, bool advance) {
+    double increment = 440.0 * (1.0 + (pitch - 69) / 12.0) / 44100.0;
+    double p = phase;
+    for (int32 i = 0; i < samples; i++) {
+      dst[i] = active_notes > 0 ? (float)(p * 2.0 - 1.0) * 0.1f : 0.0f;
+      p += increment;
+      if (p >= 1.0) {
+        p -= 1.0;
+      }
+    }
+
+    if (advance) {
+      phase = p;
+    }
+  }
+
+  std::vector<char> blob;
+  ParamValue gain = 0.5;
+  int32 active_notes = 0;
+  int32 pitch = 69;
+  double phase = 0.0;
+};
+
+bool InitModule() { return true; }
+bool DeinitModule() { return true; }
+
+#if BENCH_PLUGIN_KIND == BENCH_PLUGIN_SYNTH
+#define BENCH_PLUGIN_NAME "Bench Synth"
+#define BENCH_PLUGIN_CATEGORY "Instrument|Synth"
+#elif BENCH_PLUGIN_KIND == BENCH_PLUGIN_GAIN
+#define BENCH_PLUGIN_NAME "Bench Gain"
+#define BENCH_PLUGIN_CATEGORY "Fx"
+#else
+#define BENCH_PLUGIN_NAME "Bench Pass-Through"
+#define BENCH_PLUGIN_CATEGORY "Fx"
+#endif
+
+BEGIN_FACTORY_DEF("audio-plugin-host", "", "")
+
+DEF_CLASS2(INLINE_UID(0x6A2F3C10, 0x4B7E4D21, 0x9C8A51E3, 0x00000000 + BENCH_PLUGIN_KIND),
+           PClassInfo::kManyInstances, kVstAudioEffectClass, BENCH_PLUGIN_NAME,
+           0, BENCH_PLUGIN_CATEGORY, "1.0.0", kVstVersionString,
+           BenchEffect::createInstance)
+
+END_FACTORY
@@ -0,0 +1,250 @@
+// Replays a trace recorded with `start_capture` into a freshly loaded plugin
+// as fast as possible, so a customer's CPU spike can be reproduced under a
+// profiler with identical input. Prints one JSON object with block timings.
+//
+// Usage: vst3wrapper_replay <trace> [--plugin path] [--loops n]
+
+#include "capture.h"
+#include "vst3wrapper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The Rust side normally provides this. Replays don't look at plugin issued
+// events so they are dropped.
+void send_event_to_host(const PluginIssuedEvent *event,
+                        const void *plugin_sent_events_producer) {}
+
+using Clock = std::chrono::steady_clock;
+
+struct TraceBlock {
+  ProcessDetails details;
+  std::vector<HostIssuedEvent> events;
+  // Offset of the block's input samples in `Trace::samples`
+  size_t samples_offset;
+};
+
+struct Trace {
+  TraceHeader header;
+  std::vector<TraceBlock> blocks;
+  std::vector<float> samples;
+  uint64_t dropped_blocks = 0;
+};
+
+// Reads the whole trace up front so file IO doesn't show up in the replay.
+bool read_trace(const char *path, Trace &trace) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+
+  if (!read_trace_header(file, trace.header)) {
+    fprintf(stderr, "%s is not a trace file\n", path);
+    fclose(file);
+    return false;
+  }
+
+  size_t channels = 0;
+  for (uint32_t count : trace.header.input_channels) {
+    channels += count;
+  }
+
+  TraceRecord tag;
+  while (fread(&tag, sizeof(tag), 1, file) == 1) {
+    if (tag == TraceRecord::Gap) {
+      uint32_t dropped = 0;
+      if (fread(&dropped, sizeof(dropped), 1, file) != 1) {
+        break;
+      }
+      trace.dropped_blocks += dropped;
+      continue;
+    }
+
+    TraceBlock block = {};
+    int32_t events_len = 0;
+    if (fread(&block.details, sizeof(block.details), 1, file) != 1 ||
+        fread(&events_len, sizeof(events_len), 1, file) != 1 ||
+        events_len < 0) {
+      break;
+    }
+
+    block.events.resize(events_len);
+    if (fread(block.events.data(), sizeof(HostIssuedEvent), events_len,
+              file) != (size_t)events_len) {
+      break;
+    }
+
+    size_t len = channels * block.details.block_size;
+    block.samples_offset = trace.samples.size();
+    trace.samples.resize(trace.samples.size() + len);
+    if (fread(&trace.samples[block.samples_offset], sizeof(float), len,
+              file) != len) {
+      // Truncated by a crash while recording; keep what is complete
+      trace.samples.resize(block.samples_offset);
+      break;
+    }
+
+    trace.blocks.push_back(std::move(block));
+  }
+
+  fclose(file);
+  return true;
+}
+
+static bool buses_match(const HeaplessVec<AudioBusDescriptor, 16> &buses,
+                        const std::vector<uint32_t> &channels) {
+  if (buses.count != channels.size()) {
+    return false;
+  }
+  for (uintptr_t bus = 0; bus < buses.count; bus++) {
+    if (buses.data[bus].value.channels != channels[bus]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: vst3wrapper_replay <trace> [--plugin path] [--loops n]\n");
+    return 1;
+  }
+
+  const char *plugin_path = nullptr;
+  int loops = 1;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--plugin") == 0) {
+      plugin_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--loops") == 0) {
+      loops = std::max(1, atoi(argv[i + 1]));
+    }
+  }
+
+  Trace trace;
+  if (!read_trace(argv[1], trace)) {
+    return 1;
+  }
+  if (!plugin_path) {
+    plugin_path = trace.header.plugin_path.c_str();
+  }
+
+  const void *app = load_plugin(plugin_path, nullptr);
+  if (!app) {
+    fprintf(stderr, "Failed to load %s\n", plugin_path);
+    return 1;
+  }
+
+  if (!trace.header.state.empty()) {
+    set_data(app, trace.header.state.data(),
+             (int32_t)trace.header.state.size());
+  }
+
+  IOConfigutaion config = io_config(app);
+  // The trace's input samples are laid out by its buses' channel counts
+  if (!buses_match(config.audio_inputs, trace.header.input_channels)) {
+    fprintf(stderr, "Plugin's inputs don't match the trace\n");
+    return 1;
+  }
+  if (!buses_match(config.audio_outputs, trace.header.output_channels)) {
+    fprintf(stderr, "Plugin's outputs don't match the trace\n");
+    return 1;
+  }
+
+  uintptr_t max_block_size = 0;
+  for (const TraceBlock &block : trace.blocks) {
+    max_block_size = std::max(max_block_size, block.details.block_size);
+  }
+
+  std::vector<std::vector<float *>> input_ptrs(config.audio_inputs.count);
+  std::vector<std::vector<float *>> output_ptrs(config.audio_outputs.count);
+  std::vector<std::vector<float>> channel_buffers;
+  for (uintptr_t bus = 0; bus < config.audio_inputs.count; bus++) {
+    for (uintptr_t c = 0; c < config.audio_inputs.data[bus].value.channels;
+         c++) {
+      channel_buffers.emplace_back(max_block_size);
+      input_ptrs[bus].push_back(channel_buffers.back().data());
+    }
+  }
+  for (uintptr_t bus = 0; bus < config.audio_outputs.count; bus++) {
+    for (uintptr_t c = 0; c < config.audio_outputs.data[bus].value.channels;
+         c++) {
+      channel_buffers.emplace_back(max_block_size);
+      output_ptrs[bus].push_back(channel_buffers.back().data());
+    }
+  }
+
+  std::vector<float **> inputs, outputs;
+  for (auto &bus : input_ptrs) {
+    inputs.push_back(bus.data());
+  }
+  for (auto &bus : output_ptrs) {
+    outputs.push_back(bus.data());
+  }
+
+  std::vector<double> block_ns;
+  block_ns.reserve(trace.blocks.size() * loops);
+  std::vector<HostIssuedEvent> events;
+  uintptr_t sample_rate = 0;
+  double audio_seconds = 0.0;
+
+  for (int loop = 0; loop < loops; loop++) {
+    for (const TraceBlock &block : trace.blocks) {
+      if (block.details.sample_rate != sample_rate) {
+        sample_rate = block.details.sample_rate;
+        vst3_set_sample_rate(app, (int32_t)sample_rate);
+      }
+
+      const float *samples = &trace.samples[block.samples_offset];
+      for (auto &bus : input_ptrs) {
+        for (float *channel : bus) {
+          memcpy(channel, samples, block.details.block_size * sizeof(float));
+          samples += block.details.block_size;
+        }
+      }
+      events = block.events;
+
+      auto start = Clock::now();
+      process(app, &block.details, inputs.data(), outputs.data(),
+              events.data(), (int32_t)events.size());
+      block_ns.push_back(
+          (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+              Clock::now() - start)
+              .count());
+
+      if (block.details.sample_rate > 0) {
+        audio_seconds += (double)block.details.block_size /
+                         (double)block.details.sample_rate;
+      }
+    }
+  }
+
+  delete (PluginInstance *)app;
+
+  double total_ns = 0.0;
+  for (double ns : block_ns) {
+    total_ns += ns;
+  }
+  std::sort(block_ns.begin(), block_ns.end());
+
+  double p50 = block_ns.empty() ? 0.0 : block_ns[block_ns.size() / 2];
+  double p99 = block_ns.empty()
+                   ? 0.0
+                   : block_ns[std::min(block_ns.size() - 1,
+                                       (size_t)(block_ns.size() * 0.99))];
+  double max = block_ns.empty() ? 0.0 : block_ns.back();
+
+  printf("{\"blocks\":%zu,\"dropped_blocks\":%llu,\"total_ns\":%.1f,"
+         "\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f,"
+         "\"realtime_factor\":%.2f}\n",
+         block_ns.size(), (unsigned long long)trace.dropped_blocks, total_ns,
+         p50, p99, max, total_ns > 0.0 ? audio_seconds * 1e9 / total_ns : 0.0);
+
+  return 0;
+}
@@ -0,0 +1,20 @@
+// Hosts one sandboxed plugin for a parent process. Started by
+// `load_plugin_sandboxed` as `vst3wrapper_sandbox_worker <name> <host pid>`.
+
+#include <cstdlib>
+
+#include "sandbox.h"
+#include "vst3wrapper.h"
+
+void send_event_to_host(const PluginIssuedEvent *event,
+                        const void * /*plugin_sent_events_producer*/) {
+  sandbox_worker_send_event(event);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    return 1;
+  }
+
+  return run_sandbox_worker(argv[1], strtoull(argv[2], nullptr, 10));
+}
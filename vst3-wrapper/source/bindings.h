@@ -1,9 +1,18 @@
+#pragma once
+
 #include <cstdarg>
 #include <cstdint>
 #include <cstdlib>
 #include <ostream>
 #include <new>
 
+enum class LogLevel : uint8_t {
+  Debug,
+  Info,
+  Warning,
+  Error,
+};
+
 enum class PlayingState : uint8_t {
   Stopped,
   Playing,
@@ -112,7 +121,7 @@ struct HostIssuedEventType {
 };
 
 /// Events sent to the plugin from the host. Can be passed into the `process` function or queued
-/// for the next process call with `queue_event`.
+/// from any thread for a future block with `queue_event`.
 struct HostIssuedEvent {
   HostIssuedEventType event_type;
   /// Time in samples from start of next block.
@@ -121,6 +130,30 @@ struct HostIssuedEvent {
   uintptr_t bus_index;
 };
 
+/// When an event queued with `queue_event` should reach the plugin.
+struct EventTime {
+  enum class Tag {
+    /// Absolute sample position on the instance's own clock. See `sample_position`.
+    Samples,
+    /// Musical position. Delivered once the transport reaches it.
+    Ppq,
+  };
+
+  struct Samples_Body {
+    uint64_t _0;
+  };
+
+  struct Ppq_Body {
+    PpqTime _0;
+  };
+
+  Tag tag;
+  union {
+    Samples_Body samples;
+    Ppq_Body ppq;
+  };
+};
+
 struct ParameterFFI {
   int id;
   const char *name;
@@ -166,10 +199,57 @@ struct PluginIssuedEvent {
   };
 };
 
+/// A diagnostic message logged by the wrapper. `tag` identifies the plugin instance that logged
+/// it, or is 0 for messages not tied to an instance.
+struct LogRecordFFI {
+  LogLevel level;
+  uintptr_t tag;
+  /// Number of identical messages that were dropped by rate limiting before this one.
+  uint32_t suppressed;
+  char message[128];
+};
+
+/// Bytes the wrapper allocated for one plugin instance, by structure. The plugin's own
+/// allocations are not included.
+struct MemoryUsage {
+  /// The instance itself, including its fixed-capacity command queues.
+  uintptr_t instance;
+  /// Bus and channel pointer arrays handed to the plugin. Channels point at the host's buffers.
+  uintptr_t process_data;
+  /// MIDI passed to the plugin, sized for one block.
+  uintptr_t event_lists;
+  /// Automation passed to the plugin, one queue per parameter.
+  uintptr_t parameter_changes;
+  /// Parameter ids and edit state mirrored between the processor and the edit controller.
+  uintptr_t parameter_tables;
+  /// Events queued with `queue_event` and the buffers merging them into blocks.
+  uintptr_t event_scheduler;
+  /// FIFOs of a fixed block size.
+  uintptr_t block_adapter;
+  /// Ring buffer of a running capture.
+  uintptr_t capture;
+  /// Memory shared with a sandboxed plugin's worker process.
+  uintptr_t sandbox;
+  uintptr_t total;
+};
+
 extern "C" {
 
+/// Returns null if the plugin fails to load.
 extern const void *load_plugin(const char *s, const void *plugin_sent_events_producer);
 
+/// Loads the plugin in a worker process started from `worker_path` (the
+/// `vst3wrapper_sandbox_worker` executable), so a crashing plugin cannot take the host down
+/// with it. All other functions work the same on the returned instance, except the editor.
+/// Returns null if the worker fails to start or to load the plugin.
+extern const void *load_plugin_sandboxed(const char *s,
+                                         const void *plugin_sent_events_producer,
+                                         const char *worker_path);
+
+/// Shared memory buffer of a sandboxed plugin's input or output `channel`, counting channels
+/// across buses. Audio rendered directly into these is not copied. Null for in-process plugins.
+extern float *sandbox_channel_buffer(const void *app, bool output, uintptr_t channel);
+
 extern Dims show_gui(const void *app, const void *window_id);
 
 extern void hide_gui(const void *app);
@@ -180,17 +260,74 @@ extern IOConfigutaion io_config(const void *app);
 
 extern uintptr_t parameter_count(const void *app);
 
-extern void process(const void *app,
+extern uintptr_t get_latency(const void *app);
+
+/// Whether the plugin currently allows being processed ahead of the playhead, as reported by
+/// `IPrefetchableSupport`. Plugins without the interface are assumed to allow it.
+extern bool prefetchable(const void *app);
+
+/// Returns false if the block was skipped because a control call needed the instance to itself
+/// (see `set_queued_control`). `output` is left untouched then.
+extern bool process(const void *app,
                     const ProcessDetails *data,
                     float ***input,
                     float ***output,
                     HostIssuedEvent *events,
                     int32_t events_len);
 
-extern void set_param_in_edit_controller(const void *app, int32_t id, float value);
+extern void set_auto_sleep(const void *app, bool enabled);
+
+/// Feeds the plugin constant blocks of `block_size` samples whatever block sizes `process` is
+/// called with, adding `block_size` samples of latency, which is reported with `ChangeLatency`.
+/// 0 disables it. Not supported for sandboxed plugins.
+extern bool set_fixed_block_size(const void *app, uint32_t block_size);
+
+/// Tells the plugin the largest block `process` will be called with, so it can size its
+/// buffers. Defaults to 8192, which is also the limit. The plugin is deactivated and
+/// reactivated, so don't call it from the audio thread.
+extern bool set_max_block_size(const void *app, uint32_t max_block_size);
+
+/// Bytes the wrapper allocated for the instance. Doesn't include the plugin's own allocations.
+extern MemoryUsage memory_usage(const void *app);
+
+extern uint64_t output_silence_flags(const void *app, uintptr_t bus);
+
+/// Queues `event` for the block containing `time`. Safe to call from any thread. Returns
+/// false if the queue is full.
+extern bool queue_event(const void *app, const HostIssuedEvent *event, EventTime time);
+
+/// Number of samples processed since the plugin was loaded. The clock for
+/// `EventTime::Samples`.
+extern uint64_t sample_position(const void *app);
+
+/// Applies the restarts the plugin requested through `restartComponent` since the last call,
+/// then sends `IOChanged`, `ChangeLatency` and `UpdateDisplay` as needed. Changed buses are
+/// rebuilt with processing stopped, so call it from the UI thread, not concurrently with
+/// `process` unless queued control is enabled, and rebind buffers after `IOChanged`.
+extern void apply_restart(const void *app);
+
+/// Mirrors every parameter changed by `process` since the last call to the edit controller.
+extern void flush_param_updates(const void *app);
+
+/// Starts writing every block passed to `process` to a trace file at `path`, along with the
+/// plugin's state if `include_state` is set. Replay it with `vst3wrapper_replay`.
+extern bool start_capture(const void *app, const char *path, bool include_state);
+
+extern void stop_capture(const void *app);
 
 extern ParameterFFI get_parameter(const void *app, int32_t id);
 
+/// Number of programs across the plugin's program lists. The lists are read once, on first use,
+/// and cached.
+extern uintptr_t program_count(const void *app);
+
+/// Name of program `index`, counting across program lists. Null if out of range.
+extern const char *program_name(const void *app, uintptr_t index);
+
+/// Switches to program `index` at the start of the next block, through the program change
+/// parameter of its unit. Returns false if out of range or the unit has no such parameter.
+extern bool set_program(const void *app, uintptr_t index);
+
 extern const void *get_data(const void *app, int32_t *data_len, const void **stream);
 
 extern void free_data_stream(const void *stream);
@@ -199,6 +336,29 @@ extern void set_data(const void *app, const void *data, int32_t data_len);
 
 extern void set_processing(const void *app, bool processing);
 
+/// While enabled, control calls such as `set_processing` and `set_data` are queued and applied
+/// at the start of the next block by whichever thread calls `process`, so C callers may make
+/// them concurrently with it. Returns false from `process` for skipped blocks.
+extern void set_queued_control(const void *app, bool enabled);
+
+extern uintptr_t drain_log(LogRecordFFI *records, uintptr_t max_records);
+
+/// Starts or stops recording wrapper calls of every instance into per-thread timelines.
+/// Registers the calling thread when enabling.
+extern void set_timeline_tracing(bool enabled);
+
+/// Allocates a timeline for the calling thread, labelled `name` in dumps. Only registered
+/// threads record, so call it from the audio thread before tracing it, outside of `process`.
+extern void register_timeline_thread(const char *name);
+
+/// Writes the recorded timelines to `path` as Chrome trace JSON.
+extern bool dump_timeline(const char *path);
+
+/// Calls the timer and file descriptor handlers plugins registered with the host's run loop,
+/// waiting up to `timeout_ms` for one to become ready. Linux plugins rely on it for their
+/// timers and editors, so call it regularly from the UI thread.
+extern void run_loop_dispatch(uint32_t timeout_ms);
+
 extern void free_string(const char *str);
 
 void send_event_to_host(const PluginIssuedEvent *event, const void *plugin_sent_events_producer);
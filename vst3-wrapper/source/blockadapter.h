@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "bindings.h"
+
+const size_t BLOCK_ADAPTER_MAX_EVENTS = 1024;
+
+// Moves `data` on by `frames` samples at its tempo.
+inline void advance_transport(ProcessDetails &data, uintptr_t frames) {
+  if (data.sample_rate == 0) {
+    return;
+  }
+  double seconds = (double)frames / (double)data.sample_rate;
+  data.nanos += seconds * 1e9;
+  if (data.playing_state != PlayingState::Stopped) {
+    data.player_time += seconds * data.tempo / 60.0;
+  }
+}
+
+// Feeds a plugin constant blocks whatever block sizes the host uses, by
+// buffering input and output through FIFOs of one block each. Adds exactly one
+// block of latency. Everything is allocated by `configure`, so `process` is
+// safe on the audio thread.
+class FixedBlockAdapter {
+public:
+  // {UI thread} Sets the block size the plugin is fed, or disables the
+  // adapter for 0. Processing must be stopped.
+  void configure(uint32_t _block_size, const IOConfigutaion &io) {
+    block_size = _block_size;
+    fill = 0;
+    pending_len = 0;
+
+    input_fifo.clear();
+    output_fifo.clear();
+    input_ptrs.clear();
+    output_ptrs.clear();
+    inputs.clear();
+    outputs.clear();
+    pending.clear();
+
+    if (block_size == 0) {
+      return;
+    }
+
+    allocate(io.audio_inputs, input_fifo, input_ptrs, inputs);
+    allocate(io.audio_outputs, output_fifo, output_ptrs, outputs);
+    pending.resize(BLOCK_ADAPTER_MAX_EVENTS);
+  }
+
+  bool enabled() const { return block_size != 0; }
+  uint32_t latency() const { return block_size; }
+
+  size_t allocated_bytes() const {
+    size_t bytes = pending.capacity() * sizeof(HostIssuedEvent) +
+                   (inputs.capacity() + outputs.capacity()) * sizeof(float **);
+    for (const auto *fifo : {&input_fifo, &output_fifo}) {
+      for (const auto &channel : *fifo) {
+        bytes += channel.capacity() * sizeof(float);
+      }
+    }
+    for (const auto *ptrs : {&input_ptrs, &output_ptrs}) {
+      for (const auto &bus : *ptrs) {
+        bytes += bus.capacity() * sizeof(float *);
+      }
+    }
+    return bytes;
+  }
+
+  // {Audio thread} Buffers one host block, calling `process_fixed` with the
+  // same arguments as `process` for every full block. Events are retimed into
+  // the block their sample lands in. Returns how many events didn't fit.
+  template <typename ProcessFixed>
+  uint32_t process(const ProcessDetails *data, float ***input, float ***output,
+                   HostIssuedEvent *events, int32_t events_len,
+                   ProcessFixed &&process_fixed) {
+    uint32_t dropped = 0;
+    uintptr_t frames = data->block_size;
+    uintptr_t done = 0;
+
+    while (done < frames) {
+      if (fill == 0) {
+        block_details = *data;
+        advance_transport(block_details, done);
+        block_details.block_size = block_size;
+      }
+
+      uintptr_t count = std::min<uintptr_t>(frames - done, block_size - fill);
+      copy(input_ptrs, input, done, inputs.data(), fill, count);
+      copy(output_ptrs, outputs.data(), fill, output, done, count);
+
+      bool last_chunk = done + count == frames;
+      for (int32_t i = 0; i < events_len; i++) {
+        uintptr_t time = events[i].block_time;
+        bool in_chunk = time >= done && (time < done + count || last_chunk);
+        if (!in_chunk) {
+          continue;
+        }
+        if (pending_len == pending.size()) {
+          dropped++;
+          continue;
+        }
+        pending[pending_len] = events[i];
+        pending[pending_len].block_time =
+            fill + std::min<uintptr_t>(time - done, count - 1);
+        pending_len++;
+      }
+
+      fill += (uint32_t)count;
+      done += count;
+
+      if (fill == block_size) {
+        process_fixed(&block_details, inputs.data(), outputs.data(),
+                      pending.data(), (int32_t)pending_len);
+        pending_len = 0;
+        fill = 0;
+      }
+    }
+
+    return dropped;
+  }
+
+private:
+  using Buses = HeaplessVec<AudioBusDescriptor, 16>;
+
+  void allocate(const Buses &buses, std::vector<std::vector<float>> &fifo,
+                std::vector<std::vector<float *>> &ptrs,
+                std::vector<float **> &bus_ptrs) {
+    for (uintptr_t bus = 0; bus < buses.count; bus++) {
+      for (uintptr_t c = 0; c < buses.data[bus].value.channels; c++) {
+        fifo.emplace_back(block_size, 0.0f);
+      }
+    }
+
+    // Pointers are taken once `fifo` has stopped growing
+    size_t channel = 0;
+    ptrs.resize(buses.count);
+    for (uintptr_t bus = 0; bus < buses.count; bus++) {
+      for (uintptr_t c = 0; c < buses.data[bus].value.channels; c++) {
+        ptrs[bus].push_back(fifo[channel++].data());
+      }
+      bus_ptrs.push_back(ptrs[bus].data());
+    }
+  }
+
+  // Copies `count` frames between host buffers and FIFOs, which share the
+  // layout of `layout`.
+  static void copy(const std::vector<std::vector<float *>> &layout,
+                   float ***from, uintptr_t from_offset, float ***to,
+                   uintptr_t to_offset, uintptr_t count) {
+    for (size_t bus = 0; bus < layout.size(); bus++) {
+      for (size_t c = 0; c < layout[bus].size(); c++) {
+        memcpy(to[bus][c] + to_offset, from[bus][c] + from_offset,
+               count * sizeof(float));
+      }
+    }
+  }
+
+  uint32_t block_size = 0;
+  // Frames buffered towards the next block
+  uint32_t fill = 0;
+
+  std::vector<std::vector<float>> input_fifo, output_fifo;
+  std::vector<std::vector<float *>> input_ptrs, output_ptrs;
+  std::vector<float **> inputs, outputs;
+
+  std::vector<HostIssuedEvent> pending;
+  size_t pending_len = 0;
+  ProcessDetails block_details = {};
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity lock-free queue. Any number of threads may push and pop.
+// Elements are written and read in place through callbacks so large records
+// never get copied through temporaries. `Capacity` must be a power of two.
+template <typename T, size_t Capacity> class BoundedQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "BoundedQueue capacity must be a power of two");
+
+public:
+  BoundedQueue() {
+    for (size_t i = 0; i < Capacity; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // Claims a slot and calls `fill(T &)` on it. Returns false if the queue is
+  // full, in which case `fill` is not called.
+  template <typename F> bool push_with(F &&fill) {
+    Cell *cell = nullptr;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & (Capacity - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    fill(cell->data);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool push(const T &value) {
+    return push_with([&](T &slot) { slot = value; });
+  }
+
+  // Calls `consume(T &)` on the oldest element and releases its slot. Returns
+  // false if the queue is empty.
+  template <typename F> bool pop_with(F &&consume) {
+    Cell *cell = nullptr;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & (Capacity - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    consume(cell->data);
+    cell->sequence.store(pos + Capacity, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value) {
+    return pop_with([&](T &slot) { value = slot; });
+  }
+
+  bool empty() const {
+    return enqueue_pos.load(std::memory_order_acquire) ==
+           dequeue_pos.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  Cell cells[Capacity];
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
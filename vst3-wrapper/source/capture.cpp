@@ -0,0 +1,211 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Enough for several seconds of multichannel audio at typical block sizes,
+// so disk hiccups don't drop blocks.
+static const size_t CAPTURE_RING_SIZE = 32 * 1024 * 1024;
+static const int CAPTURE_WRITER_INTERVAL_MS = 5;
+
+static bool write_u32(FILE *file, uint32_t value) {
+  return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool read_u32(FILE *file, uint32_t &value) {
+  return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool write_channels(FILE *file, const std::vector<uint32_t> &channels) {
+  return write_u32(file, (uint32_t)channels.size()) &&
+         fwrite(channels.data(), sizeof(uint32_t), channels.size(), file) ==
+             channels.size();
+}
+
+static bool read_channels(FILE *file, std::vector<uint32_t> &channels) {
+  uint32_t count = 0;
+  if (!read_u32(file, count) || count > 64) {
+    return false;
+  }
+  channels.resize(count);
+  return fread(channels.data(), sizeof(uint32_t), count, file) == count;
+}
+
+bool write_trace_header(FILE *file, const TraceHeader &header) {
+  return fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, file) == 1 &&
+         write_u32(file, (uint32_t)header.plugin_path.size()) &&
+         fwrite(header.plugin_path.data(), 1, header.plugin_path.size(),
+                file) == header.plugin_path.size() &&
+         write_channels(file, header.input_channels) &&
+         write_channels(file, header.output_channels) &&
+         write_u32(file, (uint32_t)header.state.size()) &&
+         fwrite(header.state.data(), 1, header.state.size(), file) ==
+             header.state.size();
+}
+
+bool read_trace_header(FILE *file, TraceHeader &header) {
+  char magic[sizeof(TRACE_MAGIC)] = {};
+  if (fread(magic, sizeof(magic), 1, file) != 1 ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+    return false;
+  }
+
+  uint32_t len = 0;
+  if (!read_u32(file, len)) {
+    return false;
+  }
+  header.plugin_path.resize(len);
+  if (fread(&header.plugin_path[0], 1, len, file) != len) {
+    return false;
+  }
+
+  if (!read_channels(file, header.input_channels) ||
+      !read_channels(file, header.output_channels)) {
+    return false;
+  }
+
+  if (!read_u32(file, len)) {
+    return false;
+  }
+  header.state.resize(len);
+  return fread(header.state.data(), 1, len, file) == len;
+}
+
+ProcessRecorder::~ProcessRecorder() { stop(); }
+
+bool ProcessRecorder::start(const std::string &path,
+                            const TraceHeader &header) {
+  stop();
+
+  file = fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  if (!write_trace_header(file, header)) {
+    fclose(file);
+    file = nullptr;
+    return false;
+  }
+
+  ring.assign(CAPTURE_RING_SIZE, 0);
+  input_channels = header.input_channels;
+  dropped = 0;
+  read_pos.store(0);
+  write_pos.store(0);
+
+  writer_running.store(true);
+  writer = std::thread(&ProcessRecorder::writer_loop, this);
+  _active.store(true);
+  return true;
+}
+
+void ProcessRecorder::stop() {
+  if (!file) {
+    return;
+  }
+
+  // Pairs with `record`: once `busy` reads false after clearing `_active`,
+  // no block is being written into the ring and none will be.
+  _active.store(false);
+  while (busy.load()) {
+    std::this_thread::yield();
+  }
+
+  writer_running.store(false);
+  writer.join();
+
+  fclose(file);
+  file = nullptr;
+
+  ring.clear();
+  ring.shrink_to_fit();
+}
+
+void ProcessRecorder::record(const ProcessDetails *data, float ***input,
+                             const HostIssuedEvent *events,
+                             int32_t events_len) {
+  busy.store(true);
+  if (!_active.load()) {
+    busy.store(false);
+    return;
+  }
+
+  size_t channels = 0;
+  for (uint32_t count : input_channels) {
+    channels += count;
+  }
+
+  size_t size = sizeof(TraceRecord) + sizeof(ProcessDetails) +
+                sizeof(int32_t) + events_len * sizeof(HostIssuedEvent) +
+                channels * data->block_size * sizeof(float);
+  size_t gap_size = sizeof(TraceRecord) + sizeof(uint32_t);
+
+  size_t used = write_pos.load(std::memory_order_relaxed) -
+                read_pos.load(std::memory_order_acquire);
+  if (used + size + gap_size > ring.size()) {
+    dropped++;
+    busy.store(false);
+    return;
+  }
+
+  if (dropped > 0) {
+    TraceRecord tag = TraceRecord::Gap;
+    write(&tag, sizeof(tag));
+    write(&dropped, sizeof(dropped));
+    dropped = 0;
+  }
+
+  TraceRecord tag = TraceRecord::Process;
+  write(&tag, sizeof(tag));
+  write(data, sizeof(ProcessDetails));
+  write(&events_len, sizeof(events_len));
+  write(events, events_len * sizeof(HostIssuedEvent));
+  for (size_t bus = 0; bus < input_channels.size(); bus++) {
+    for (uint32_t channel = 0; channel < input_channels[bus]; channel++) {
+      write(input[bus][channel], data->block_size * sizeof(float));
+    }
+  }
+
+  busy.store(false);
+}
+
+void ProcessRecorder::write(const void *bytes, size_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  size_t pos = write_pos.load(std::memory_order_relaxed);
+  size_t offset = pos % ring.size();
+  size_t first = std::min(len, ring.size() - offset);
+
+  memcpy(&ring[offset], bytes, first);
+  memcpy(&ring[0], (const uint8_t *)bytes + first, len - first);
+
+  write_pos.store(pos + len, std::memory_order_release);
+}
+
+void ProcessRecorder::writer_loop() {
+  for (;;) {
+    // Read the flag first so the last pass after `stop` drains everything
+    bool running = writer_running.load();
+
+    size_t start = read_pos.load(std::memory_order_relaxed);
+    size_t end = write_pos.load(std::memory_order_acquire);
+    while (start < end) {
+      size_t offset = start % ring.size();
+      size_t len = std::min(end - start, ring.size() - offset);
+      fwrite(&ring[offset], 1, len, file);
+      start += len;
+    }
+    read_pos.store(start, std::memory_order_release);
+
+    if (!running) {
+      break;
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(CAPTURE_WRITER_INTERVAL_MS));
+  }
+
+  fflush(file);
+}
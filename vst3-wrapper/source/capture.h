@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bindings.h"
+
+// Trace files written by `ProcessRecorder` and read by `vst3wrapper_replay`.
+// Everything is stored in the recording machine's native layout.
+//
+//   char     magic[8]            TRACE_MAGIC
+//   uint32_t path_len, char path[path_len]
+//   uint32_t input_buses,  uint32_t channels[input_buses]
+//   uint32_t output_buses, uint32_t channels[output_buses]
+//   uint32_t state_len, uint8_t state[state_len]   (0 if not captured)
+//
+// followed by records, each starting with a `TraceRecord` tag:
+//
+//   Process: ProcessDetails, int32_t events_len,
+//            HostIssuedEvent events[events_len],
+//            float samples[block_size] for every input channel, bus by bus
+//   Gap:     uint32_t blocks dropped because the writer fell behind
+const char TRACE_MAGIC[8] = {'V', '3', 'T', 'R', 'A', 'C', 'E', '1'};
+
+enum class TraceRecord : uint8_t {
+  Process,
+  Gap,
+};
+
+struct TraceHeader {
+  std::string plugin_path;
+  std::vector<uint32_t> input_channels;
+  std::vector<uint32_t> output_channels;
+  std::vector<uint8_t> state;
+};
+
+bool write_trace_header(FILE *file, const TraceHeader &header);
+bool read_trace_header(FILE *file, TraceHeader &header);
+
+// Serialises every processed block into a trace file. The audio thread only
+// copies the block into a lock-free ring; a writer thread moves it to disk.
+// Blocks that don't fit in the ring are dropped and recorded as a gap. The
+// ring is only allocated while recording.
+class ProcessRecorder {
+public:
+  ProcessRecorder() = default;
+  ~ProcessRecorder();
+
+  ProcessRecorder(const ProcessRecorder &) = delete;
+  ProcessRecorder &operator=(const ProcessRecorder &) = delete;
+
+  // {UI thread}
+  bool start(const std::string &path, const TraceHeader &header);
+  // {UI thread} Waits for any block being recorded and flushes the file.
+  void stop();
+  bool active() const { return _active.load(); }
+  size_t allocated_bytes() const {
+    return ring.capacity() + input_channels.capacity() * sizeof(uint32_t);
+  }
+
+  // {Audio thread}
+  void record(const ProcessDetails *data, float ***input,
+              const HostIssuedEvent *events, int32_t events_len);
+
+private:
+  void write(const void *bytes, size_t len);
+  void writer_loop();
+
+  std::vector<uint8_t> ring;
+  std::atomic<size_t> write_pos{0};
+  std::atomic<size_t> read_pos{0};
+
+  std::vector<uint32_t> input_channels;
+  uint32_t dropped = 0;
+
+  FILE *file = nullptr;
+  std::thread writer;
+  std::atomic<bool> _active{false};
+  std::atomic<bool> busy{false};
+  std::atomic<bool> writer_running{false};
+};
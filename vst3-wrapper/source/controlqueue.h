@@ -0,0 +1,30 @@
+#pragma once
+
+#include "bindings.h"
+#include "boundedqueue.h"
+#include "memoryibstream.h"
+
+constexpr size_t COMMAND_QUEUE_CAPACITY = 64;
+
+enum class ControlCommandType {
+  SetProcessing,
+  SetState,
+  SetSampleRate,
+  SetAutoSleep,
+};
+
+// A control operation on an instance with queued control. Commands are
+// applied in order at the start of the instance's next block, on whichever
+// thread processes it.
+struct ControlCommand {
+  ControlCommandType type = ControlCommandType::SetProcessing;
+  bool enabled = false;
+  int32_t value = 0;
+  // Owned by the command until applied, then handed back to the control side
+  // through `PluginInstance::retired_states` so the audio thread never frees.
+  Steinberg::ResizableMemoryIBStream *state = nullptr;
+};
+
+using CommandQueue = BoundedQueue<ControlCommand, COMMAND_QUEUE_CAPACITY>;
+using RetiredStateQueue =
+    BoundedQueue<Steinberg::ResizableMemoryIBStream *, COMMAND_QUEUE_CAPACITY>;
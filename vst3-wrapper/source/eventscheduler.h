@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "bindings.h"
+#include "boundedqueue.h"
+
+constexpr size_t EVENT_QUEUE_CAPACITY = 1024;
+
+struct QueuedEvent {
+  HostIssuedEvent event;
+  EventTime time;
+};
+
+// Events queued from any thread for a future block. The audio thread moves
+// them into `pending` and hands them to `process` once their block arrives,
+// merged with that block's own events in time order. Nothing allocates on the
+// audio thread as long as the block's own events fit the reserved capacity.
+class EventScheduler {
+public:
+  EventScheduler() {
+    pending.reserve(EVENT_QUEUE_CAPACITY);
+    due.reserve(EVENT_QUEUE_CAPACITY);
+    merged.reserve(EVENT_QUEUE_CAPACITY * 2);
+  }
+
+  // {Any thread} Returns false if the queue is full.
+  bool push(const HostIssuedEvent &event, EventTime time) {
+    return queue.push_with([&](QueuedEvent &queued) {
+      queued.event = event;
+      queued.time = time;
+    });
+  }
+
+  // {Audio thread} Returns the events for the block starting at absolute
+  // sample `block_start`. That is `events` itself if nothing queued is due,
+  // otherwise a merged list owned by the scheduler, valid until the next call.
+  // Events already late are delivered at the start of the block. PPQ events
+  // wait while the transport is stopped.
+  HostIssuedEvent *schedule(const ProcessDetails *data, uint64_t block_start,
+                            HostIssuedEvent *events, int32_t &events_len) {
+    while (pending.size() < pending.capacity()) {
+      QueuedEvent queued;
+      if (!queue.pop(queued)) {
+        break;
+      }
+      pending.push_back(queued);
+    }
+
+    if (pending.empty()) {
+      return events;
+    }
+
+    due.clear();
+    bool playing =
+        data->playing_state != PlayingState::Stopped && data->tempo > 0.0;
+    double samples_per_beat = data->sample_rate * 60.0 / data->tempo;
+
+    // Move due events out of `pending`, keeping the rest in order
+    size_t kept = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+      QueuedEvent &queued = pending[i];
+
+      double offset = -1.0;
+      if (queued.time.tag == EventTime::Tag::Samples) {
+        offset = (double)queued.time.samples._0 - (double)block_start;
+      } else if (playing) {
+        offset = (queued.time.ppq._0 - data->player_time) * samples_per_beat;
+      } else {
+        pending[kept++] = queued;
+        continue;
+      }
+
+      if (offset >= (double)data->block_size) {
+        pending[kept++] = queued;
+        continue;
+      }
+
+      HostIssuedEvent event = queued.event;
+      event.block_time = offset > 0.0 ? (Samples)offset : 0;
+      due.push_back(event);
+    }
+    pending.resize(kept);
+
+    if (due.empty()) {
+      return events;
+    }
+
+    auto earlier = [](const HostIssuedEvent &a, const HostIssuedEvent &b) {
+      return a.block_time < b.block_time;
+    };
+
+    // Insertion sort keeps queue order for events at the same sample
+    for (size_t i = 1; i < due.size(); i++) {
+      HostIssuedEvent event = due[i];
+      size_t j = i;
+      for (; j > 0 && earlier(event, due[j - 1]); j--) {
+        due[j] = due[j - 1];
+      }
+      due[j] = event;
+    }
+
+    merged.resize(due.size() + events_len);
+    std::merge(events, events + events_len, due.begin(), due.end(),
+               merged.begin(), earlier);
+
+    events_len = (int32_t)merged.size();
+    return merged.data();
+  }
+
+  // Including the queue itself.
+  size_t allocated_bytes() const {
+    return sizeof(*this) + pending.capacity() * sizeof(QueuedEvent) +
+           (due.capacity() + merged.capacity()) * sizeof(HostIssuedEvent);
+  }
+
+private:
+  BoundedQueue<QueuedEvent, EVENT_QUEUE_CAPACITY> queue;
+  std::vector<QueuedEvent> pending;
+  std::vector<HostIssuedEvent> due;
+  std::vector<HostIssuedEvent> merged;
+};
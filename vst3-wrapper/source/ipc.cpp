@@ -0,0 +1,336 @@
+#include "ipc.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+extern char **environ;
+#endif
+
+// Spins before sleeping, long enough to cover a typical block on the other
+// side. Pointless with a single core, where the other side can't run while
+// we spin.
+static const int IPC_SPIN_COUNT = 2000;
+
+static int spin_count() {
+  static const int count =
+      std::thread::hardware_concurrency() > 1 ? IPC_SPIN_COUNT : 0;
+  return count;
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||             \
+    defined(_M_IX86)
+#ifdef _MSC_VER
+  YieldProcessor();
+#else
+  __builtin_ia32_pause();
+#endif
+#endif
+}
+
+SharedMemory::~SharedMemory() { close(); }
+
+#ifdef _WIN32
+
+bool SharedMemory::create(const std::string &name, size_t size) {
+  close();
+  handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                              (DWORD)((uint64_t)size >> 32), (DWORD)size,
+                              name.c_str());
+  if (!handle) {
+    return false;
+  }
+  _data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  _size = size;
+  owner = true;
+  _name = name;
+  return _data != nullptr;
+}
+
+bool SharedMemory::open(const std::string &name, size_t size) {
+  close();
+  handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+  if (!handle) {
+    return false;
+  }
+  _data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  _size = size;
+  _name = name;
+  return _data != nullptr;
+}
+
+void SharedMemory::close() {
+  if (_data) {
+    UnmapViewOfFile(_data);
+  }
+  if (handle) {
+    CloseHandle(handle);
+  }
+  _data = nullptr;
+  handle = nullptr;
+  _size = 0;
+  owner = false;
+}
+
+IpcEvent::~IpcEvent() {
+  if (handle) {
+    CloseHandle(handle);
+  }
+}
+
+bool IpcEvent::init(std::atomic<uint32_t> *_word, const std::string &name,
+                    bool create) {
+  word = _word;
+  handle = create ? CreateEventA(nullptr, FALSE, FALSE, name.c_str())
+                  : OpenEventA(EVENT_ALL_ACCESS, FALSE, name.c_str());
+  return handle != nullptr;
+}
+
+void IpcEvent::notify() {
+  word->fetch_add(1, std::memory_order_release);
+  SetEvent(handle);
+}
+
+bool IpcEvent::wait(uint32_t seen, uint32_t timeout_ms) {
+  for (int i = 0; i < spin_count(); i++) {
+    if (value() != seen) {
+      return true;
+    }
+    cpu_relax();
+  }
+
+  // The event is auto-reset and may carry a stale signal, so the counter is
+  // always the source of truth.
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeout_ms);
+  while (value() == seen) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         deadline - now)
+                         .count();
+    WaitForSingleObject(handle, (DWORD)remaining + 1);
+  }
+  return true;
+}
+
+ChildProcess::~ChildProcess() {
+  kill();
+  if (handle) {
+    CloseHandle(handle);
+  }
+}
+
+bool ChildProcess::spawn(const std::string &path, const std::string &arg0,
+                         const std::string &arg1) {
+  std::string command_line = "\"" + path + "\" " + arg0 + " " + arg1;
+
+  STARTUPINFOA startup_info = {};
+  startup_info.cb = sizeof(startup_info);
+  PROCESS_INFORMATION process_info = {};
+
+  if (!CreateProcessA(path.c_str(), &command_line[0], nullptr, nullptr, FALSE,
+                      0, nullptr, nullptr, &startup_info, &process_info)) {
+    return false;
+  }
+
+  CloseHandle(process_info.hThread);
+  handle = process_info.hProcess;
+  return true;
+}
+
+bool ChildProcess::running() {
+  return handle && WaitForSingleObject(handle, 0) == WAIT_TIMEOUT;
+}
+
+void ChildProcess::kill() {
+  if (running()) {
+    TerminateProcess(handle, 1);
+    WaitForSingleObject(handle, INFINITE);
+  }
+}
+
+uint64_t current_process_id() { return GetCurrentProcessId(); }
+
+bool process_alive(uint64_t pid) {
+  HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+  if (!process) {
+    return false;
+  }
+  bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+  CloseHandle(process);
+  return alive;
+}
+
+#else
+
+bool SharedMemory::create(const std::string &name, size_t size) {
+  close();
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  owner = true;
+  _name = name;
+
+  if (ftruncate(fd, (off_t)size) != 0) {
+    ::close(fd);
+    close();
+    return false;
+  }
+
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    close();
+    return false;
+  }
+
+  _data = data;
+  _size = size;
+  return true;
+}
+
+bool SharedMemory::open(const std::string &name, size_t size) {
+  close();
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    return false;
+  }
+
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  _data = data;
+  _size = size;
+  _name = name;
+  return true;
+}
+
+void SharedMemory::close() {
+  if (_data) {
+    munmap(_data, _size);
+  }
+  if (owner) {
+    shm_unlink(_name.c_str());
+  }
+  _data = nullptr;
+  _size = 0;
+  owner = false;
+}
+
+IpcEvent::~IpcEvent() {}
+
+bool IpcEvent::init(std::atomic<uint32_t> *_word, const std::string & /*name*/,
+                    bool /*create*/) {
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "Futex word must be a plain 32 bit integer");
+  word = _word;
+  return true;
+}
+
+void IpcEvent::notify() {
+  word->fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr,
+          0);
+#endif
+}
+
+bool IpcEvent::wait(uint32_t seen, uint32_t timeout_ms) {
+  for (int i = 0; i < spin_count(); i++) {
+    if (value() != seen) {
+      return true;
+    }
+    cpu_relax();
+  }
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeout_ms);
+  while (value() == seen) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+
+#ifdef __linux__
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         deadline - now)
+                         .count();
+    timespec timeout = {};
+    timeout.tv_sec = (time_t)(remaining / 1000000000);
+    timeout.tv_nsec = (long)(remaining % 1000000000);
+    // Returns immediately if the counter already moved
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, seen, &timeout, nullptr,
+            0);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+  }
+  return true;
+}
+
+ChildProcess::~ChildProcess() { kill(); }
+
+bool ChildProcess::spawn(const std::string &path, const std::string &arg0,
+                         const std::string &arg1) {
+  char *argv[] = {(char *)path.c_str(), (char *)arg0.c_str(),
+                  (char *)arg1.c_str(), nullptr};
+
+  pid_t child = -1;
+  if (posix_spawn(&child, path.c_str(), nullptr, nullptr, argv, environ) !=
+      0) {
+    return false;
+  }
+
+  pid = child;
+  return true;
+}
+
+bool ChildProcess::running() {
+  if (pid < 0) {
+    return false;
+  }
+
+  int status = 0;
+  if (waitpid(pid, &status, WNOHANG) == pid) {
+    pid = -1;
+    return false;
+  }
+  return true;
+}
+
+void ChildProcess::kill() {
+  if (running()) {
+    ::kill(pid, SIGKILL);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    pid = -1;
+  }
+}
+
+uint64_t current_process_id() { return (uint64_t)getpid(); }
+
+bool process_alive(uint64_t pid) { return ::kill((pid_t)pid, 0) == 0; }
+
+#endif
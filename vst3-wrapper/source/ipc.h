@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Memory mapping shared between the host and a sandbox worker. The creator
+// removes the name when it closes the mapping.
+class SharedMemory {
+public:
+  SharedMemory() = default;
+  ~SharedMemory();
+
+  SharedMemory(const SharedMemory &) = delete;
+  SharedMemory &operator=(const SharedMemory &) = delete;
+
+  // New mappings are zero filled.
+  bool create(const std::string &name, size_t size);
+  bool open(const std::string &name, size_t size);
+  void close();
+
+  void *data() const { return _data; }
+  size_t size() const { return _size; }
+
+private:
+  void *_data = nullptr;
+  size_t _size = 0;
+  bool owner = false;
+  std::string _name;
+#ifdef _WIN32
+  void *handle = nullptr;
+#endif
+};
+
+// Cross-process wakeup built on a counter in shared memory. `notify` bumps the
+// counter and wakes the other side; `wait` returns once it has moved. On Linux
+// the counter is waited on directly with a futex, on Windows through a named
+// event, elsewhere by polling.
+class IpcEvent {
+public:
+  IpcEvent() = default;
+  ~IpcEvent();
+
+  IpcEvent(const IpcEvent &) = delete;
+  IpcEvent &operator=(const IpcEvent &) = delete;
+
+  bool init(std::atomic<uint32_t> *word, const std::string &name,
+            bool create);
+
+  uint32_t value() const { return word->load(std::memory_order_acquire); }
+  void notify();
+  // Waits until the counter differs from `seen`. Spins briefly first since
+  // the other side usually answers within microseconds. Returns false on
+  // timeout.
+  bool wait(uint32_t seen, uint32_t timeout_ms);
+
+private:
+  std::atomic<uint32_t> *word = nullptr;
+#ifdef _WIN32
+  void *handle = nullptr;
+#endif
+};
+
+class ChildProcess {
+public:
+  ChildProcess() = default;
+  // Kills the process if it is still running.
+  ~ChildProcess();
+
+  ChildProcess(const ChildProcess &) = delete;
+  ChildProcess &operator=(const ChildProcess &) = delete;
+
+  bool spawn(const std::string &path, const std::string &arg0,
+             const std::string &arg1);
+  bool running();
+  void kill();
+
+private:
+#ifdef _WIN32
+  void *handle = nullptr;
+#else
+  int pid = -1;
+#endif
+};
+
+uint64_t current_process_id();
+bool process_alive(uint64_t pid);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "bindings.h"
+#include "boundedqueue.h"
+
+// Diagnostics from the wrapper are queued here instead of being written to
+// stdout, so logging from the audio thread never locks or flushes. The host
+// drains the ring from the UI thread with `drain_log`.
+const size_t LOG_RING_CAPACITY = 1024;
+
+// Each distinct message is emitted at most once per interval per instance.
+// Anything over that is counted and reported with the next emitted record.
+const int64_t LOG_RATE_LIMIT_NS = 1000000000;
+
+const int LOG_LIMITER_SLOTS = 32;
+
+using LogRing = BoundedQueue<LogRecordFFI, LOG_RING_CAPACITY>;
+
+class LogLimiter {
+public:
+  // Returns true if a message with the given format string may be logged now.
+  // `suppressed` is set to the number of records for that message which were
+  // dropped since the last one got through.
+  bool allow(const char *key, uint32_t &suppressed) {
+    Slot &slot = find(key);
+
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+
+    int64_t next_allowed = slot.next_allowed.load(std::memory_order_relaxed);
+    if (now < next_allowed ||
+        !slot.next_allowed.compare_exchange_strong(
+            next_allowed, now + LOG_RATE_LIMIT_NS, std::memory_order_relaxed)) {
+      slot.suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    suppressed = slot.suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Called when a record was allowed but the ring was full.
+  void dropped(const char *key, uint32_t count) {
+    find(key).suppressed.fetch_add(count, std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::atomic<const char *> key{nullptr};
+    std::atomic<int64_t> next_allowed{0};
+    std::atomic<uint32_t> suppressed{0};
+  };
+
+  // Format strings are literals so their addresses identify the message.
+  // When every slot is taken the remaining messages share the last one.
+  Slot &find(const char *key) {
+    for (int i = 0; i < LOG_LIMITER_SLOTS - 1; i++) {
+      const char *existing = slots[i].key.load(std::memory_order_acquire);
+      if (existing == key) {
+        return slots[i];
+      }
+
+      if (existing == nullptr &&
+          (slots[i].key.compare_exchange_strong(existing, key,
+                                                std::memory_order_acq_rel) ||
+           existing == key)) {
+        return slots[i];
+      }
+    }
+
+    return slots[LOG_LIMITER_SLOTS - 1];
+  }
+
+  Slot slots[LOG_LIMITER_SLOTS];
+};
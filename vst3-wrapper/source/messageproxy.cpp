@@ -0,0 +1,83 @@
+#include "messageproxy.h"
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+
+MessageProxy::MessageProxy(IConnectionPoint *_destination)
+    : destination(_destination) {
+  destination->addRef();
+}
+
+MessageProxy::~MessageProxy() { close(); }
+
+tresult PLUGIN_API MessageProxy::connect(IConnectionPoint * /*other*/) {
+  return kResultOk;
+}
+
+tresult PLUGIN_API MessageProxy::disconnect(IConnectionPoint * /*other*/) {
+  return kResultOk;
+}
+
+tresult PLUGIN_API MessageProxy::notify(IMessage *message) {
+  if (!destination || !message) {
+    return kResultFalse;
+  }
+
+  if (!in_audio_callback) {
+    return destination->notify(message);
+  }
+
+  // The reference is released on the UI thread after delivery, so the
+  // message is also freed there rather than on the audio thread.
+  message->addRef();
+  if (!queue.push(message)) {
+    message->release();
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return kResultFalse;
+  }
+  return kResultOk;
+}
+
+uint32_t MessageProxy::deliver() {
+  IMessage *message = nullptr;
+  while (queue.pop(message)) {
+    if (destination) {
+      destination->notify(message);
+    }
+    message->release();
+  }
+  return dropped.exchange(0, std::memory_order_relaxed);
+}
+
+void MessageProxy::close() {
+  IMessage *message = nullptr;
+  while (queue.pop(message)) {
+    message->release();
+  }
+
+  if (destination) {
+    destination->release();
+    destination = nullptr;
+  }
+}
+
+tresult PLUGIN_API MessageProxy::queryInterface(const TUID _iid, void **obj) {
+  if (FUnknownPrivate::iidEqual(_iid, IConnectionPoint::iid) ||
+      FUnknownPrivate::iidEqual(_iid, FUnknown::iid)) {
+    addRef();
+    *obj = static_cast<IConnectionPoint *>(this);
+    return kResultOk;
+  }
+  *obj = nullptr;
+  return kNoInterface;
+}
+
+uint32 PLUGIN_API MessageProxy::addRef() { return ++ref_count; }
+
+uint32 PLUGIN_API MessageProxy::release() {
+  uint32 count = --ref_count;
+  if (count == 0) {
+    delete this;
+  }
+  return count;
+}
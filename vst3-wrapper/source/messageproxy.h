@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+
+#include <pluginterfaces/vst/ivstmessage.h>
+
+#include "boundedqueue.h"
+
+const size_t MESSAGE_QUEUE_CAPACITY = 256;
+
+// Set while the calling thread is inside `process_block`.
+inline thread_local bool in_audio_callback = false;
+
+struct AudioCallbackScope {
+  AudioCallbackScope() { in_audio_callback = true; }
+  ~AudioCallbackScope() { in_audio_callback = false; }
+};
+
+// Stands in for the other side of a plugin's component/controller connection.
+// Messages sent from inside `process` are queued and delivered on the UI
+// thread by `deliver`, so the receiver's `notify` never runs on the audio
+// thread. Messages sent from any other thread are passed straight through.
+class MessageProxy : public Steinberg::Vst::IConnectionPoint {
+public:
+  explicit MessageProxy(Steinberg::Vst::IConnectionPoint *destination);
+  virtual ~MessageProxy();
+
+  Steinberg::tresult PLUGIN_API
+  connect(Steinberg::Vst::IConnectionPoint *other) override;
+  Steinberg::tresult PLUGIN_API
+  disconnect(Steinberg::Vst::IConnectionPoint *other) override;
+  Steinberg::tresult PLUGIN_API
+  notify(Steinberg::Vst::IMessage *message) override;
+
+  // {UI thread} Delivers queued messages in order. Returns how many messages
+  // were dropped since the last call because the queue was full.
+  uint32_t deliver();
+  // Drops queued messages and stops forwarding. Processing must be stopped.
+  void close();
+
+  Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID _iid,
+                                               void **obj) override;
+  Steinberg::uint32 PLUGIN_API addRef() override;
+  Steinberg::uint32 PLUGIN_API release() override;
+
+private:
+  Steinberg::Vst::IConnectionPoint *destination = nullptr;
+  BoundedQueue<Steinberg::Vst::IMessage *, MESSAGE_QUEUE_CAPACITY> queue;
+  std::atomic<uint32_t> dropped{0};
+  std::atomic<Steinberg::uint32> ref_count{1};
+};
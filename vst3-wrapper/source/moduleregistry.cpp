@@ -0,0 +1,31 @@
+#include "moduleregistry.h"
+
+ModuleRegistry::Entry &ModuleRegistry::entry(const std::string &path) {
+  std::lock_guard<std::mutex> guard(mutex);
+  std::unique_ptr<Entry> &entry = entries[path];
+  if (!entry) {
+    entry = std::make_unique<Entry>();
+  }
+  return *entry;
+}
+
+std::unique_lock<std::mutex> ModuleRegistry::lock(const std::string &path) {
+  return std::unique_lock<std::mutex>(entry(path).lock);
+}
+
+VST3::Hosting::Module::Ptr ModuleRegistry::acquire(const std::string &path,
+                                                   std::string &error) {
+  Entry &module_entry = entry(path);
+
+  VST3::Hosting::Module::Ptr module = module_entry.module.lock();
+  if (!module) {
+    module = VST3::Hosting::Module::create(path, error);
+    module_entry.module = module;
+  }
+  return module;
+}
+
+ModuleRegistry &module_registry() {
+  static ModuleRegistry registry;
+  return registry;
+}
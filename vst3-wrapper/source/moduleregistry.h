@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "public.sdk/source/vst/hosting/module.h"
+
+// Modules loaded by in-process instances, shared by every instance of the
+// same path. Plugins commonly keep unsynchronised state per module, so
+// loading a module and creating or destroying its instances is serialised
+// per module. Instances of different modules load in parallel.
+class ModuleRegistry {
+public:
+  // Held while loading the module at `path` or creating and destroying its
+  // instances.
+  std::unique_lock<std::mutex> lock(const std::string &path);
+
+  // {With `lock(path)` held} Returns the module at `path`, loading it unless
+  // a live instance already holds it.
+  VST3::Hosting::Module::Ptr acquire(const std::string &path,
+                                     std::string &error);
+
+private:
+  struct Entry {
+    std::mutex lock;
+    std::weak_ptr<VST3::Hosting::Module> module;
+  };
+
+  Entry &entry(const std::string &path);
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::unique_ptr<Entry>> entries;
+};
+
+ModuleRegistry &module_registry();
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Latest value per parameter plus a dirty bitset. The audio thread marks
+// parameters as it applies automation; the UI thread flushes only the dirty
+// ones. Repeated changes to one parameter between flushes coalesce to the
+// latest value and nothing is ever dropped.
+class ParameterSync {
+public:
+  // {UI thread} Not safe to call while the audio thread may mark.
+  void init(std::vector<uint32_t> param_ids) {
+    std::sort(param_ids.begin(), param_ids.end());
+    ids = std::move(param_ids);
+    values = std::vector<std::atomic<float>>(ids.size());
+    dirty = std::vector<std::atomic<uint64_t>>((ids.size() + 63) / 64);
+  }
+
+  // {Audio thread} Returns false for unknown parameter ids.
+  bool mark(uint32_t id, float value) {
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it == ids.end() || *it != id) {
+      return false;
+    }
+
+    size_t slot = it - ids.begin();
+    values[slot].store(value, std::memory_order_relaxed);
+    dirty[slot / 64].fetch_or(uint64_t(1) << (slot % 64),
+                              std::memory_order_release);
+    return true;
+  }
+
+  // {UI thread} Calls `apply(id, value)` for every parameter marked since the
+  // last flush and clears it.
+  template <typename F> void flush(F &&apply) {
+    for (size_t word = 0; word < dirty.size(); word++) {
+      uint64_t bits = dirty[word].exchange(0, std::memory_order_acquire);
+      while (bits) {
+        size_t bit = count_trailing_zeros(bits);
+        bits &= bits - 1;
+
+        size_t slot = word * 64 + bit;
+        apply(ids[slot], values[slot].load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+  size_t allocated_bytes() const {
+    return ids.capacity() * sizeof(uint32_t) +
+           values.capacity() * sizeof(std::atomic<float>) +
+           dirty.capacity() * sizeof(std::atomic<uint64_t>);
+  }
+
+private:
+  static size_t count_trailing_zeros(uint64_t bits) {
+    size_t count = 0;
+    while (!(bits & 1)) {
+      bits >>= 1;
+      count++;
+    }
+    return count;
+  }
+
+  // Sorted parameter ids. A parameter's slot in `values` and `dirty` is its
+  // position in this list.
+  std::vector<uint32_t> ids;
+  std::vector<std::atomic<float>> values;
+  std::vector<std::atomic<uint64_t>> dirty;
+};
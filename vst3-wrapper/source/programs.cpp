@@ -0,0 +1,100 @@
+#include "programs.h"
+
+#include <unordered_map>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+
+namespace {
+
+struct ProgramParameter {
+  ParamID id;
+  int32 step_count;
+};
+
+std::string program_name(const String128 name) {
+  std::string result = {};
+  for (int i = 0; i < 128 && name[i] != '\0'; i++) {
+    result += (char)name[i];
+  }
+  return result;
+}
+
+} // namespace
+
+const std::vector<ProgramEntry> &
+ProgramCache::programs(IEditController *controller) {
+  if (!loaded) {
+    load(controller);
+    loaded = true;
+  }
+  return entries;
+}
+
+void ProgramCache::invalidate() {
+  entries.clear();
+  loaded = false;
+}
+
+void ProgramCache::load(IEditController *controller) {
+  entries.clear();
+  if (!controller) {
+    return;
+  }
+
+  FUnknownPtr<IUnitInfo> units(controller);
+  if (!units) {
+    return;
+  }
+
+  std::unordered_map<UnitID, ProgramParameter> unit_params;
+  int32 param_count = controller->getParameterCount();
+  for (int32 i = 0; i < param_count; i++) {
+    ParameterInfo info = {};
+    if (controller->getParameterInfo(i, info) == kResultOk &&
+        (info.flags & ParameterInfo::kIsProgramChange)) {
+      unit_params[info.unitId] = {info.id, info.stepCount};
+    }
+  }
+
+  std::unordered_map<ProgramListID, UnitID> list_units;
+  int32 unit_count = units->getUnitCount();
+  for (int32 i = 0; i < unit_count; i++) {
+    UnitInfo info = {};
+    if (units->getUnitInfo(i, info) == kResultOk &&
+        info.programListId != kNoProgramListId) {
+      list_units[info.programListId] = info.id;
+    }
+  }
+
+  int32 list_count = units->getProgramListCount();
+  for (int32 i = 0; i < list_count; i++) {
+    ProgramListInfo list = {};
+    if (units->getProgramListInfo(i, list) != kResultOk) {
+      continue;
+    }
+
+    ProgramParameter param = {kNoParamId, 0};
+    auto unit = list_units.find(list.id);
+    if (unit != list_units.end()) {
+      auto found = unit_params.find(unit->second);
+      if (found != unit_params.end()) {
+        param = found->second;
+      }
+    }
+
+    entries.reserve(entries.size() + list.programCount);
+    for (int32 program = 0; program < list.programCount; program++) {
+      String128 name = {};
+      units->getProgramName(list.id, program, name);
+
+      ProgramEntry entry = {};
+      entry.name = program_name(name);
+      entry.param = param.id;
+      entry.value = param.step_count > 0
+                        ? (ParamValue)program / (ParamValue)param.step_count
+                        : 0.0;
+      entries.push_back(std::move(entry));
+    }
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <pluginterfaces/vst/ivsteditcontroller.h>
+#include <pluginterfaces/vst/ivstunits.h>
+
+// A program of one of the plugin's program lists.
+struct ProgramEntry {
+  std::string name;
+  // Program-change parameter of the unit using the list, or `kNoParamId` if
+  // it has none, and the normalized value selecting this program.
+  Steinberg::Vst::ParamID param;
+  Steinberg::Vst::ParamValue value;
+};
+
+// Every program of every program list, read through `IUnitInfo` on first use
+// and flattened into one indexed list. Lookups never call into the plugin
+// after that.
+class ProgramCache {
+public:
+  // {UI thread}
+  const std::vector<ProgramEntry> &
+  programs(Steinberg::Vst::IEditController *controller);
+  // {UI thread} Re-reads the lists on next use.
+  void invalidate();
+
+private:
+  void load(Steinberg::Vst::IEditController *controller);
+
+  std::vector<ProgramEntry> entries;
+  bool loaded = false;
+};
@@ -0,0 +1,159 @@
+#include "runloop.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <thread>
+#else
+#include <poll.h>
+#endif
+
+using namespace Steinberg;
+using namespace Steinberg::Linux;
+
+tresult PLUGIN_API RunLoop::registerEventHandler(IEventHandler *handler,
+                                                 FileDescriptor fd) {
+#ifdef _WIN32
+  return kNotImplemented;
+#else
+  if (!handler || fd < 0) {
+    return kInvalidArgument;
+  }
+  std::lock_guard<std::mutex> guard(mutex);
+  event_handlers.push_back({IPtr<IEventHandler>(handler), fd});
+  return kResultTrue;
+#endif
+}
+
+tresult PLUGIN_API RunLoop::unregisterEventHandler(IEventHandler *handler) {
+  std::lock_guard<std::mutex> guard(mutex);
+  auto removed = std::remove_if(
+      event_handlers.begin(), event_handlers.end(),
+      [&](const EventHandler &entry) { return entry.handler.get() == handler; });
+  if (removed == event_handlers.end()) {
+    return kInvalidArgument;
+  }
+  event_handlers.erase(removed, event_handlers.end());
+  return kResultTrue;
+}
+
+tresult PLUGIN_API RunLoop::registerTimer(ITimerHandler *handler,
+                                          TimerInterval milliseconds) {
+  if (!handler) {
+    return kInvalidArgument;
+  }
+  Clock::duration interval = std::chrono::milliseconds(
+      std::max<TimerInterval>(milliseconds, 1));
+
+  std::lock_guard<std::mutex> guard(mutex);
+  timers.push_back(
+      {IPtr<ITimerHandler>(handler), interval, Clock::now() + interval});
+  return kResultTrue;
+}
+
+tresult PLUGIN_API RunLoop::unregisterTimer(ITimerHandler *handler) {
+  std::lock_guard<std::mutex> guard(mutex);
+  auto removed =
+      std::remove_if(timers.begin(), timers.end(), [&](const Timer &timer) {
+        return timer.handler.get() == handler;
+      });
+  if (removed == timers.end()) {
+    return kInvalidArgument;
+  }
+  timers.erase(removed, timers.end());
+  return kResultTrue;
+}
+
+void RunLoop::dispatch(uint32_t timeout_ms) {
+  Clock::time_point wake = Clock::now() + std::chrono::milliseconds(timeout_ms);
+  std::vector<EventHandler> handlers;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    handlers = event_handlers;
+    for (const Timer &timer : timers) {
+      wake = std::min(wake, timer.due);
+    }
+  }
+
+  // Rounded up so a timer isn't polled for just before it falls due
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+      wake - Clock::now() + std::chrono::microseconds(999));
+  int wait_ms = (int)std::max<int64_t>(wait.count(), 0);
+
+#ifdef _WIN32
+  std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+#else
+  std::vector<pollfd> fds(handlers.size());
+  for (size_t i = 0; i < handlers.size(); i++) {
+    fds[i] = {handlers[i].fd, POLLIN, 0};
+  }
+
+  if (poll(fds.data(), fds.size(), wait_ms) > 0) {
+    for (size_t i = 0; i < handlers.size(); i++) {
+      short ready = fds[i].revents;
+      if (ready == 0 || (ready & POLLNVAL)) {
+        continue;
+      }
+      if (event_handler_registered(handlers[i].handler.get(), fds[i].fd)) {
+        handlers[i].handler->onFDIsSet(fds[i].fd);
+      }
+    }
+  }
+#endif
+
+  std::vector<IPtr<ITimerHandler>> due;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    Clock::time_point now = Clock::now();
+    for (Timer &timer : timers) {
+      if (timer.due > now) {
+        continue;
+      }
+      due.push_back(timer.handler);
+      // Missed ticks are dropped rather than fired back to back
+      timer.due = std::max(timer.due + timer.interval, now);
+    }
+  }
+
+  for (const IPtr<ITimerHandler> &handler : due) {
+    if (timer_registered(handler.get())) {
+      handler->onTimer();
+    }
+  }
+}
+
+bool RunLoop::event_handler_registered(IEventHandler *handler,
+                                       FileDescriptor fd) {
+  std::lock_guard<std::mutex> guard(mutex);
+  for (const EventHandler &entry : event_handlers) {
+    if (entry.handler.get() == handler && entry.fd == fd) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RunLoop::timer_registered(ITimerHandler *handler) {
+  std::lock_guard<std::mutex> guard(mutex);
+  for (const Timer &timer : timers) {
+    if (timer.handler.get() == handler) {
+      return true;
+    }
+  }
+  return false;
+}
+
+tresult PLUGIN_API RunLoop::queryInterface(const TUID _iid, void **obj) {
+  if (FUnknownPrivate::iidEqual(_iid, IRunLoop::iid) ||
+      FUnknownPrivate::iidEqual(_iid, FUnknown::iid)) {
+    *obj = static_cast<IRunLoop *>(this);
+    return kResultOk;
+  }
+  *obj = nullptr;
+  return kNoInterface;
+}
+
+RunLoop &run_loop() {
+  static RunLoop loop;
+  return loop;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <pluginterfaces/gui/iplugview.h>
+
+// The host side of the Linux run loop. Plugins without a display of their own
+// register file descriptors and timers here instead of spinning up an X11 event
+// loop, and the host pumps them with `run_loop_dispatch`. One loop is shared by
+// every instance; it's handed out by the host context and the editor frame.
+class RunLoop : public Steinberg::Linux::IRunLoop {
+public:
+  // {Any thread}
+  Steinberg::tresult PLUGIN_API
+  registerEventHandler(Steinberg::Linux::IEventHandler *handler,
+                       Steinberg::Linux::FileDescriptor fd) override;
+  Steinberg::tresult PLUGIN_API
+  unregisterEventHandler(Steinberg::Linux::IEventHandler *handler) override;
+  Steinberg::tresult PLUGIN_API
+  registerTimer(Steinberg::Linux::ITimerHandler *handler,
+                Steinberg::Linux::TimerInterval milliseconds) override;
+  Steinberg::tresult PLUGIN_API
+  unregisterTimer(Steinberg::Linux::ITimerHandler *handler) override;
+
+  // {UI thread} Waits up to `timeout_ms` for a registered descriptor to become
+  // ready or a timer to fall due, then calls every ready handler once.
+  void dispatch(uint32_t timeout_ms);
+
+  Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID _iid,
+                                               void **obj) override;
+  // Lives as long as the process, so plug-in references are not counted
+  Steinberg::uint32 PLUGIN_API addRef() override { return 1000; }
+  Steinberg::uint32 PLUGIN_API release() override { return 1000; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct EventHandler {
+    Steinberg::IPtr<Steinberg::Linux::IEventHandler> handler;
+    Steinberg::Linux::FileDescriptor fd;
+  };
+
+  struct Timer {
+    Steinberg::IPtr<Steinberg::Linux::ITimerHandler> handler;
+    Clock::duration interval;
+    Clock::time_point due;
+  };
+
+  bool event_handler_registered(Steinberg::Linux::IEventHandler *handler,
+                                Steinberg::Linux::FileDescriptor fd);
+  bool timer_registered(Steinberg::Linux::ITimerHandler *handler);
+
+  // Handlers may (un)register from their callbacks and from other threads, so
+  // `dispatch` works on copies and rechecks before each call.
+  std::mutex mutex;
+  std::vector<EventHandler> event_handlers;
+  std::vector<Timer> timers;
+};
+
+RunLoop &run_loop();
@@ -0,0 +1,682 @@
+#include "sandbox.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include "vst3wrapper.h"
+
+static std::atomic<uint32_t> sandbox_counter{0};
+
+static std::string sandbox_object_name(const std::string &name) {
+#ifdef _WIN32
+  return "Local\\" + name;
+#else
+  return "/" + name;
+#endif
+}
+
+static bool init_events(SandboxShared *shared, const std::string &name,
+                        bool create, IpcEvent &control_request,
+                        IpcEvent &control_response, IpcEvent &audio_request,
+                        IpcEvent &audio_response) {
+  return control_request.init(&shared->control.request,
+                              name + "-control-request", create) &&
+         control_response.init(&shared->control.response,
+                               name + "-control-response", create) &&
+         audio_request.init(&shared->audio_channel.request,
+                            name + "-audio-request", create) &&
+         audio_response.init(&shared->audio_channel.response,
+                             name + "-audio-response", create);
+}
+
+// Strings are passed through the payload as consecutive NUL terminated runs
+// after any fixed size data.
+static size_t write_string(uint8_t *payload, size_t offset, const char *str) {
+  size_t len = str ? strlen(str) : 0;
+  if (offset + len + 1 > SANDBOX_PAYLOAD_SIZE) {
+    len = offset < SANDBOX_PAYLOAD_SIZE ? SANDBOX_PAYLOAD_SIZE - offset - 1 : 0;
+  }
+  if (len > 0) {
+    memcpy(payload + offset, str, len);
+  }
+  payload[offset + len] = '\0';
+  return offset + len + 1;
+}
+
+static const char *read_string(const uint8_t *payload, size_t &offset) {
+  const char *str = (const char *)payload + offset;
+  offset += strlen(str) + 1;
+  return alloc_string(str);
+}
+
+SandboxClient::~SandboxClient() {
+  if (shared && !failed.load()) {
+    std::lock_guard<std::mutex> lock(control_mutex);
+    call(shared->control, control_request, control_response, SandboxCall::Quit,
+         SANDBOX_POLL_MS * 10);
+  }
+
+  std::lock_guard<std::mutex> lock(worker_mutex);
+  worker.kill();
+}
+
+bool SandboxClient::start(const std::string &worker_path,
+                          const std::string &plugin_path,
+                          PluginInstance *_instance) {
+  instance = _instance;
+
+  std::string name = "vst3sandbox-" + std::to_string(current_process_id()) +
+                     "-" + std::to_string(sandbox_counter++);
+  std::string object_name = sandbox_object_name(name);
+
+  if (!memory.create(object_name, sizeof(SandboxShared))) {
+    fail("Failed to create sandbox shared memory");
+    return false;
+  }
+
+  // The mapping is zero filled, so only members with constructors need
+  // initialising. Value initialisation would touch every page.
+  shared = new (memory.data()) SandboxShared;
+
+  if (!init_events(shared, object_name, true, control_request,
+                   control_response, audio_request, audio_response)) {
+    fail("Failed to create sandbox events");
+    return false;
+  }
+
+  if (!worker.spawn(worker_path, name, std::to_string(current_process_id()))) {
+    fail("Failed to start sandbox worker");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(control_mutex);
+  write_string(shared->payload, 0, plugin_path.c_str());
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::Load, SANDBOX_CONTROL_TIMEOUT_MS) ||
+      shared->control.result == 0) {
+    fail("Sandbox worker failed to load the plugin");
+    return false;
+  }
+
+  memcpy(&_io_config, shared->payload, sizeof(_io_config));
+  return true;
+}
+
+bool SandboxClient::call(SandboxChannel &channel, IpcEvent &request,
+                         IpcEvent &response, SandboxCall call,
+                         uint32_t timeout_ms) {
+  if (failed.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  channel.call = call;
+  uint32_t seen = response.value();
+  request.notify();
+
+  uint32_t waited = 0;
+  while (!response.wait(seen, SANDBOX_POLL_MS)) {
+    waited += SANDBOX_POLL_MS;
+
+    bool running = false;
+    {
+      std::lock_guard<std::mutex> lock(worker_mutex);
+      running = worker.running();
+    }
+
+    if (!running) {
+      fail("Sandbox worker exited");
+      return false;
+    }
+    if (waited >= timeout_ms) {
+      fail("Sandbox worker stopped responding");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void SandboxClient::fail(const char *reason) {
+  if (failed.exchange(true)) {
+    return;
+  }
+
+  wrapper_log(instance, LogLevel::Error, "%s", reason);
+
+  std::lock_guard<std::mutex> lock(worker_mutex);
+  worker.kill();
+}
+
+FFIPluginDescriptor SandboxClient::descriptor() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  FFIPluginDescriptor desc = {};
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::Descriptor, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return desc;
+  }
+
+  size_t offset = 0;
+  desc.name = read_string(shared->payload, offset);
+  desc.vendor = read_string(shared->payload, offset);
+  desc.version = read_string(shared->payload, offset);
+  desc.id = read_string(shared->payload, offset);
+  desc.initial_latency = (int)shared->control.result;
+  return desc;
+}
+
+IOConfigutaion SandboxClient::io_config() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  if (call(shared->control, control_request, control_response,
+           SandboxCall::IoConfig, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    memcpy(&_io_config, shared->payload, sizeof(_io_config));
+  }
+  return _io_config;
+}
+
+uintptr_t SandboxClient::parameter_count() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::ParameterCount, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return 0;
+  }
+  return (uintptr_t)shared->control.result;
+}
+
+bool SandboxClient::prefetchable() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::Prefetchable, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return false;
+  }
+  return shared->control.result != 0;
+}
+
+uintptr_t SandboxClient::program_count() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::ProgramCount, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return 0;
+  }
+  return (uintptr_t)shared->control.result;
+}
+
+const char *SandboxClient::program_name(uintptr_t index) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  shared->control.arg = (int64_t)index;
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::ProgramName, SANDBOX_CONTROL_TIMEOUT_MS) ||
+      shared->control.result == 0) {
+    return nullptr;
+  }
+
+  size_t offset = 0;
+  return read_string(shared->payload, offset);
+}
+
+bool SandboxClient::set_program(uintptr_t index) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  shared->control.arg = (int64_t)index;
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::SetProgram, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return false;
+  }
+  return shared->control.result != 0;
+}
+
+ParameterFFI SandboxClient::get_parameter(int32_t index) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  ParameterFFI param = {};
+  shared->control.arg = index;
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::GetParameter, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return param;
+  }
+
+  memcpy(&param, shared->payload, sizeof(param));
+  size_t offset = sizeof(param);
+  param.name = read_string(shared->payload, offset);
+  param.formatted_value = read_string(shared->payload, offset);
+  return param;
+}
+
+uintptr_t SandboxClient::get_latency() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::GetLatency, SANDBOX_CONTROL_TIMEOUT_MS)) {
+    return 0;
+  }
+  return (uintptr_t)shared->control.result;
+}
+
+const void *SandboxClient::get_data(int32_t *data_len, const void **stream) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  Steinberg::ResizableMemoryIBStream *stream_ =
+      new Steinberg::ResizableMemoryIBStream();
+  *stream = stream_;
+
+  if (!call(shared->control, control_request, control_response,
+            SandboxCall::GetData, SANDBOX_CONTROL_TIMEOUT_MS) ||
+      shared->control.result == 0) {
+    return nullptr;
+  }
+
+  Steinberg::int32 num_bytes_written = 0;
+  stream_->write(shared->payload, (Steinberg::int32)shared->control.payload_size,
+                 &num_bytes_written);
+  *data_len = num_bytes_written;
+  return stream_->getData();
+}
+
+void SandboxClient::set_data(const void *data, int32_t data_len) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  if ((size_t)data_len > SANDBOX_PAYLOAD_SIZE) {
+    wrapper_log(instance, LogLevel::Error,
+                "Plugin state is too large for the sandbox");
+    return;
+  }
+
+  memcpy(shared->payload, data, data_len);
+  shared->control.payload_size = data_len;
+  call(shared->control, control_request, control_response,
+       SandboxCall::SetData, SANDBOX_CONTROL_TIMEOUT_MS);
+}
+
+void SandboxClient::set_processing(bool processing) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  shared->control.arg = processing;
+  call(shared->control, control_request, control_response,
+       SandboxCall::SetProcessing, SANDBOX_CONTROL_TIMEOUT_MS);
+}
+
+void SandboxClient::set_sample_rate(int32_t rate) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  shared->control.arg = rate;
+  call(shared->control, control_request, control_response,
+       SandboxCall::SetSampleRate, SANDBOX_CONTROL_TIMEOUT_MS);
+}
+
+void SandboxClient::set_auto_sleep(bool enabled) {
+  std::lock_guard<std::mutex> lock(control_mutex);
+
+  shared->control.arg = enabled;
+  call(shared->control, control_request, control_response,
+       SandboxCall::SetAutoSleep, SANDBOX_CONTROL_TIMEOUT_MS);
+}
+
+void SandboxClient::apply_restart() {
+  std::lock_guard<std::mutex> lock(control_mutex);
+  call(shared->control, control_request, control_response,
+       SandboxCall::ApplyRestart, SANDBOX_CONTROL_TIMEOUT_MS);
+}
+
+void SandboxClient::flush_param_updates(
+    const void *plugin_sent_events_producer) {
+  {
+    std::lock_guard<std::mutex> lock(control_mutex);
+    call(shared->control, control_request, control_response,
+         SandboxCall::FlushParamUpdates, SANDBOX_CONTROL_TIMEOUT_MS);
+  }
+
+  LogRecordFFI record = {};
+  while (shared->log.pop(record)) {
+    forward_log_record(instance, record);
+  }
+
+  PluginIssuedEvent event = {};
+  while (shared->plugin_events.pop(event)) {
+    send_event_to_host(&event, plugin_sent_events_producer);
+  }
+}
+
+void SandboxClient::silence_outputs(const ProcessDetails *data,
+                                    float ***output) {
+  for (size_t bus = 0; bus < _io_config.audio_outputs.count; bus++) {
+    size_t channels = _io_config.audio_outputs.data[bus].value.channels;
+    for (size_t channel = 0; channel < channels; channel++) {
+      memset(output[bus][channel], 0, data->block_size * sizeof(float));
+    }
+  }
+}
+
+void SandboxClient::process(const ProcessDetails *data, float ***input,
+                            float ***output, HostIssuedEvent *events,
+                            int32_t events_len) {
+  if (failed.load(std::memory_order_relaxed) ||
+      data->block_size > SANDBOX_MAX_BLOCK_SIZE) {
+    silence_outputs(data, output);
+    return;
+  }
+
+  size_t block_bytes = data->block_size * sizeof(float);
+
+  shared->details = *data;
+  shared->events_len = std::min(events_len, (int32_t)SANDBOX_MAX_EVENTS);
+  if (events_len > shared->events_len) {
+    wrapper_log(instance, LogLevel::Warning,
+                "Dropped %d events over the sandbox's capacity of %u",
+                events_len - shared->events_len, SANDBOX_MAX_EVENTS);
+  }
+  memcpy(shared->events, events, shared->events_len * sizeof(HostIssuedEvent));
+
+  // Hosts rendering straight into the shared buffers skip the copies
+  size_t index = 0;
+  for (size_t bus = 0; bus < _io_config.audio_inputs.count; bus++) {
+    size_t channels = _io_config.audio_inputs.data[bus].value.channels;
+    for (size_t channel = 0; channel < channels; channel++, index++) {
+      if (index < SANDBOX_MAX_CHANNELS &&
+          input[bus][channel] != shared->audio[index]) {
+        memcpy(shared->audio[index], input[bus][channel], block_bytes);
+      }
+    }
+  }
+
+  if (!call(shared->audio_channel, audio_request, audio_response,
+            SandboxCall::Process, SANDBOX_AUDIO_TIMEOUT_MS)) {
+    silence_outputs(data, output);
+    return;
+  }
+
+  index = 0;
+  for (size_t bus = 0; bus < _io_config.audio_outputs.count; bus++) {
+    size_t channels = _io_config.audio_outputs.data[bus].value.channels;
+    for (size_t channel = 0; channel < channels; channel++, index++) {
+      float *shared_channel = shared->audio[SANDBOX_MAX_CHANNELS + index];
+      if (index >= SANDBOX_MAX_CHANNELS) {
+        memset(output[bus][channel], 0, block_bytes);
+      } else if (output[bus][channel] != shared_channel) {
+        memcpy(output[bus][channel], shared_channel, block_bytes);
+      }
+    }
+  }
+}
+
+uint64_t SandboxClient::output_silence_flags(uintptr_t bus) {
+  if (bus >= SANDBOX_MAX_BUSES) {
+    return 0;
+  }
+  return shared->output_silence_flags[bus];
+}
+
+bool SandboxClient::queue_event(const HostIssuedEvent &event,
+                                EventTime time) {
+  return shared->queued_events.push_with([&](QueuedEvent &queued) {
+    queued.event = event;
+    queued.time = time;
+  });
+}
+
+uint64_t SandboxClient::sample_position() {
+  return shared->sample_position.load(std::memory_order_relaxed);
+}
+
+float *SandboxClient::channel_buffer(bool output, uintptr_t channel) {
+  if (channel >= SANDBOX_MAX_CHANNELS) {
+    return nullptr;
+  }
+  return shared->audio[(output ? SANDBOX_MAX_CHANNELS : 0) + channel];
+}
+
+// Worker
+
+static SandboxShared *worker_shared = nullptr;
+
+void sandbox_worker_send_event(const PluginIssuedEvent *event) {
+  if (worker_shared) {
+    worker_shared->plugin_events.push(*event);
+  }
+}
+
+static void forward_worker_log(SandboxShared *shared) {
+  const uintptr_t batch = 16;
+  LogRecordFFI records[batch];
+  for (;;) {
+    uintptr_t count = drain_log(records, batch);
+    for (uintptr_t i = 0; i < count; i++) {
+      shared->log.push(records[i]);
+    }
+    if (count < batch) {
+      break;
+    }
+  }
+}
+
+static void serve_audio(SandboxShared *shared, PluginInstance *vst,
+                        IpcEvent &request, IpcEvent &response,
+                        uint64_t host_pid, std::atomic<bool> &quitting) {
+  set_realtime_priority();
+
+  float *channels[2 * SANDBOX_MAX_CHANNELS] = {};
+  for (uint32_t i = 0; i < 2 * SANDBOX_MAX_CHANNELS; i++) {
+    channels[i] = shared->audio[i];
+  }
+
+  float **inputs[SANDBOX_MAX_BUSES] = {};
+  float **outputs[SANDBOX_MAX_BUSES] = {};
+
+  while (!quitting.load()) {
+    // Calls alternate request, response, so a request is pending whenever the
+    // two counters differ. This also catches one sent before the worker
+    // started waiting.
+    if (!request.wait(response.value(), SANDBOX_POLL_MS)) {
+      if (!process_alive(host_pid)) {
+        return;
+      }
+      continue;
+    }
+
+    QueuedEvent queued = {};
+    while (shared->queued_events.pop(queued)) {
+      vst->event_scheduler.push(queued.event, queued.time);
+    }
+
+    // Bind every bus to its run of shared channels. Channels past the shared
+    // capacity all alias the last one.
+    const IOConfigutaion &io = vst->_io_config;
+    size_t index = 0;
+    for (size_t bus = 0; bus < io.audio_inputs.count && bus < SANDBOX_MAX_BUSES;
+         bus++) {
+      inputs[bus] = &channels[std::min<size_t>(index, SANDBOX_MAX_CHANNELS - 1)];
+      index += io.audio_inputs.data[bus].value.channels;
+    }
+    index = 0;
+    for (size_t bus = 0;
+         bus < io.audio_outputs.count && bus < SANDBOX_MAX_BUSES; bus++) {
+      outputs[bus] = &channels[SANDBOX_MAX_CHANNELS +
+                               std::min<size_t>(index, SANDBOX_MAX_CHANNELS - 1)];
+      index += io.audio_outputs.data[bus].value.channels;
+    }
+
+    if (!process(vst, &shared->details, inputs, outputs, shared->events,
+                 shared->events_len)) {
+      for (uint32_t i = 0; i < SANDBOX_MAX_CHANNELS; i++) {
+        memset(shared->audio[SANDBOX_MAX_CHANNELS + i], 0,
+               shared->details.block_size * sizeof(float));
+      }
+    }
+
+    for (size_t bus = 0; bus < SANDBOX_MAX_BUSES; bus++) {
+      shared->output_silence_flags[bus] = output_silence_flags(vst, bus);
+    }
+    shared->sample_position.store(vst->samples_processed.load(),
+                                  std::memory_order_relaxed);
+
+    response.notify();
+  }
+}
+
+int run_sandbox_worker(const char *name, uint64_t host_pid) {
+  std::string object_name = sandbox_object_name(name);
+
+  SharedMemory memory;
+  if (!memory.open(object_name, sizeof(SandboxShared))) {
+    return 1;
+  }
+
+  SandboxShared *shared = (SandboxShared *)memory.data();
+  worker_shared = shared;
+
+  IpcEvent control_request, control_response, audio_request, audio_response;
+  if (!init_events(shared, object_name, false, control_request,
+                   control_response, audio_request, audio_response)) {
+    return 1;
+  }
+
+  PluginInstance *vst = nullptr;
+  std::atomic<bool> quitting{false};
+  std::thread audio_thread;
+
+  SandboxChannel &channel = shared->control;
+  while (!quitting.load()) {
+    if (!control_request.wait(control_response.value(), SANDBOX_POLL_MS)) {
+      // The control thread is the plugin's UI thread
+      run_loop().dispatch(0);
+      forward_worker_log(shared);
+      if (!process_alive(host_pid)) {
+        quitting = true;
+      }
+      continue;
+    }
+
+    channel.result = 0;
+    switch (channel.call) {
+    case SandboxCall::Load: {
+      if (vst) {
+        break;
+      }
+      vst = (PluginInstance *)load_plugin((const char *)shared->payload,
+                                          nullptr);
+      if (!vst) {
+        break;
+      }
+      // Control calls arrive on this thread while the audio thread processes
+      set_queued_control(vst, true);
+      IOConfigutaion io = vst->get_io_config();
+      memcpy(shared->payload, &io, sizeof(io));
+      channel.result = 1;
+      audio_thread = std::thread(serve_audio, shared, vst,
+                                 std::ref(audio_request),
+                                 std::ref(audio_response), host_pid,
+                                 std::ref(quitting));
+      break;
+    }
+    case SandboxCall::Descriptor: {
+      FFIPluginDescriptor desc = descriptor(vst);
+      size_t offset = 0;
+      offset = write_string(shared->payload, offset, desc.name);
+      offset = write_string(shared->payload, offset, desc.vendor);
+      offset = write_string(shared->payload, offset, desc.version);
+      offset = write_string(shared->payload, offset, desc.id);
+      channel.result = desc.initial_latency;
+      free_string(desc.name);
+      free_string(desc.vendor);
+      free_string(desc.version);
+      free_string(desc.id);
+      break;
+    }
+    case SandboxCall::IoConfig: {
+      IOConfigutaion io = io_config(vst);
+      memcpy(shared->payload, &io, sizeof(io));
+      break;
+    }
+    case SandboxCall::ParameterCount:
+      channel.result = (int64_t)parameter_count(vst);
+      break;
+    case SandboxCall::GetParameter: {
+      ParameterFFI param = get_parameter(vst, (int32_t)channel.arg);
+      const char *param_name = param.name;
+      const char *formatted_value = param.formatted_value;
+      param.name = nullptr;
+      param.formatted_value = nullptr;
+      memcpy(shared->payload, &param, sizeof(param));
+      size_t offset = sizeof(param);
+      offset = write_string(shared->payload, offset, param_name);
+      offset = write_string(shared->payload, offset, formatted_value);
+      free_string(param_name);
+      free_string(formatted_value);
+      break;
+    }
+    case SandboxCall::GetLatency:
+      channel.result = (int64_t)get_latency(vst);
+      break;
+    case SandboxCall::Prefetchable:
+      channel.result = prefetchable(vst) ? 1 : 0;
+      break;
+    case SandboxCall::ProgramCount:
+      channel.result = (int64_t)program_count(vst);
+      break;
+    case SandboxCall::ProgramName: {
+      const char *name = program_name(vst, (uintptr_t)channel.arg);
+      if (name) {
+        write_string(shared->payload, 0, name);
+        free_string(name);
+        channel.result = 1;
+      }
+      break;
+    }
+    case SandboxCall::SetProgram:
+      channel.result = set_program(vst, (uintptr_t)channel.arg) ? 1 : 0;
+      break;
+    case SandboxCall::GetData: {
+      int32_t data_len = 0;
+      const void *stream = nullptr;
+      const void *data = get_data(vst, &data_len, &stream);
+      if (data && (size_t)data_len <= SANDBOX_PAYLOAD_SIZE) {
+        memcpy(shared->payload, data, data_len);
+        channel.payload_size = data_len;
+        channel.result = 1;
+      }
+      free_data_stream(stream);
+      break;
+    }
+    case SandboxCall::SetData:
+      set_data(vst, shared->payload, (int32_t)channel.payload_size);
+      break;
+    case SandboxCall::SetProcessing:
+      set_processing(vst, channel.arg != 0);
+      break;
+    case SandboxCall::SetSampleRate:
+      vst3_set_sample_rate(vst, (int32_t)channel.arg);
+      break;
+    case SandboxCall::SetAutoSleep:
+      set_auto_sleep(vst, channel.arg != 0);
+      break;
+    case SandboxCall::FlushParamUpdates:
+      flush_param_updates(vst);
+      break;
+    case SandboxCall::ApplyRestart:
+      apply_restart(vst);
+      break;
+    case SandboxCall::Process:
+      break;
+    case SandboxCall::Quit:
+      quitting = true;
+      break;
+    }
+
+    forward_worker_log(shared);
+    control_response.notify();
+  }
+
+  if (audio_thread.joinable()) {
+    audio_thread.join();
+  }
+  delete vst;
+
+  worker_shared = nullptr;
+  return 0;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "bindings.h"
+#include "boundedqueue.h"
+#include "eventscheduler.h"
+#include "ipc.h"
+
+class PluginInstance;
+
+constexpr uint32_t SANDBOX_MAX_BUSES = 16;
+constexpr uint32_t SANDBOX_MAX_CHANNELS = 64;
+constexpr uint32_t SANDBOX_MAX_BLOCK_SIZE = 8192;
+constexpr uint32_t SANDBOX_MAX_EVENTS = 1024;
+constexpr size_t SANDBOX_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+constexpr uint32_t SANDBOX_CONTROL_TIMEOUT_MS = 30000;
+constexpr uint32_t SANDBOX_AUDIO_TIMEOUT_MS = 2000;
+// How often blocked waits check that the other process is still alive.
+constexpr uint32_t SANDBOX_POLL_MS = 50;
+
+enum class SandboxCall : uint32_t {
+  Load,
+  Descriptor,
+  IoConfig,
+  ParameterCount,
+  GetParameter,
+  GetLatency,
+  Prefetchable,
+  ProgramCount,
+  ProgramName,
+  SetProgram,
+  GetData,
+  SetData,
+  SetProcessing,
+  SetSampleRate,
+  SetAutoSleep,
+  FlushParamUpdates,
+  ApplyRestart,
+  Process,
+  Quit,
+};
+
+// One request/response pair. Only one call is in flight per channel: the
+// caller fills in the call, bumps `request` and waits for `response`.
+struct SandboxChannel {
+  std::atomic<uint32_t> request;
+  std::atomic<uint32_t> response;
+  SandboxCall call;
+  int64_t arg;
+  int64_t result;
+  uint64_t payload_size;
+};
+
+// Layout of the shared mapping. Control calls and processing use separate
+// channels so a slow state load never blocks the audio thread behind it.
+// Audio is processed in place: the worker binds the plugin directly to
+// `audio`, so a host that renders into `sandbox_channel_buffer` never copies.
+struct SandboxShared {
+  SandboxChannel control;
+  SandboxChannel audio_channel;
+
+  std::atomic<uint64_t> sample_position;
+
+  ProcessDetails details;
+  int32_t events_len;
+  HostIssuedEvent events[SANDBOX_MAX_EVENTS];
+
+  uint64_t output_silence_flags[SANDBOX_MAX_BUSES];
+
+  BoundedQueue<QueuedEvent, EVENT_QUEUE_CAPACITY> queued_events;
+  BoundedQueue<PluginIssuedEvent, 256> plugin_events;
+  BoundedQueue<LogRecordFFI, 256> log;
+
+  // Inputs, then outputs, each channel SANDBOX_MAX_BLOCK_SIZE samples
+  alignas(64) float audio[2 * SANDBOX_MAX_CHANNELS][SANDBOX_MAX_BLOCK_SIZE];
+  alignas(64) uint8_t payload[SANDBOX_PAYLOAD_SIZE];
+};
+
+// Host side of a sandboxed plugin. Owns the worker process and the shared
+// mapping. Once the worker dies or stops answering every call fails softly:
+// processing outputs silence and queries return empty results.
+class SandboxClient {
+public:
+  SandboxClient() = default;
+  ~SandboxClient();
+
+  bool start(const std::string &worker_path, const std::string &plugin_path,
+             PluginInstance *instance);
+
+  FFIPluginDescriptor descriptor();
+  IOConfigutaion io_config();
+  uintptr_t parameter_count();
+  ParameterFFI get_parameter(int32_t index);
+  uintptr_t get_latency();
+  bool prefetchable();
+  uintptr_t program_count();
+  const char *program_name(uintptr_t index);
+  bool set_program(uintptr_t index);
+  // Returns a `ResizableMemoryIBStream` like the in-process `get_data`.
+  const void *get_data(int32_t *data_len, const void **stream);
+  void set_data(const void *data, int32_t data_len);
+  void set_processing(bool processing);
+  void set_sample_rate(int32_t rate);
+  void set_auto_sleep(bool enabled);
+  // Also forwards the worker's log records and plugin issued events.
+  void flush_param_updates(const void *plugin_sent_events_producer);
+  void apply_restart();
+
+  void process(const ProcessDetails *data, float ***input, float ***output,
+               HostIssuedEvent *events, int32_t events_len);
+  uint64_t output_silence_flags(uintptr_t bus);
+  bool queue_event(const HostIssuedEvent &event, EventTime time);
+  uint64_t sample_position();
+  float *channel_buffer(bool output, uintptr_t channel);
+
+private:
+  bool call(SandboxChannel &channel, IpcEvent &request, IpcEvent &response,
+            SandboxCall call, uint32_t timeout_ms);
+  void fail(const char *reason);
+  void silence_outputs(const ProcessDetails *data, float ***output);
+
+  PluginInstance *instance = nullptr;
+  SharedMemory memory;
+  SandboxShared *shared = nullptr;
+  ChildProcess worker;
+  IpcEvent control_request, control_response;
+  IpcEvent audio_request, audio_response;
+  std::mutex control_mutex;
+  std::mutex worker_mutex;
+  IOConfigutaion _io_config = {};
+  std::atomic<bool> failed{false};
+};
+
+// Worker side. Serves the sandbox named `name` until the host quits or dies.
+int run_sandbox_worker(const char *name, uint64_t host_pid);
+
+// Called by the worker's `send_event_to_host`.
+void sandbox_worker_send_event(const PluginIssuedEvent *event);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SILENCE_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SILENCE_NEON 1
+#endif
+
+// Returns true if every sample is +0.0 or -0.0. Loud buffers are rejected
+// early; the loop only runs to the end for silent (or nearly silent) input.
+inline bool is_silent(const float *samples, int32_t count) {
+  int32_t i = 0;
+
+#if defined(SILENCE_SSE2)
+  const __m128i abs_mask = _mm_set1_epi32(0x7fffffff);
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(samples + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(samples + i + 4));
+    __m128i c = _mm_loadu_si128((const __m128i *)(samples + i + 8));
+    __m128i d = _mm_loadu_si128((const __m128i *)(samples + i + 12));
+    __m128i bits = _mm_and_si128(
+        _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), abs_mask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(bits, _mm_setzero_si128())) !=
+        0xffff) {
+      return false;
+    }
+  }
+#elif defined(SILENCE_NEON)
+  const uint32x4_t abs_mask = vdupq_n_u32(0x7fffffff);
+  for (; i + 16 <= count; i += 16) {
+    uint32x4_t a = vld1q_u32((const uint32_t *)(samples + i));
+    uint32x4_t b = vld1q_u32((const uint32_t *)(samples + i + 4));
+    uint32x4_t c = vld1q_u32((const uint32_t *)(samples + i + 8));
+    uint32x4_t d = vld1q_u32((const uint32_t *)(samples + i + 12));
+    uint32x4_t bits =
+        vandq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d)), abs_mask);
+#if defined(__aarch64__) || defined(_M_ARM64)
+    if (vmaxvq_u32(bits) != 0) {
+      return false;
+    }
+#else
+    // ARMv7 has no across-vector max, so the halves are folded pairwise
+    uint32x2_t folded = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+    folded = vpmax_u32(folded, folded);
+    if (vget_lane_u32(folded, 0) != 0) {
+      return false;
+    }
+#endif
+  }
+#endif
+
+  for (; i < count; i++) {
+    uint32_t bits;
+    memcpy(&bits, samples + i, sizeof(bits));
+    if ((bits & 0x7fffffff) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Scans each channel of a bus and returns a VST3 style silence bit mask.
+inline uint64_t silence_flags(float *const *channels, int32_t num_channels,
+                              int32_t count) {
+  uint64_t flags = 0;
+  for (int32_t c = 0; c < num_channels && c < 64; c++) {
+    if (is_silent(channels[c], count)) {
+      flags |= (uint64_t)1 << c;
+    }
+  }
+  return flags;
+}
+
+inline uint64_t all_channels_mask(int32_t num_channels) {
+  return num_channels >= 64 ? ~(uint64_t)0
+                            : (((uint64_t)1 << num_channels) - 1);
+}
@@ -0,0 +1,182 @@
+#include "timeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ipc.h"
+
+static const size_t TIMELINE_BUFFER_CAPACITY = 16384;
+
+std::atomic<bool> timeline_enabled{false};
+
+struct TimelineEvent {
+  const char *name;
+  const void *instance;
+  int64_t begin_ns;
+  int64_t end_ns;
+};
+
+// Written by the owning thread only. The sequence is odd while the event is
+// being written, so a concurrent dump can skip torn slots.
+struct TimelineSlot {
+  std::atomic<uint32_t> sequence{0};
+  TimelineEvent event = {};
+};
+
+struct ThreadTimeline {
+  uint32_t thread_id = 0;
+  // Guarded by `registry_mutex`
+  std::string thread_name;
+  std::atomic<uint64_t> written{0};
+  TimelineSlot slots[TIMELINE_BUFFER_CAPACITY];
+};
+
+// Buffers are never freed so spans from threads that have since exited can
+// still be dumped. They are only allocated for registered threads.
+static std::mutex registry_mutex;
+static std::vector<ThreadTimeline *> registry;
+static std::unordered_map<const void *, std::string> instance_names;
+
+static thread_local ThreadTimeline *current_timeline = nullptr;
+
+int64_t timeline_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void timeline_record(const char *name, const void *instance, int64_t begin_ns,
+                     int64_t end_ns) {
+  ThreadTimeline *timeline = current_timeline;
+  if (!timeline) {
+    return;
+  }
+
+  uint64_t index = timeline->written.load(std::memory_order_relaxed);
+  TimelineSlot &slot = timeline->slots[index % TIMELINE_BUFFER_CAPACITY];
+
+  uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.event = {name, instance, begin_ns, end_ns};
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+
+  timeline->written.store(index + 1, std::memory_order_release);
+}
+
+void timeline_name_instance(const void *instance, const std::string &name) {
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  instance_names[instance] = name;
+}
+
+void timeline_forget_instance(const void *instance) {
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  instance_names.erase(instance);
+}
+
+void timeline_register_thread(const std::string &name) {
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  if (!current_timeline) {
+    current_timeline = new ThreadTimeline();
+    current_timeline->thread_id = (uint32_t)registry.size() + 1;
+    registry.push_back(current_timeline);
+  }
+  current_timeline->thread_name = name;
+}
+
+static void write_json_string(FILE *file, const std::string &str) {
+  fputc('"', file);
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if ((unsigned char)c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+bool timeline_dump(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  uint64_t pid = current_process_id();
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) {
+      fprintf(file, ",\n");
+    }
+    first = false;
+  };
+
+  std::vector<TimelineEvent> events;
+  for (ThreadTimeline *timeline : registry) {
+    separator();
+    fprintf(file,
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%llu,\"tid\":%u,"
+            "\"args\":{\"name\":",
+            (unsigned long long)pid, timeline->thread_id);
+    write_json_string(file, !timeline->thread_name.empty()
+                                ? timeline->thread_name
+                                : "thread " +
+                                      std::to_string(timeline->thread_id));
+    fprintf(file, "}}");
+
+    events.clear();
+    uint64_t written = timeline->written.load(std::memory_order_acquire);
+    uint64_t start = written > TIMELINE_BUFFER_CAPACITY
+                         ? written - TIMELINE_BUFFER_CAPACITY
+                         : 0;
+    for (uint64_t i = start; i < written; i++) {
+      TimelineSlot &slot = timeline->slots[i % TIMELINE_BUFFER_CAPACITY];
+      uint32_t before = slot.sequence.load(std::memory_order_acquire);
+      TimelineEvent event = slot.event;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint32_t after = slot.sequence.load(std::memory_order_relaxed);
+      if ((before & 1) == 0 && before == after) {
+        events.push_back(event);
+      }
+    }
+
+    // Slots overwritten during the dump may hold newer spans out of order
+    std::sort(events.begin(), events.end(),
+              [](const TimelineEvent &a, const TimelineEvent &b) {
+                return a.begin_ns < b.begin_ns;
+              });
+
+    for (const TimelineEvent &event : events) {
+      separator();
+      fprintf(file,
+              "{\"name\":\"%s\",\"cat\":\"vst3wrapper\",\"ph\":\"X\","
+              "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%llu,\"tid\":%u",
+              event.name, event.begin_ns / 1000.0,
+              (event.end_ns - event.begin_ns) / 1000.0,
+              (unsigned long long)pid, timeline->thread_id);
+
+      if (event.instance) {
+        auto name = instance_names.find(event.instance);
+        fprintf(file, ",\"args\":{\"instance\":");
+        write_json_string(file, name != instance_names.end()
+                                    ? name->second
+                                    : std::to_string((uintptr_t)event.instance));
+        fprintf(file, "}");
+      }
+      fprintf(file, "}");
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
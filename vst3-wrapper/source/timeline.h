@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timeline of wrapper calls, exported as Chrome trace JSON for
+// chrome://tracing or Perfetto. Each thread records spans into its own
+// fixed-size buffer without locking, overwriting its oldest spans once full.
+// Nothing is recorded until enabled with `set_timeline_tracing`, and only
+// threads that registered with `timeline_register_thread` record; spans from
+// other threads are dropped so recording never allocates or locks.
+extern std::atomic<bool> timeline_enabled;
+
+int64_t timeline_now_ns();
+void timeline_record(const char *name, const void *instance, int64_t begin_ns,
+                     int64_t end_ns);
+
+// Labels the spans of `instance` in dumps.
+void timeline_name_instance(const void *instance, const std::string &name);
+void timeline_forget_instance(const void *instance);
+// Allocates the calling thread's buffer, or relabels it if it already has one.
+// An empty `name` labels it by its ID in dumps.
+void timeline_register_thread(const std::string &name);
+
+bool timeline_dump(const char *path);
+
+// Records the enclosing scope as a span named `name`, which must be a string
+// literal.
+class TimelineSpan {
+public:
+  TimelineSpan(const char *_name, const void *_instance) {
+    if (timeline_enabled.load(std::memory_order_relaxed)) {
+      name = _name;
+      instance = _instance;
+      begin_ns = timeline_now_ns();
+    }
+  }
+
+  ~TimelineSpan() {
+    if (name) {
+      timeline_record(name, instance, begin_ns, timeline_now_ns());
+    }
+  }
+
+  TimelineSpan(const TimelineSpan &) = delete;
+  TimelineSpan &operator=(const TimelineSpan &) = delete;
+
+private:
+  const char *name = nullptr;
+  const void *instance = nullptr;
+  int64_t begin_ns = 0;
+};
@@ -0,0 +1,167 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+
+static bool same_cycle(const ProcessDetails &a, const ProcessDetails &b) {
+  return a.nanos == b.nanos && a.player_time == b.player_time &&
+         a.block_size == b.block_size && a.sample_rate == b.sample_rate &&
+         a.tempo == b.tempo && a.playing_state == b.playing_state &&
+         a.time_signature_numerator == b.time_signature_numerator &&
+         a.time_signature_denominator == b.time_signature_denominator &&
+         a.cycle_enabled == b.cycle_enabled &&
+         a.cycle_start == b.cycle_start && a.cycle_end == b.cycle_end &&
+         a.bar_start_pos == b.bar_start_pos;
+}
+
+// Hosts that don't track bars pass a `bar_start_pos` that doesn't contain
+// `player_time`. The bar is then derived assuming the current time signature
+// since the project start.
+static double bar_position(const ProcessDetails *data) {
+  uintptr_t denominator = data->time_signature_denominator
+                              ? data->time_signature_denominator
+                              : 4;
+  double bar_length =
+      data->time_signature_numerator * 4.0 / (double)denominator;
+  if (bar_length <= 0.0) {
+    return data->bar_start_pos;
+  }
+
+  double offset = data->player_time - data->bar_start_pos;
+  if (offset >= 0.0 && offset < bar_length) {
+    return data->bar_start_pos;
+  }
+  return std::floor(data->player_time / bar_length) * bar_length;
+}
+
+static TSamples project_samples(const ProcessDetails *data,
+                                const ProcessDetails *previous,
+                                TSamples previous_samples) {
+  if (data->tempo <= 0.0 || data->sample_rate == 0) {
+    return 0;
+  }
+
+  // Continuing from the previous block: the samples it covered are exact
+  // whatever tempo changes the host applied within it.
+  if (previous && previous->sample_rate == data->sample_rate &&
+      previous->tempo > 0.0) {
+    bool moving = previous->playing_state != PlayingState::Stopped;
+    TSamples advanced = moving ? (TSamples)previous->block_size : 0;
+    double beats_per_sample = previous->tempo / 60.0 / previous->sample_rate;
+    double expected = previous->player_time + advanced * beats_per_sample;
+    double tolerance =
+        0.5 * std::max<uintptr_t>(data->block_size, 1) * beats_per_sample;
+
+    if (std::abs(data->player_time - expected) <= tolerance) {
+      return previous_samples + advanced;
+    }
+  }
+
+  return std::llround(data->player_time * 60.0 / data->tempo *
+                      (double)data->sample_rate);
+}
+
+TransportEngine::Cycle TransportEngine::build(const ProcessDetails *data,
+                                              const Cycle *previous) {
+  Cycle cycle = {};
+  cycle.details = *data;
+
+  ProcessContext &ctx = cycle.context;
+  uint32 state = 0;
+
+  ctx.projectTimeSamples =
+      project_samples(data, previous ? &previous->details : nullptr,
+                      previous ? previous->context.projectTimeSamples : 0);
+
+  ctx.tempo = data->tempo;
+  state |= ProcessContext::kTempoValid;
+
+  ctx.timeSigNumerator = (int32)data->time_signature_numerator;
+  ctx.timeSigDenominator = (int32)data->time_signature_denominator;
+  state |= ProcessContext::kTimeSigValid;
+
+  ctx.projectTimeMusic = data->player_time;
+  state |= ProcessContext::kProjectTimeMusicValid;
+
+  ctx.barPositionMusic = bar_position(data);
+  state |= ProcessContext::kBarPositionValid;
+
+  ctx.cycleStartMusic = data->cycle_start;
+  ctx.cycleEndMusic = data->cycle_end;
+  state |= ProcessContext::kCycleValid;
+
+  ctx.systemTime = (int64)data->nanos;
+  state |= ProcessContext::kSystemTimeValid;
+
+  if (data->cycle_enabled) {
+    state |= ProcessContext::kCycleActive;
+  }
+
+  if (data->playing_state != PlayingState::Stopped) {
+    state |= ProcessContext::kPlaying;
+  }
+
+  if (data->playing_state == PlayingState::Recording) {
+    state |= ProcessContext::kRecording;
+  }
+
+  ctx.state = state;
+  return cycle;
+}
+
+void TransportEngine::context(const ProcessDetails *data, uint32 requirements,
+                              ProcessContext &context) {
+  if (!has_last || !same_cycle(last.details, *data)) {
+    last = build(data, has_last ? &last : nullptr);
+    has_last = true;
+  }
+
+  const ProcessContext &src = last.context;
+  uint32 state = 0;
+
+  // Always provided, whatever the plugin declares
+  context.projectTimeSamples = src.projectTimeSamples;
+
+  if (requirements & IProcessContextRequirements::kNeedSystemTime) {
+    context.systemTime = src.systemTime;
+    state |= src.state & ProcessContext::kSystemTimeValid;
+  }
+
+  if (requirements & IProcessContextRequirements::kNeedProjectTimeMusic) {
+    context.projectTimeMusic = src.projectTimeMusic;
+    state |= src.state & ProcessContext::kProjectTimeMusicValid;
+  }
+
+  if (requirements & IProcessContextRequirements::kNeedBarPositionMusic) {
+    context.barPositionMusic = src.barPositionMusic;
+    state |= src.state & ProcessContext::kBarPositionValid;
+  }
+
+  if (requirements & IProcessContextRequirements::kNeedCycleMusic) {
+    context.cycleStartMusic = src.cycleStartMusic;
+    context.cycleEndMusic = src.cycleEndMusic;
+    state |= src.state & ProcessContext::kCycleValid;
+  }
+
+  if (requirements & IProcessContextRequirements::kNeedTempo) {
+    context.tempo = src.tempo;
+    state |= src.state & ProcessContext::kTempoValid;
+  }
+
+  if (requirements & IProcessContextRequirements::kNeedTimeSignature) {
+    context.timeSigNumerator = src.timeSigNumerator;
+    context.timeSigDenominator = src.timeSigDenominator;
+    state |= src.state & ProcessContext::kTimeSigValid;
+  }
+
+  if (requirements & IProcessContextRequirements::kNeedTransportState) {
+    state |= src.state & (ProcessContext::kPlaying |
+                          ProcessContext::kCycleActive |
+                          ProcessContext::kRecording);
+  }
+
+  context.state = state;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+#include <pluginterfaces/vst/ivstprocesscontext.h>
+
+#include "bindings.h"
+
+// Builds an instance's `ProcessContext` from the `ProcessDetails` of each
+// block. Every instance keeps its own history, as instances in one process
+// follow different timelines: fixed block sub-blocks, anticipative renders
+// running ahead and offline renders all advance on their own.
+//
+// `projectTimeSamples` follows the host's tempo map by advancing with the
+// blocks played while the transport runs continuously. It is only derived
+// from `player_time` at the current tempo after a relocation, where nothing
+// better is known.
+class TransportEngine {
+public:
+  // Copies the fields in `requirements`, a set of
+  // `IProcessContextRequirements` flags, of the context for `data` into
+  // `context`. `sampleRate` is left to the instance.
+  void context(const ProcessDetails *data, Steinberg::uint32 requirements,
+               Steinberg::Vst::ProcessContext &context);
+
+private:
+  struct Cycle {
+    ProcessDetails details;
+    Steinberg::Vst::ProcessContext context;
+  };
+
+  // Builds the cycle for `data`, continuing from `previous` if given.
+  static Cycle build(const ProcessDetails *data, const Cycle *previous);
+
+  // The last block's cycle, reused if a block repeats its details.
+  Cycle last = {};
+  bool has_last = false;
+};
+
+// Requirements assumed for plugins that don't implement
+// `IProcessContextRequirements`.
+const Steinberg::uint32 ALL_PROCESS_CONTEXT_REQUIREMENTS = 0xffffffff;
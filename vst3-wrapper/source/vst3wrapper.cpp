@@ -1,13 +1,81 @@
 #include "vst3wrapper.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
 #include <cstdio>
-#include <iostream>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 using namespace Steinberg;
 using namespace Steinberg::Vst;
 
+static LogRing log_ring;
+static LogLimiter global_log_limiter;
+
+void wrapper_log(PluginInstance *vst, LogLevel level, const char *format, ...) {
+  LogLimiter &limiter = vst ? vst->log_limiter : global_log_limiter;
+
+  uint32_t suppressed = 0;
+  if (!limiter.allow(format, suppressed)) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  bool queued = log_ring.push_with([&](LogRecordFFI &record) {
+    record.level = level;
+    record.tag = (uintptr_t)vst;
+    record.suppressed = suppressed;
+    vsnprintf(record.message, sizeof(record.message), format, args);
+  });
+  va_end(args);
+
+  if (!queued) {
+    limiter.dropped(format, suppressed + 1);
+  }
+}
+
+void forward_log_record(PluginInstance *vst, const LogRecordFFI &record) {
+  log_ring.push_with([&](LogRecordFFI &slot) {
+    slot = record;
+    slot.tag = (uintptr_t)vst;
+  });
+}
+
+uintptr_t drain_log(LogRecordFFI *records, uintptr_t max_records) {
+  uintptr_t count = 0;
+  while (count < max_records &&
+         log_ring.pop_with(
+             [&](LogRecordFFI &record) { records[count] = record; })) {
+    count++;
+  }
+  return count;
+}
+
+void set_timeline_tracing(bool enabled) {
+  if (enabled) {
+    timeline_register_thread("");
+  }
+  timeline_enabled.store(enabled);
+}
+
+void register_timeline_thread(const char *name) {
+  timeline_register_thread(name ? name : "");
+}
+
+bool dump_timeline(const char *path) { return timeline_dump(path); }
+
+void run_loop_dispatch(uint32_t timeout_ms) { run_loop().dispatch(timeout_ms); }
+
 const char *alloc_string(const char *str) {
   if (str == nullptr) {
     return nullptr;
@@ -65,8 +133,11 @@ public:
     return Steinberg::kResultOk;
   }
 
-  Steinberg::tresult queryInterface(const Steinberg::TUID /*_iid*/,
-                                    void ** /*obj*/) override {
+  Steinberg::tresult queryInterface(const Steinberg::TUID _iid,
+                                    void **obj) override {
+    if (FUnknownPrivate::iidEqual(_iid, Linux::IRunLoop::iid)) {
+      return run_loop().queryInterface(_iid, obj);
+    }
     return Steinberg::kNoInterface;
   }
   // we do not care here of the ref-counting. A plug-in call of release should
@@ -75,17 +146,32 @@ public:
   Steinberg::uint32 release() override { return 1000; }
 };
 
+// Also hands out the run loop, for plugins that set up their timers before an
+// editor, or without one.
+class HostContext : public Steinberg::Vst::HostApplication {
+public:
+  Steinberg::tresult PLUGIN_API queryInterface(const Steinberg::TUID _iid,
+                                               void **obj) override {
+    if (FUnknownPrivate::iidEqual(_iid, Linux::IRunLoop::iid)) {
+      return run_loop().queryInterface(_iid, obj);
+    }
+    return HostApplication::queryInterface(_iid, obj);
+  }
+};
+
 class ComponentHandler : public Steinberg::Vst::IComponentHandler {
 public:
+  PluginInstance *instance = nullptr;
   std::vector<ParameterEditState> *param_edits = nullptr;
   std::mutex *param_edits_mutex = nullptr;
   const void *plugin_sent_events_producer = nullptr;
   const std::unordered_map<ParamID, int> *parameter_indicies = nullptr;
 
   ComponentHandler(
-      std::vector<ParameterEditState> *_param_edits,
+      PluginInstance *_instance, std::vector<ParameterEditState> *_param_edits,
       std::mutex *_param_edits_mutex, const void *_plugin_sent_events_producer,
       const std::unordered_map<ParamID, int> *_parameter_indicies) {
+    instance = _instance;
     param_edits = _param_edits;
     param_edits_mutex = _param_edits_mutex;
     plugin_sent_events_producer = _plugin_sent_events_producer;
@@ -93,6 +179,7 @@ public:
   }
 
   Steinberg::tresult beginEdit(Steinberg::Vst::ParamID id) override {
+    TimelineSpan span("beginEdit", instance);
     // TODO
     return Steinberg::kResultOk;
   }
@@ -100,8 +187,10 @@ public:
   Steinberg::tresult
   performEdit(Steinberg::Vst::ParamID id,
               Steinberg::Vst::ParamValue valueNormalized) override {
+    TimelineSpan span("performEdit", instance);
     if (!param_edits || !param_edits_mutex) {
-      std::cout << "Param editing state was no initilaized" << std::endl;
+      wrapper_log(instance, LogLevel::Error,
+                  "Param editing state was no initilaized");
       return Steinberg::kResultFalse;
     }
 
@@ -134,6 +223,7 @@ public:
   }
 
   Steinberg::tresult endEdit(Steinberg::Vst::ParamID id) override {
+    TimelineSpan span("endEdit", instance);
     std::lock_guard<std::mutex> guard(*param_edits_mutex);
 
     for (int i = 0; i < param_edits->size(); i++) {
@@ -157,12 +247,8 @@ public:
   }
 
   Steinberg::tresult restartComponent(Steinberg::int32 flags) override {
-    // TODO
-
-    PluginIssuedEvent event = {};
-    event.tag = PluginIssuedEvent::Tag::IOChanged;
-    send_event_to_host(&event, plugin_sent_events_producer);
-
+    TimelineSpan span("restartComponent", instance);
+    instance->pending_restart.fetch_or(flags);
     return Steinberg::kResultOk;
   }
 
@@ -180,6 +266,7 @@ private:
 Steinberg::Vst::HostApplication *PluginInstance::_standardPluginContext =
     nullptr;
 int PluginInstance::_standardPluginContextRefCount = 0;
+std::mutex PluginInstance::_standardPluginContextMutex;
 
 PluginInstance::PluginInstance() {}
 
@@ -187,13 +274,23 @@ PluginInstance::~PluginInstance() { destroy(); }
 
 const int MAX_BLOCK_SIZE = 4096 * 2;
 
+// Events a block can pass to the plugin's MIDI input: one per sample of the
+// largest block, within what the event scheduler hands over per block.
+static int32 midi_event_capacity(int32 max_block_size) {
+  return std::min<int32>(max_block_size, (int32)EVENT_QUEUE_CAPACITY);
+}
+
 bool PluginInstance::init(const std::string &path) {
   _destroy(false);
 
-  ++_standardPluginContextRefCount;
-  if (!_standardPluginContext) {
-    _standardPluginContext = owned(NEW HostApplication());
-    PluginContextFactory::instance().setPluginContext(_standardPluginContext);
+  {
+    std::lock_guard<std::mutex> lock(_standardPluginContextMutex);
+    ++_standardPluginContextRefCount;
+    if (!_standardPluginContext) {
+      // Our reference is released with the last instance
+      _standardPluginContext = NEW HostContext();
+      PluginContextFactory::instance().setPluginContext(_standardPluginContext);
+    }
   }
 
   _processSetup.symbolicSampleSize = 0;
@@ -204,16 +301,18 @@ bool PluginInstance::init(const std::string &path) {
   _processData.processContext = &_processContext;
 
   std::string error;
-  _module = VST3::Hosting::Module::create(path, error);
+  auto module_lock = module_registry().lock(path);
+  _module = module_registry().acquire(path, error);
   if (!_module) {
-    std::cout << "Failed to load VST3 module: " << error << std::endl;
+    wrapper_log(this, LogLevel::Error, "Failed to load VST3 module: %s",
+                error.c_str());
     return false;
   }
 
   VST3::Hosting::PluginFactory factory = _module->getFactory();
   for (auto &classInfo : factory.classInfos()) {
     if (classInfo.category() == kVstAudioEffectClass) {
-      return this->load_plugin_from_class(factory, classInfo);
+      return this->load_plugin_from_class(factory, classInfo, module_lock);
     }
   }
 
@@ -221,11 +320,13 @@ bool PluginInstance::init(const std::string &path) {
 }
 
 bool PluginInstance::load_plugin_from_class(
-    VST3::Hosting::PluginFactory &factory,
-    VST3::Hosting::ClassInfo &classInfo) {
-  _plugProvider = owned(NEW PlugProvider(factory, classInfo, true));
+    VST3::Hosting::PluginFactory &factory, VST3::Hosting::ClassInfo &classInfo,
+    std::unique_lock<std::mutex> &module_lock) {
+  IPtr<WrapperPlugProvider> provider =
+      owned(NEW WrapperPlugProvider(factory, classInfo, true));
+  _plugProvider = provider.get();
   if (!_plugProvider) {
-    std::cout << "No PlugProvider found" << std::endl;
+    wrapper_log(this, LogLevel::Error, "No PlugProvider found");
     return false;
   }
 
@@ -233,36 +334,35 @@ bool PluginInstance::load_plugin_from_class(
 
   _audioEffect = FUnknownPtr<IAudioProcessor>(_vstPlug);
   if (!_audioEffect) {
-    std::cout << "Could not get audio processor from VST" << std::endl;
+    wrapper_log(this, LogLevel::Error,
+                "Could not get audio processor from VST");
     return false;
   }
 
+  FUnknownPtr<IProcessContextRequirements> requirements(_audioEffect);
+  context_requirements = requirements
+                             ? requirements->getProcessContextRequirements()
+                             : ALL_PROCESS_CONTEXT_REQUIREMENTS;
+
   _editController = _plugProvider->getController();
   if (_editController->initialize(_standardPluginContext) != kResultOk) {
-    std::cout << "Failed to initialize editor context" << std::endl;
+    wrapper_log(this, LogLevel::Warning, "Failed to initialize editor context");
   }
 
   param_edits = {};
 
   component_handler =
-      new ComponentHandler(&param_edits, &param_edits_mutex,
+      new ComponentHandler(this, &param_edits, &param_edits_mutex,
                            plugin_sent_events_producer, &parameter_indicies);
   _editController->setComponentHandler((ComponentHandler *)component_handler);
 
-  Vst::IConnectionPoint *iConnectionPointComponent = nullptr;
-  Vst::IConnectionPoint *iConnectionPointController = nullptr;
+  // The provider connects the component and controller directly when it
+  // creates them; route their messages through our proxies instead.
+  provider->disconnect_components();
+  connect_message_proxies();
 
-  _audioEffect->queryInterface(Vst::IConnectionPoint::iid,
-                               (void **)&iConnectionPointComponent);
-  _editController->queryInterface(Vst::IConnectionPoint::iid,
-                                  (void **)&iConnectionPointController);
-
-  if (iConnectionPointComponent && iConnectionPointController) {
-    iConnectionPointComponent->connect(iConnectionPointController);
-    iConnectionPointController->connect(iConnectionPointComponent);
-  } else {
-    std::cout << "Failed to get connection points." << std::endl;
-  }
+  // The rest only touches this instance
+  module_lock.unlock();
 
   auto stream = ResizableMemoryIBStream();
 
@@ -327,37 +427,195 @@ bool PluginInstance::load_plugin_from_class(
       _inSpeakerArrs.data(), _numInAudioBuses, _outSpeakerArrs.data(),
       _numOutAudioBuses);
   if (res != kResultTrue) {
-    std::cout << "Failed to set bus arrangements" << std::endl;
+    wrapper_log(this, LogLevel::Warning, "Failed to set bus arrangements");
   }
 
   res = _audioEffect->setupProcessing(_processSetup);
   if (res == kResultOk) {
-    _processData.prepare(*_vstPlug, MAX_BLOCK_SIZE,
-                         _processSetup.symbolicSampleSize);
-    if (_numInEventBuses > 0) {
-      _processData.inputEvents = new EventList[_numInEventBuses];
-    }
-    if (_numOutEventBuses > 0) {
-      _processData.outputEvents = new EventList[_numOutEventBuses];
-    }
+    prepare_process_data();
   } else {
-    std::cout << "Failed to setup VST processing" << std::endl;
+    wrapper_log(this, LogLevel::Error, "Failed to setup VST processing");
   }
 
   if (_vstPlug->setActive(true) != kResultTrue) {
-    std::cout << "Failed to activate VST component" << std::endl;
+    wrapper_log(this, LogLevel::Error, "Failed to activate VST component");
   }
 
+  tail_samples = _audioEffect->getTailSamples();
+  latency_samples = _audioEffect->getLatencySamples();
+
   get_io_config();
 
   return true;
 }
 
-void PluginInstance::destroy() { _destroy(true); }
+void PluginInstance::prepare_process_data() {
+  unprepare_process_data();
+
+  // Channels are bound to the host's buffers every block, so the SDK only
+  // allocates the bus and pointer arrays.
+  _processData.prepare(*_vstPlug, 0, _processSetup.symbolicSampleSize);
+  for (int i = 0; i < _processData.numInputs; i++) {
+    prepared_inputs.push_back(_processData.inputs[i].channelBuffers32);
+  }
+  for (int i = 0; i < _processData.numOutputs; i++) {
+    prepared_outputs.push_back(_processData.outputs[i].channelBuffers32);
+  }
+
+  // MIDI only ever goes to the first input bus and output event buses are
+  // never activated, so the other lists hold no events.
+  if (_numInEventBuses > 0) {
+    _processData.inputEvents = new EventList[_numInEventBuses];
+    eventList(kInput, 0)->setMaxSize(
+        midi_event_capacity(_processSetup.maxSamplesPerBlock));
+    for (int i = 1; i < _numInEventBuses; i++) {
+      eventList(kInput, i)->setMaxSize(0);
+    }
+  }
+  if (_numOutEventBuses > 0) {
+    _processData.outputEvents = new EventList[_numOutEventBuses];
+    for (int i = 0; i < _numOutEventBuses; i++) {
+      eventList(kOutput, i)->setMaxSize(0);
+    }
+  }
+
+  // One queue per parameter covers every change a block can carry
+  parameter_queues = _editController ? _editController->getParameterCount() : 0;
+  _processData.inputParameterChanges = new ParameterChanges(parameter_queues);
+}
+
+void PluginInstance::unprepare_process_data() {
+  if (_processData.inputEvents) {
+    delete[] static_cast<Steinberg::Vst::EventList *>(_processData.inputEvents);
+    _processData.inputEvents = nullptr;
+  }
+  if (_processData.outputEvents) {
+    delete[] static_cast<Steinberg::Vst::EventList *>(
+        _processData.outputEvents);
+    _processData.outputEvents = nullptr;
+  }
+  if (_processData.inputParameterChanges) {
+    delete static_cast<Steinberg::Vst::ParameterChanges *>(
+        _processData.inputParameterChanges);
+    _processData.inputParameterChanges = nullptr;
+  }
+  parameter_queues = 0;
+
+  for (size_t i = 0; i < prepared_inputs.size(); i++) {
+    _processData.inputs[i].channelBuffers32 = prepared_inputs[i];
+  }
+  for (size_t i = 0; i < prepared_outputs.size(); i++) {
+    _processData.outputs[i].channelBuffers32 = prepared_outputs[i];
+  }
+  prepared_inputs.clear();
+  prepared_outputs.clear();
+
+  _processData.unprepare();
+}
+
+// The SDK keeps its queue storage protected, so these reach it through member
+// pointers taken in derived classes to report what it actually reserved.
+struct ParameterValueQueueStorage : ParameterValueQueue {
+  static size_t allocated_bytes(ParameterValueQueue *queue) {
+    auto values = &ParameterValueQueueStorage::values;
+    return sizeof(ParameterValueQueue) +
+           (queue->*values).capacity() *
+               sizeof(decltype(ParameterValueQueueStorage::values)::value_type);
+  }
+};
+
+struct ParameterChangesStorage : ParameterChanges {
+  static size_t allocated_bytes(ParameterChanges *changes) {
+    auto queues = &ParameterChangesStorage::queues;
+    size_t bytes = sizeof(ParameterChanges) +
+                   (changes->*queues).capacity() *
+                       sizeof(IPtr<ParameterValueQueue>);
+    for (const IPtr<ParameterValueQueue> &queue : changes->*queues) {
+      bytes += ParameterValueQueueStorage::allocated_bytes(queue.get());
+    }
+    return bytes;
+  }
+};
+
+MemoryUsage PluginInstance::memory_usage() {
+  MemoryUsage usage = {};
+  usage.instance = sizeof(PluginInstance) - sizeof(EventScheduler);
+
+  if (sandbox) {
+    usage.sandbox = sizeof(SandboxShared);
+  } else {
+    usage.process_data =
+        (prepared_inputs.size() + prepared_outputs.size()) *
+        sizeof(AudioBusBuffers);
+    for (int i = 0; i < _processData.numInputs; i++) {
+      usage.process_data +=
+          _processData.inputs[i].numChannels * sizeof(Sample32 *);
+    }
+    for (int i = 0; i < _processData.numOutputs; i++) {
+      usage.process_data +=
+          _processData.outputs[i].numChannels * sizeof(Sample32 *);
+    }
+
+    usage.event_lists = (_numInEventBuses + _numOutEventBuses) *
+                        sizeof(EventList);
+    if (_processData.inputEvents) {
+      usage.event_lists +=
+          midi_event_capacity(_processSetup.maxSamplesPerBlock) *
+          sizeof(Event);
+    }
+
+    if (_processData.inputParameterChanges) {
+      usage.parameter_changes = ParameterChangesStorage::allocated_bytes(
+          static_cast<ParameterChanges *>(_processData.inputParameterChanges));
+    }
+  }
+
+  usage.event_scheduler = event_scheduler.allocated_bytes();
+  usage.block_adapter = block_adapter.allocated_bytes();
+
+  // Hash nodes hold the entry and a next pointer, plus a bucket pointer each
+  usage.parameter_tables =
+      param_sync.allocated_bytes() +
+      parameter_info_cache.capacity() * sizeof(ParameterInfo) +
+      parameter_indicies.size() *
+          (sizeof(std::pair<const ParamID, int>) + sizeof(void *)) +
+      parameter_indicies.bucket_count() * sizeof(void *) +
+      param_edits.capacity() * sizeof(ParameterEditState);
+  usage.capture = recorder.allocated_bytes();
+
+  usage.total = usage.instance + usage.process_data + usage.event_lists +
+                usage.parameter_changes + usage.parameter_tables +
+                usage.event_scheduler + usage.block_adapter + usage.capture +
+                usage.sandbox;
+  return usage;
+}
+
+void PluginInstance::destroy() {
+  recorder.stop();
+  timeline_forget_instance(this);
+  // Sandboxed instances never took a reference on the plugin context
+  _destroy(!sandbox);
+  sandbox = nullptr;
+}
 
 void set_processing(const void *app, bool processing) {
   PluginInstance *vst = (PluginInstance *)app;
+
+  if (vst->sandbox) {
+    vst->sandbox->set_processing(processing);
+    return;
+  }
+
+  if (vst->queued_control.load()) {
+    ControlCommand command = {};
+    command.type = ControlCommandType::SetProcessing;
+    command.enabled = processing;
+    vst->push_command(command);
+    return;
+  }
+
   vst->_audioEffect->setProcessing(processing);
+  vst->processing = processing;
 }
 
 Steinberg::Vst::ProcessContext *PluginInstance::processContext() {
@@ -391,16 +649,52 @@ PluginInstance::parameterChanges(Steinberg::Vst::BusDirection direction,
   }
 }
 
+void PluginInstance::connect_message_proxies() {
+  FUnknownPtr<Vst::IConnectionPoint> component(_vstPlug);
+  FUnknownPtr<Vst::IConnectionPoint> controller(_editController);
+  if (!component || !controller) {
+    wrapper_log(this, LogLevel::Warning, "Failed to get connection points.");
+    return;
+  }
+
+  to_controller = owned(new MessageProxy(controller));
+  to_component = owned(new MessageProxy(component));
+  component->connect(to_controller);
+  controller->connect(to_component);
+}
+
+void PluginInstance::disconnect_message_proxies() {
+  FUnknownPtr<Vst::IConnectionPoint> component(_vstPlug);
+  FUnknownPtr<Vst::IConnectionPoint> controller(_editController);
+
+  if (to_controller) {
+    if (component) {
+      component->disconnect(to_controller);
+    }
+    to_controller->close();
+    to_controller = nullptr;
+  }
+  if (to_component) {
+    if (controller) {
+      controller->disconnect(to_component);
+    }
+    to_component->close();
+    to_component = nullptr;
+  }
+}
+
 Dims PluginInstance::createView(void *window_id) {
   if (!_editController) {
-    std::cout << "VST does not provide an edit controller" << std::endl;
+    wrapper_log(this, LogLevel::Warning,
+                "VST does not provide an edit controller");
     return {};
   }
 
   if (!_view) {
     _view = _editController->createView(ViewType::kEditor);
     if (!_view) {
-      std::cout << "EditController does not provide its own view" << std::endl;
+      wrapper_log(this, LogLevel::Warning,
+                  "EditController does not provide its own view");
       return {};
     }
 
@@ -410,25 +704,41 @@ Dims PluginInstance::createView(void *window_id) {
 #ifdef _WIN32
   if (_view->isPlatformTypeSupported(Steinberg::kPlatformTypeHWND) !=
       Steinberg::kResultTrue) {
-    std::cout << "Editor view does not support HWND" << std::endl;
+    wrapper_log(this, LogLevel::Warning, "Editor view does not support HWND");
+    return {};
+  }
+#elif defined(__linux__)
+  if (_view->isPlatformTypeSupported(
+          Steinberg::kPlatformTypeX11EmbedWindowID) != Steinberg::kResultTrue) {
+    wrapper_log(this, LogLevel::Warning,
+                "Editor view does not support X11 embedding");
     return {};
   }
 #else
-  std::cout << "Platform is not supported yet" << std::endl;
-  return false;
+  wrapper_log(this, LogLevel::Warning, "Platform is not supported yet");
+  return {};
 #endif
 
 #ifdef _WIN32
   if (_view->attached(window_id, Steinberg::kPlatformTypeHWND) !=
       Steinberg::kResultOk) {
-    std::cout << "Failed to attach editor view to HWND" << std::endl;
+    wrapper_log(this, LogLevel::Error, "Failed to attach editor view to HWND");
+    return {};
+  }
+#elif defined(__linux__)
+  // `window_id` is the X11 window to embed into. The view's timers and X11
+  // connection are driven through `run_loop_dispatch`.
+  if (_view->attached(window_id, Steinberg::kPlatformTypeX11EmbedWindowID) !=
+      Steinberg::kResultOk) {
+    wrapper_log(this, LogLevel::Error,
+                "Failed to attach editor view to X11 window");
     return {};
   }
 #endif
 
   ViewRect viewRect = {};
   if (_view->getSize(&viewRect) != kResultOk) {
-    std::cout << "Failed to get editor view size" << std::endl;
+    wrapper_log(this, LogLevel::Error, "Failed to get editor view size");
     return {};
   }
 
@@ -438,7 +748,66 @@ Dims PluginInstance::createView(void *window_id) {
   };
 }
 
+bool PluginInstance::scan_input_silence() {
+  bool all_silent = true;
+  for (int i = 0; i < _processData.numInputs; i++) {
+    AudioBusBuffers &bus = _processData.inputs[i];
+    bus.silenceFlags = silence_flags(bus.channelBuffers32, bus.numChannels,
+                                     _processData.numSamples);
+    if (bus.silenceFlags != all_channels_mask(bus.numChannels)) {
+      all_silent = false;
+    }
+  }
+  return all_silent;
+}
+
+bool PluginInstance::outputs_silent() {
+  for (int i = 0; i < _processData.numOutputs; i++) {
+    AudioBusBuffers &bus = _processData.outputs[i];
+    uint64_t all = all_channels_mask(bus.numChannels);
+
+    // Trust the plugin if it flagged its output silent, otherwise check.
+    if ((bus.silenceFlags & all) == all) {
+      continue;
+    }
+
+    if (silence_flags(bus.channelBuffers32, bus.numChannels,
+                      _processData.numSamples) != all) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PluginInstance::can_sleep() {
+  if (!auto_sleep || tail_samples == kInfiniteTail) {
+    return false;
+  }
+
+  // Only sleep once the plugin has been fed silence for longer than its tail
+  // and has itself produced silence, so generators that ignore their input
+  // keep running.
+  return last_output_silent && silent_input_samples >= (int64)tail_samples;
+}
+
+void PluginInstance::silence_outputs() {
+  for (int i = 0; i < _processData.numOutputs; i++) {
+    AudioBusBuffers &bus = _processData.outputs[i];
+    for (int c = 0; c < bus.numChannels; c++) {
+      memset(bus.channelBuffers32[c], 0,
+             _processData.numSamples * sizeof(Sample32));
+    }
+    bus.silenceFlags = all_channels_mask(bus.numChannels);
+  }
+}
+
 IOConfigutaion PluginInstance::get_io_config() {
+  IOConfigutaion io_config = read_io_config();
+  apply_io_config(io_config);
+  return io_config;
+}
+
+IOConfigutaion PluginInstance::read_io_config() {
   IOConfigutaion io_config = {};
   io_config.audio_inputs = {};
   io_config.audio_outputs = {};
@@ -471,18 +840,192 @@ IOConfigutaion PluginInstance::get_io_config() {
   // vst->_vstPlug->getBusCount(MediaTypes::kEvent, BusDirections::kInput);
   // vst->_vstPlug->getBusCount(MediaTypes::kEvent, BusDirections::kOutput);
 
+  return io_config;
+}
+
+void PluginInstance::apply_io_config(const IOConfigutaion &io_config) {
   _io_config = io_config;
+  select_process_kernel();
 
-  return io_config;
+  // The FIFOs follow the new channel layout
+  if (block_adapter.enabled()) {
+    block_adapter.configure(block_adapter.latency(), io_config);
+  }
+}
+
+static bool same_buses(const HeaplessVec<AudioBusDescriptor, 16> &a,
+                       const HeaplessVec<AudioBusDescriptor, 16> &b) {
+  if (a.count != b.count) {
+    return false;
+  }
+  for (uintptr_t i = 0; i < a.count; i++) {
+    if (a.data[i].value.channels != b.data[i].value.channels) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PluginInstance::reconfigure_buses(bool reload) {
+  IOConfigutaion io_config = read_io_config();
+  bool changed =
+      !same_buses(io_config.audio_inputs, _io_config.audio_inputs) ||
+      !same_buses(io_config.audio_outputs, _io_config.audio_outputs) ||
+      io_config.event_inputs_count != _io_config.event_inputs_count;
+  if (!changed && !reload) {
+    return false;
+  }
+
+  if (processing) {
+    _audioEffect->setProcessing(false);
+  }
+  _vstPlug->setActive(false);
+
+  _numInAudioBuses = _vstPlug->getBusCount(kAudio, kInput);
+  _numOutAudioBuses = _vstPlug->getBusCount(kAudio, kOutput);
+  _numInEventBuses = _vstPlug->getBusCount(kEvent, kInput);
+  _numOutEventBuses = _vstPlug->getBusCount(kEvent, kOutput);
+
+  if (reload && _audioEffect->setupProcessing(_processSetup) != kResultOk) {
+    wrapper_log(this, LogLevel::Error, "Failed to setup VST processing");
+  }
+  prepare_process_data();
+  activate_buses();
+
+  if (_vstPlug->setActive(true) != kResultTrue) {
+    wrapper_log(this, LogLevel::Error, "Failed to activate VST component");
+  }
+  if (processing) {
+    _audioEffect->setProcessing(true);
+  }
+
+  apply_io_config(io_config);
+  return changed;
+}
+
+void PluginInstance::activate_buses() {
+  for (int i = 0; i < _vstPlug->getBusCount(kAudio, kInput); i++) {
+    _vstPlug->activateBus(kAudio, kInput, i, true);
+  }
+  for (int i = 0; i < _vstPlug->getBusCount(kAudio, kOutput); i++) {
+    _vstPlug->activateBus(kAudio, kOutput, i, true);
+  }
+  for (int i = 0; i < _vstPlug->getBusCount(kEvent, kInput); i++) {
+    _vstPlug->activateBus(kEvent, kInput, i, true);
+  }
+
+  // NOTE: Output event buses are not supported yet so they are not activated
+}
+
+void PluginInstance::apply_restart() {
+  int32 flags = pending_restart.exchange(0);
+  if (flags == 0) {
+    return;
+  }
+
+  bool reload = (flags & RestartFlags::kReloadComponent) != 0;
+  bool io = reload || (flags & RestartFlags::kIoChanged);
+  bool latency_changed = io || (flags & RestartFlags::kLatencyChanged);
+
+  bool buses_changed = false;
+  uint32 latency = latency_samples.load();
+  if (latency_changed) {
+    // Queued commands may toggle processing, so they go first
+    exclude_process();
+    apply_commands();
+
+    if (reload) {
+      // Parameter ids may change, and the parameter queues are sized from
+      // them when the buses are rebuilt
+      init_parameters();
+    }
+    if (io) {
+      buses_changed = reconfigure_buses(reload);
+    }
+    tail_samples = _audioEffect->getTailSamples();
+    latency = _audioEffect->getLatencySamples();
+
+    allow_process();
+  }
+
+  if (buses_changed) {
+    PluginIssuedEvent event = {};
+    event.tag = PluginIssuedEvent::Tag::IOChanged;
+    send_event_to_host(&event, plugin_sent_events_producer);
+  }
+
+  if (latency_samples.exchange(latency) != latency) {
+    PluginIssuedEvent event = {};
+    event.tag = PluginIssuedEvent::Tag::ChangeLatency;
+    event.change_latency = {};
+    event.change_latency._0 = latency + block_adapter.latency();
+    send_event_to_host(&event, plugin_sent_events_producer);
+  }
+
+  if (flags & RestartFlags::kParamTitlesChanged) {
+    parameter_infos_valid = false;
+    program_cache.invalidate();
+  }
+
+  if (reload || (flags & (RestartFlags::kParamValuesChanged |
+                          RestartFlags::kParamTitlesChanged))) {
+    PluginIssuedEvent event = {};
+    event.tag = PluginIssuedEvent::Tag::UpdateDisplay;
+    send_event_to_host(&event, plugin_sent_events_producer);
+  }
+}
+
+void PluginInstance::init_parameters() {
+  parameter_infos_valid = false;
+  program_cache.invalidate();
+  parameter_indicies.clear();
+
+  std::vector<uint32_t> param_ids = {};
+  const std::vector<ParameterInfo> &infos = parameter_infos();
+  for (size_t i = 0; i < infos.size(); i++) {
+    if (infos[i].id != kNoParamId) {
+      param_ids.push_back(infos[i].id);
+      parameter_indicies[infos[i].id] = (int)i;
+    }
+  }
+  param_sync.init(std::move(param_ids));
+}
+
+const std::vector<ParameterInfo> &PluginInstance::parameter_infos() {
+  if (!parameter_infos_valid) {
+    parameter_info_cache.clear();
+    int32 count = _editController ? _editController->getParameterCount() : 0;
+    for (int32 i = 0; i < count; i++) {
+      ParameterInfo info = {};
+      if (_editController->getParameterInfo(i, info) != kResultOk) {
+        info.id = kNoParamId;
+      }
+      parameter_info_cache.push_back(info);
+    }
+    parameter_infos_valid = true;
+  }
+  return parameter_info_cache;
 }
 
 void PluginInstance::_destroy(bool decrementRefCount) {
   // destroyView();
-  _editController = nullptr;
-  _audioEffect = nullptr;
-  _vstPlug = nullptr;
-  _plugProvider = nullptr;
-  _module = nullptr;
+  if (queued_control.load()) {
+    sync_commands();
+    queued_control.store(false);
+  }
+  free_retired_states();
+  block_adapter.configure(0, {});
+
+  disconnect_message_proxies();
+
+  if (_module) {
+    auto module_lock = module_registry().lock(path);
+    _editController = nullptr;
+    _audioEffect = nullptr;
+    _vstPlug = nullptr;
+    _plugProvider = nullptr;
+    _module = nullptr;
+  }
 
   _inAudioBusInfos.clear();
   _outAudioBusInfos.clear();
@@ -497,14 +1040,7 @@ void PluginInstance::_destroy(bool decrementRefCount) {
   _inSpeakerArrs.clear();
   _outSpeakerArrs.clear();
 
-  if (_processData.inputEvents) {
-    delete[] static_cast<Steinberg::Vst::EventList *>(_processData.inputEvents);
-  }
-  if (_processData.outputEvents) {
-    delete[] static_cast<Steinberg::Vst::EventList *>(
-        _processData.outputEvents);
-  }
-  _processData.unprepare();
+  unprepare_process_data();
   _processData = {};
 
   _processSetup = {};
@@ -513,13 +1049,13 @@ void PluginInstance::_destroy(bool decrementRefCount) {
   name = "";
 
   if (decrementRefCount) {
+    std::lock_guard<std::mutex> lock(_standardPluginContextMutex);
     if (_standardPluginContextRefCount > 0) {
       --_standardPluginContextRefCount;
     }
     if (_standardPluginContext && _standardPluginContextRefCount == 0) {
       PluginContextFactory::instance().setPluginContext(nullptr);
       _standardPluginContext->release();
-      delete _standardPluginContext;
       _standardPluginContext = nullptr;
     }
   }
@@ -528,39 +1064,70 @@ void PluginInstance::_destroy(bool decrementRefCount) {
 const void *load_plugin(const char *s,
                         const void *plugin_sent_events_producer) {
   PluginInstance *vst = new PluginInstance();
+  TimelineSpan span("load_plugin", vst);
   vst->plugin_sent_events_producer = plugin_sent_events_producer;
-  vst->init(s);
+  vst->path = s;
+  if (!vst->init(s) || !vst->_audioEffect) {
+    delete vst;
+    return nullptr;
+  }
+  timeline_name_instance(vst, vst->name);
 
   vst->_audioEffect->setProcessing(true);
+  vst->processing = true;
+  vst->activate_buses();
 
-  auto aud_in = vst->_vstPlug->getBusCount(kAudio, kInput);
-  for (int i = 0; i < aud_in; i++) {
-    vst->_vstPlug->activateBus(kAudio, kInput, i, true);
+  if (vst->_editController) {
+    vst->init_parameters();
   }
 
-  auto aud_out = vst->_vstPlug->getBusCount(kAudio, kOutput);
-  for (int i = 0; i < aud_out; i++) {
-    vst->_vstPlug->activateBus(kAudio, kOutput, i, true);
-  }
+  return vst;
+}
 
-  auto evt_in = vst->_vstPlug->getBusCount(kEvent, kInput);
-  for (int i = 0; i < evt_in; i++) {
-    vst->_vstPlug->activateBus(kEvent, kInput, i, true);
-  }
+const void *load_plugin_sandboxed(const char *s,
+                                  const void *plugin_sent_events_producer,
+                                  const char *worker_path) {
+  PluginInstance *vst = new PluginInstance();
+  TimelineSpan span("load_plugin_sandboxed", vst);
+  vst->plugin_sent_events_producer = plugin_sent_events_producer;
+  vst->path = s;
+  timeline_name_instance(vst, s);
+  vst->sandbox = std::make_unique<SandboxClient>();
 
-  // NOTE: Output event buses are not supported yet so they are not activated
+  if (!vst->sandbox->start(worker_path, s, vst)) {
+    delete vst;
+    return nullptr;
+  }
 
   return vst;
 }
 
+float *sandbox_channel_buffer(const void *app, bool output, uintptr_t channel) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (!vst->sandbox) {
+    return nullptr;
+  }
+  return vst->sandbox->channel_buffer(output, channel);
+}
+
 Dims show_gui(const void *app, const void *window_id) {
   PluginInstance *vst = (PluginInstance *)app;
+  TimelineSpan span("show_gui", vst);
+
+  if (vst->sandbox) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Editors are not supported for sandboxed plugins");
+    return {};
+  }
 
   return vst->createView((void *)window_id);
 }
 
 void hide_gui(const void *app) {
   PluginInstance *vst = (PluginInstance *)app;
+  if (!vst->_view) {
+    return;
+  }
   vst->_view->release();
   vst->_view = nullptr;
 }
@@ -568,28 +1135,137 @@ void hide_gui(const void *app) {
 FFIPluginDescriptor descriptor(const void *app) {
   PluginInstance *vst = (PluginInstance *)app;
 
+  if (vst->sandbox) {
+    return vst->sandbox->descriptor();
+  }
+
   FFIPluginDescriptor desc = {};
   desc.name = alloc_string(vst->name.c_str());
   desc.version = alloc_string(vst->version.c_str());
   desc.vendor = alloc_string(vst->vendor.c_str());
   desc.id = alloc_string(vst->id.c_str());
+  desc.initial_latency = (int)vst->_audioEffect->getLatencySamples();
 
   return desc;
 }
 
+uintptr_t get_latency(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->get_latency();
+  }
+  return vst->latency_samples.load() + vst->block_adapter.latency();
+}
+
+bool prefetchable(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->prefetchable();
+  }
+
+  FUnknownPtr<IPrefetchableSupport> support(vst->_vstPlug);
+  if (!support) {
+    return true;
+  }
+
+  PrefetchableSupport value = kIsYetPrefetchable;
+  if (support->getPrefetchableSupport(value) != kResultOk) {
+    return true;
+  }
+  return value == kIsYetPrefetchable;
+}
+
 void vst3_set_sample_rate(const void *app, int32_t rate) {
   PluginInstance *vst = (PluginInstance *)app;
+
+  if (vst->sandbox) {
+    vst->sandbox->set_sample_rate(rate);
+    return;
+  }
+
+  if (vst->queued_control.load()) {
+    ControlCommand command = {};
+    command.type = ControlCommandType::SetSampleRate;
+    command.value = rate;
+    vst->push_command(command);
+    return;
+  }
+
   vst->_processData.processContext->sampleRate = rate;
 }
 
+uintptr_t program_count(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->program_count();
+  }
+  return vst->program_cache.programs(vst->_editController).size();
+}
+
+const char *program_name(const void *app, uintptr_t index) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->program_name(index);
+  }
+
+  const auto &programs = vst->program_cache.programs(vst->_editController);
+  if (index >= programs.size()) {
+    return nullptr;
+  }
+  return alloc_string(programs[index].name.c_str());
+}
+
+bool set_program(const void *app, uintptr_t index) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->set_program(index);
+  }
+
+  const auto &programs = vst->program_cache.programs(vst->_editController);
+  if (index >= programs.size()) {
+    return false;
+  }
+
+  const ProgramEntry &program = programs[index];
+  if (program.param == kNoParamId) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Program %zu has no program change parameter", (size_t)index);
+    return false;
+  }
+
+  // Applied by the processor at the start of the next block like any other
+  // automation, and mirrored to the controller by `flush_param_updates`.
+  HostIssuedEvent event = {};
+  event.event_type.tag = HostIssuedEventType::Tag::Parameter;
+  event.event_type.parameter = {};
+  event.event_type.parameter._0.parameter_id = (int32_t)program.param;
+  event.event_type.parameter._0.current_value = (float)program.value;
+  event.event_type.parameter._0.end_edit = true;
+
+  EventTime time = {};
+  time.tag = EventTime::Tag::Samples;
+  time.samples = {};
+  time.samples._0 = vst->samples_processed.load(std::memory_order_relaxed);
+  return vst->event_scheduler.push(event, time);
+}
+
 const void *get_data(const void *app, int32_t *data_len, const void **stream) {
   PluginInstance *vst = (PluginInstance *)app;
+  TimelineSpan span("get_data", vst);
+
+  if (vst->sandbox) {
+    return vst->sandbox->get_data(data_len, stream);
+  }
+
+  // Make sure queued state changes are reflected in the returned state
+  vst->wait_for_commands();
 
   ResizableMemoryIBStream *stream_ = new ResizableMemoryIBStream();
   *stream = stream_;
 
   if (vst->_vstPlug->getState(stream_) != kResultOk) {
-    std::cout << "Failed to get plugin state. Non ok result." << std::endl;
+    wrapper_log(vst, LogLevel::Error,
+                "Failed to get plugin state. Non ok result.");
     return nullptr;
   }
 
@@ -607,6 +1283,14 @@ void free_data_stream(const void *stream) {
 
 void set_data(const void *app, const void *data, int32_t data_len) {
   PluginInstance *vst = (PluginInstance *)app;
+  TimelineSpan span("set_data", vst);
+
+  if (vst->sandbox) {
+    vst->sandbox->set_data(data, data_len);
+    return;
+  }
+
+  vst->free_retired_states();
 
   ResizableMemoryIBStream stream = {};
 
@@ -614,80 +1298,189 @@ void set_data(const void *app, const void *data, int32_t data_len) {
   stream.write((void *)data, data_len, &num_bytes_written);
   assert(data_len == num_bytes_written);
 
-  if (vst->_vstPlug->setState(&stream) != kResultOk) {
-    std::cout << "Failed to set plugin state" << std::endl;
+  if (vst->queued_control.load()) {
+    ControlCommand command = {};
+    command.type = ControlCommandType::SetState;
+    command.state = new ResizableMemoryIBStream();
+    command.state->write((void *)data, data_len, &num_bytes_written);
+    vst->push_command(command);
+  } else {
+    stream.rewind();
+    if (vst->_vstPlug->setState(&stream) != kResultOk) {
+      wrapper_log(vst, LogLevel::Error, "Failed to set plugin state");
+    }
   }
 
   stream.rewind();
   vst->_editController->setComponentState(&stream);
 }
 
-void process(const void *app, const ProcessDetails *data, float ***input,
-             float ***output, HostIssuedEvent *events, int32_t events_len) {
-  PluginInstance *vst = (PluginInstance *)app;
+// Returns false if the event didn't fit the block's event list.
+static bool add_midi_event(PluginInstance *vst,
+                           Steinberg::Vst::EventList *eventList, int midi_bus,
+                           const HostIssuedEvent &event) {
+  Steinberg::Vst::Event evt = {};
+  evt.busIndex = midi_bus;
+  evt.sampleOffset = event.block_time;
+  evt.ppqPosition = event.ppq_time;
+  // evt.flags = Steinberg::Vst::Event::EventFlags::kIsLive;
+
+  // The low nibble of the status byte is the channel, and a note on with zero
+  // velocity is a note off
+  const uint8_t *midi_data = event.event_type.midi._0.midi_data;
+  uint8_t status = midi_data[0] & 0xf0;
+  int16 channel = midi_data[0] & 0x0f;
+  bool is_note_on = status == 0x90 && midi_data[2] != 0;
+  bool is_note_off = status == 0x80 || (status == 0x90 && midi_data[2] == 0);
+
+  if (is_note_on) {
+    vst->held_notes++;
+    evt.type = Steinberg::Vst::Event::EventTypes::kNoteOnEvent;
+    evt.noteOn.channel = channel;
+    evt.noteOn.pitch = midi_data[1];
+    evt.noteOn.tuning = event.event_type.midi._0.detune;
+    evt.noteOn.velocity = midi_data[2];
+    evt.noteOn.length = 0;
+    evt.noteOn.noteId = -1;
+  } else if (is_note_off) {
+    if (vst->held_notes > 0) {
+      vst->held_notes--;
+    }
+    evt.type = Steinberg::Vst::Event::EventTypes::kNoteOffEvent;
+    evt.noteOff.channel = channel;
+    evt.noteOff.pitch = midi_data[1];
+    evt.noteOff.tuning = event.event_type.midi._0.detune;
+    evt.noteOff.velocity = midi_data[2];
+    evt.noteOff.noteId = -1;
+  }
+  return eventList->addEvent(evt) == kResultOk;
+}
 
-  auto audio_inputs = vst->_io_config.audio_inputs.count;
-  auto audio_outputs = vst->_io_config.audio_outputs.count;
+static void add_parameter_change(PluginInstance *vst,
+                                 const HostIssuedEvent &event) {
+  auto changes = vst->_processData.inputParameterChanges;
+  if (!changes) {
+    return;
+  }
 
-  vst->_processData.numSamples = data->block_size;
+  auto time = event.block_time;
+  auto id = event.event_type.parameter._0.parameter_id;
+  auto value = event.event_type.parameter._0.current_value;
+
+  // Every point a block carries for a parameter goes into one queue, which
+  // the plugin interpolates. Queues reused from an earlier block still hold
+  // its points.
+  int32 used_queues = changes->getParameterCount();
+  int queue_index = 0;
+  auto queue = changes->addParameterData(id, queue_index);
+  if (!queue) {
+    wrapper_log(vst, LogLevel::Warning, "Failed to set parameter");
+    return;
+  }
+  if (queue_index >= used_queues) {
+    static_cast<ParameterValueQueue *>(queue)->clear();
+  }
 
-  for (int i = 0; i < audio_inputs; i++) {
-    vst->_processData.inputs->channelBuffers32 = input[i];
+  int point_index = 0;
+  if (queue->addPoint(time, value, point_index) != kResultOk) {
+    wrapper_log(vst, LogLevel::Warning, "Failed to set parameter");
   }
 
-  for (int i = 0; i < audio_outputs; i++) {
-    vst->_processData.outputs[i].channelBuffers32 = output[i];
+  if (!std::isnan(value)) {
+    vst->param_sync.mark(id, value);
   }
+}
 
-  // if (vst->numBuses(kAudio, kOutput) > 0) {
-  //   vst->_processData.outputs->channelBuffers32 = output;
-  // }
-  // if (vst->numBuses(kAudio, kInput) > 0) {
-  //   vst->_processData.inputs->channelBuffers32 = input;
-  // }
+// Input and output channels of the single input and output bus of a
+// specialised layout.
+template <BusLayout Layout> struct LayoutChannels;
+template <> struct LayoutChannels<BusLayout::Mono> {
+  static const int32_t inputs = 1, outputs = 1;
+};
+template <> struct LayoutChannels<BusLayout::Stereo> {
+  static const int32_t inputs = 2, outputs = 2;
+};
+template <> struct LayoutChannels<BusLayout::Instrument> {
+  static const int32_t inputs = 0, outputs = 2;
+};
 
-  Steinberg::uint32 state = 0;
+// One block of processing. `Layout` and `Midi` are fixed per IO configuration
+// by `select_process_kernel`, so the common layouts skip the per-bus loops and
+// instances without an event input never look at MIDI.
+template <BusLayout Layout, bool Midi>
+static void process_block_kernel(PluginInstance *vst,
+                                 const ProcessDetails *data, float ***input,
+                                 float ***output, HostIssuedEvent *events,
+                                 int32_t events_len) {
+  TimelineSpan span("process_block", vst);
+  AudioCallbackScope audio_callback;
+  uint64_t block_start = vst->samples_processed.load(std::memory_order_relaxed);
+  vst->samples_processed.store(block_start + data->block_size,
+                               std::memory_order_relaxed);
+  events =
+      vst->event_scheduler.schedule(data, block_start, events, events_len);
 
-  Steinberg::Vst::ProcessContext *ctx = vst->_processData.processContext;
+  vst->_processData.numSamples = data->block_size;
 
-  vst->_processData.processContext->tempo = data->tempo;
-  state |= ctx->kTempoValid;
+  bool inputs_silent;
+  if constexpr (Layout == BusLayout::Any) {
+    auto audio_inputs = vst->_io_config.audio_inputs.count;
+    auto audio_outputs = vst->_io_config.audio_outputs.count;
 
-  vst->_processData.processContext->timeSigNumerator =
-      data->time_signature_numerator;
-  vst->_processData.processContext->timeSigDenominator =
-      data->time_signature_denominator;
-  state |= ctx->kTimeSigValid;
+    for (int i = 0; i < audio_inputs; i++) {
+      vst->_processData.inputs[i].channelBuffers32 = input[i];
+    }
 
-  vst->_processData.processContext->projectTimeMusic = data->player_time;
+    for (int i = 0; i < audio_outputs; i++) {
+      vst->_processData.outputs[i].channelBuffers32 = output[i];
+      vst->_processData.outputs[i].silenceFlags = 0;
+    }
 
-  vst->_processData.processContext->projectTimeSamples =
-      (data->player_time / (data->tempo / 60.0)) * data->sample_rate;
+    inputs_silent = vst->scan_input_silence();
+  } else {
+    using Channels = LayoutChannels<Layout>;
+
+    if constexpr (Channels::inputs > 0) {
+      AudioBusBuffers &bus = vst->_processData.inputs[0];
+      bus.channelBuffers32 = input[0];
+      bus.silenceFlags = silence_flags(input[0], Channels::inputs,
+                                       (int32_t)data->block_size);
+      inputs_silent =
+          bus.silenceFlags == all_channels_mask(Channels::inputs);
+    } else {
+      inputs_silent = true;
+    }
 
-  // TODO
-  // vst->_processData.processContext->barPositionMusic = data.barPosBeats;
-  state |= ctx->kBarPositionValid;
+    vst->_processData.outputs[0].channelBuffers32 = output[0];
+    vst->_processData.outputs[0].silenceFlags = 0;
+  }
 
-  vst->_processData.processContext->cycleStartMusic = data->cycle_start;
-  vst->_processData.processContext->cycleEndMusic = data->cycle_end;
-  state |= ctx->kCycleValid;
+  // Built even for blocks slept through, so the sample position history
+  // stays continuous
+  Steinberg::Vst::ProcessContext *ctx = vst->_processData.processContext;
+  vst->transport.context(data, vst->context_requirements, *ctx);
 
-  vst->_processData.processContext->systemTime = data->nanos;
-  state |= ctx->kSystemTimeValid;
+  bool transport_changed = data->playing_state != vst->last_playing_state ||
+                           data->tempo != vst->last_tempo;
+  vst->last_playing_state = data->playing_state;
+  vst->last_tempo = data->tempo;
 
-  vst->_processData.processContext->frameRate.framesPerSecond = 60.;
-  vst->_processData.processContext->frameRate.flags = 0;
+  bool idle = inputs_silent && events_len == 0 && vst->held_notes == 0 &&
+              !transport_changed;
 
-  if (data->cycle_enabled) {
-    state |= ctx->kCycleActive;
+  if (idle && vst->can_sleep()) {
+    vst->silence_outputs();
+    vst->silent_input_samples += data->block_size;
+    vst->sleeping = true;
+    return;
   }
 
-  if (data->playing_state != PlayingState::Stopped) {
-    state |= ctx->kPlaying;
-  }
+  vst->sleeping = false;
 
-  if (data->playing_state == PlayingState::Recording) {
-    state |= ctx->kRecording;
+  if (vst->context_requirements &
+      IProcessContextRequirements::kNeedContinousTimeSamples) {
+    ctx->continousTimeSamples = (TSamples)block_start;
+    ctx->state |= ctx->kContTimeValid;
   }
 
   if (data->playing_state == PlayingState::OfflineRendering) {
@@ -696,86 +1489,481 @@ void process(const void *app, const ProcessDetails *data, float ***input,
     vst->_processData.processMode = kRealtime;
   }
 
-  vst->_processData.processContext->state = state;
-
   int midi_bus = 0;
   Steinberg::Vst::EventList *eventList = nullptr;
-  if (vst->_io_config.event_inputs_count > 0) {
+  if constexpr (Midi) {
     eventList = vst->eventList(Steinberg::Vst::kInput, midi_bus);
-    for (int i = 0; i < events_len; i++) {
-      if (events[i].event_type.tag != HostIssuedEventType::Tag::Midi)
-        continue;
+  }
 
-      Steinberg::Vst::Event evt = {};
-      evt.busIndex = midi_bus;
-      evt.sampleOffset = events[i].block_time;
-      evt.ppqPosition = events[i].ppq_time;
-      // evt.flags = Steinberg::Vst::Event::EventFlags::kIsLive;
-
-      bool is_note_on = events[i].event_type.midi._0.midi_data[0] == 0x90;
-      bool is_note_off = events[i].event_type.midi._0.midi_data[0] == 0x80;
-
-      if (is_note_on) {
-        evt.type = Steinberg::Vst::Event::EventTypes::kNoteOnEvent;
-        evt.noteOn.channel = 0;
-        evt.noteOn.pitch = events[i].event_type.midi._0.midi_data[1];
-        evt.noteOn.tuning = events[i].event_type.midi._0.detune;
-        evt.noteOn.velocity = events[i].event_type.midi._0.midi_data[2];
-        evt.noteOn.length = 0;
-        evt.noteOn.noteId = -1;
-      } else if (is_note_off) {
-        evt.type = Steinberg::Vst::Event::EventTypes::kNoteOffEvent;
-        evt.noteOff.channel = 0;
-        evt.noteOff.pitch = events[i].event_type.midi._0.midi_data[1];
-        evt.noteOff.tuning = events[i].event_type.midi._0.detune;
-        evt.noteOff.velocity = events[i].event_type.midi._0.midi_data[2];
-        evt.noteOff.noteId = -1;
+  int dropped_midi = 0;
+  for (int i = 0; i < events_len; i++) {
+    switch (events[i].event_type.tag) {
+    case HostIssuedEventType::Tag::Midi:
+      if constexpr (Midi) {
+        if (!add_midi_event(vst, eventList, midi_bus, events[i])) {
+          dropped_midi++;
+        }
       }
-      eventList->addEvent(evt);
+      break;
+    case HostIssuedEventType::Tag::Parameter:
+      add_parameter_change(vst, events[i]);
+      break;
     }
   }
+  if (dropped_midi > 0) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Dropped %d MIDI events over the block's capacity of %d",
+                dropped_midi,
+                midi_event_capacity(vst->_processSetup.maxSamplesPerBlock));
+  }
 
-  for (int i = 0; i < events_len; i++) {
-    if (events[i].event_type.tag != HostIssuedEventType::Tag::Parameter)
-      continue;
+  tresult result = vst->_audioEffect->process(vst->_processData);
+  if (result != kResultOk) {
+    wrapper_log(vst, LogLevel::Error, "Failed to process");
+  }
+
+  vst->last_output_silent = vst->outputs_silent();
+  if (idle) {
+    vst->silent_input_samples += data->block_size;
+  } else {
+    vst->silent_input_samples = 0;
+  }
+
+  if constexpr (Midi) {
+    eventList->clear();
+  }
+  if (vst->_processData.inputParameterChanges) {
+    static_cast<ParameterChanges *>(vst->_processData.inputParameterChanges)
+        ->clearQueue();
+  }
+}
+
+static BusLayout bus_layout(const IOConfigutaion &io) {
+  if (io.audio_outputs.count != 1) {
+    return BusLayout::Any;
+  }
+
+  uintptr_t outputs = io.audio_outputs.data[0].value.channels;
+  if (io.audio_inputs.count == 0) {
+    return outputs == 2 ? BusLayout::Instrument : BusLayout::Any;
+  }
+
+  if (io.audio_inputs.count != 1 ||
+      io.audio_inputs.data[0].value.channels != outputs) {
+    return BusLayout::Any;
+  }
+
+  switch (outputs) {
+  case 1:
+    return BusLayout::Mono;
+  case 2:
+    return BusLayout::Stereo;
+  default:
+    return BusLayout::Any;
+  }
+}
+
+template <BusLayout Layout>
+static ProcessKernel process_kernel_for(bool midi) {
+  return midi ? process_block_kernel<Layout, true>
+              : process_block_kernel<Layout, false>;
+}
+
+void PluginInstance::select_process_kernel() {
+  bool midi = _io_config.event_inputs_count > 0;
+  switch (bus_layout(_io_config)) {
+  case BusLayout::Mono:
+    process_kernel = process_kernel_for<BusLayout::Mono>(midi);
+    break;
+  case BusLayout::Stereo:
+    process_kernel = process_kernel_for<BusLayout::Stereo>(midi);
+    break;
+  case BusLayout::Instrument:
+    process_kernel = process_kernel_for<BusLayout::Instrument>(midi);
+    break;
+  case BusLayout::Any:
+    process_kernel = process_kernel_for<BusLayout::Any>(midi);
+    break;
+  }
+}
+
+static void process_block(PluginInstance *vst, const ProcessDetails *data,
+                          float ***input, float ***output,
+                          HostIssuedEvent *events, int32_t events_len) {
+  vst->process_kernel(vst, data, input, output, events, events_len);
+}
+
+// Runs `process_block` directly, or through the instance's fixed block adapter.
+static void process_adapted(PluginInstance *vst, const ProcessDetails *data,
+                            float ***input, float ***output,
+                            HostIssuedEvent *events, int32_t events_len) {
+  if (!vst->block_adapter.enabled()) {
+    process_block(vst, data, input, output, events, events_len);
+    return;
+  }
+
+  uint32_t dropped = vst->block_adapter.process(
+      data, input, output, events, events_len,
+      [vst](const ProcessDetails *block, float ***block_input,
+            float ***block_output, HostIssuedEvent *block_events,
+            int32_t block_events_len) {
+        process_block(vst, block, block_input, block_output, block_events,
+                      block_events_len);
+      });
+  if (dropped > 0) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Dropped %u events buffered for the next fixed block", dropped);
+  }
+
+  // Silence flags describe the plugin's own blocks, not the delayed audio
+  // handed back to the host
+  for (uintptr_t i = 0; i < vst->_io_config.audio_outputs.count; i++) {
+    vst->_processData.outputs[i].silenceFlags = 0;
+  }
+}
+
+bool process(const void *app, const ProcessDetails *data, float ***input,
+             float ***output, HostIssuedEvent *events, int32_t events_len) {
+  PluginInstance *vst = (PluginInstance *)app;
+  TimelineSpan span("process", vst);
+
+  vst->recorder.record(data, input, events, events_len);
+
+  if (vst->sandbox) {
+    vst->sandbox->process(data, input, output, events, events_len);
+    return true;
+  }
+
+  if (vst->queued_control.load(std::memory_order_acquire)) {
+    if (vst->process_busy.exchange(true, std::memory_order_acquire)) {
+      return false;
+    }
+    vst->apply_commands();
+    process_adapted(vst, data, input, output, events, events_len);
+    vst->process_busy.store(false, std::memory_order_release);
+    return true;
+  }
 
-    if (!vst->_processData.inputParameterChanges) {
-      vst->_processData.inputParameterChanges = new ParameterChanges(400);
+  vst->apply_commands();
+  process_adapted(vst, data, input, output, events, events_len);
+  return true;
+}
+
+bool start_capture(const void *app, const char *path, bool include_state) {
+  PluginInstance *vst = (PluginInstance *)app;
+
+  TraceHeader header = {};
+  header.plugin_path = vst->path;
+
+  IOConfigutaion config = io_config(app);
+  for (uintptr_t i = 0; i < config.audio_inputs.count; i++) {
+    header.input_channels.push_back(
+        (uint32_t)config.audio_inputs.data[i].value.channels);
+  }
+  for (uintptr_t i = 0; i < config.audio_outputs.count; i++) {
+    header.output_channels.push_back(
+        (uint32_t)config.audio_outputs.data[i].value.channels);
+  }
+
+  if (include_state) {
+    int32_t len = 0;
+    const void *stream = nullptr;
+    const void *data = get_data(app, &len, &stream);
+    if (data) {
+      header.state.assign((const uint8_t *)data, (const uint8_t *)data + len);
+    }
+    if (stream) {
+      free_data_stream(stream);
     }
+  }
+
+  if (!vst->recorder.start(path, header)) {
+    wrapper_log(vst, LogLevel::Error, "Failed to open capture file %s", path);
+    return false;
+  }
+  return true;
+}
+
+void stop_capture(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  vst->recorder.stop();
+}
 
-    auto changes = vst->_processData.inputParameterChanges;
+void PluginInstance::push_command(const ControlCommand &command) {
+  while (!commands.push(command)) {
+    std::this_thread::yield();
+  }
+  commands_pushed.fetch_add(1, std::memory_order_release);
+}
 
-    auto time = events[i].block_time;
-    auto id = events[i].event_type.parameter._0.parameter_id;
-    auto value = events[i].event_type.parameter._0.current_value;
+void PluginInstance::apply_commands() {
+  ControlCommand command = {};
+  while (commands.pop(command)) {
+    switch (command.type) {
+    case ControlCommandType::SetProcessing:
+      _audioEffect->setProcessing(command.enabled);
+      processing = command.enabled;
+      break;
+    case ControlCommandType::SetState:
+      command.state->rewind();
+      if (_vstPlug->setState(command.state) != kResultOk) {
+        wrapper_log(this, LogLevel::Error, "Failed to set plugin state");
+      }
+      if (!retired_states.push(command.state)) {
+        delete command.state;
+      }
+      break;
+    case ControlCommandType::SetSampleRate:
+      _processData.processContext->sampleRate = command.value;
+      break;
+    case ControlCommandType::SetAutoSleep:
+      auto_sleep = command.enabled;
+      break;
+    }
+    commands_applied.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void PluginInstance::exclude_process() {
+  if (!queued_control.load()) {
+    return;
+  }
+  // Blocks are short, so this waits at most one block
+  while (process_busy.exchange(true, std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
 
-    int queue_index = 0;
-    auto queue = changes->addParameterData(id, queue_index);
+void PluginInstance::allow_process() {
+  if (queued_control.load()) {
+    process_busy.store(false, std::memory_order_release);
+  }
+}
 
-    auto q = static_cast<ParameterValueQueue *>(queue);
-    q->clear();
+void PluginInstance::sync_commands() {
+  exclude_process();
+  apply_commands();
+  allow_process();
+}
 
-    int point_index = 0;
-    if (queue->addPoint(time, value, point_index) != kResultOk) {
-      std::cout << "Failed to set parameter" << std::endl;
+// Longer than the largest block at common sample rates. A host that hasn't
+// processed for that long has stopped, so the queue is applied here instead.
+const auto COMMAND_SYNC_TIMEOUT = std::chrono::milliseconds(250);
+
+void PluginInstance::wait_for_commands() {
+  uint64_t target = commands_pushed.load(std::memory_order_acquire);
+  auto deadline = std::chrono::steady_clock::now() + COMMAND_SYNC_TIMEOUT;
+  while (commands_applied.load(std::memory_order_acquire) < target) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      sync_commands();
+      return;
     }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
+}
 
-  tresult result = vst->_audioEffect->process(vst->_processData);
-  if (result != kResultOk) {
-    std::cout << "Failed to process" << std::endl;
+void PluginInstance::free_retired_states() {
+  ResizableMemoryIBStream *state = nullptr;
+  while (retired_states.pop(state)) {
+    delete state;
   }
+}
 
-  if (eventList) {
-    eventList->clear();
+void set_realtime_priority() {
+#ifdef _WIN32
+  bool raised =
+      SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+  sched_param param = {};
+  param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+  bool raised =
+      pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+  if (!raised) {
+    wrapper_log(nullptr, LogLevel::Warning,
+                "Failed to raise process thread priority");
+  }
+}
+
+void set_queued_control(const void *app, bool enabled) {
+  PluginInstance *vst = (PluginInstance *)app;
+
+  if (vst->sandbox) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Sandboxed plugins are processed on their worker's thread");
+    return;
+  }
+
+  if (enabled) {
+    vst->queued_control.store(true, std::memory_order_release);
+    return;
   }
+
+  // Commands still queued are applied before switching back
+  vst->exclude_process();
+  vst->apply_commands();
+  vst->queued_control.store(false);
+  vst->process_busy.store(false, std::memory_order_release);
+  vst->free_retired_states();
 }
 
-void set_param_in_edit_controller(const void *app, int32_t id, float value) {
+void set_auto_sleep(const void *app, bool enabled) {
   PluginInstance *vst = (PluginInstance *)app;
 
-  if (vst->_editController->setParamNormalized(id, value) != kResultOk) {
-    std::cout << "Failed to set parameter normalized" << std::endl;
+  if (vst->sandbox) {
+    vst->sandbox->set_auto_sleep(enabled);
+    return;
+  }
+
+  if (vst->queued_control.load()) {
+    ControlCommand command = {};
+    command.type = ControlCommandType::SetAutoSleep;
+    command.enabled = enabled;
+    vst->push_command(command);
+    return;
+  }
+
+  vst->auto_sleep = enabled;
+}
+
+bool set_fixed_block_size(const void *app, uint32_t block_size) {
+  PluginInstance *vst = (PluginInstance *)app;
+
+  if (vst->sandbox) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Fixed block sizes are not supported for sandboxed plugins");
+    return false;
+  }
+
+  if (block_size > (uint32_t)vst->_processSetup.maxSamplesPerBlock) {
+    wrapper_log(vst, LogLevel::Error,
+                "Fixed block size %u exceeds the maximum of %d", block_size,
+                vst->_processSetup.maxSamplesPerBlock);
+    return false;
+  }
+
+  vst->exclude_process();
+  vst->block_adapter.configure(block_size, vst->_io_config);
+  vst->allow_process();
+
+  PluginIssuedEvent event = {};
+  event.tag = PluginIssuedEvent::Tag::ChangeLatency;
+  event.change_latency = {};
+  event.change_latency._0 = get_latency(app);
+  send_event_to_host(&event, vst->plugin_sent_events_producer);
+  return true;
+}
+
+bool set_max_block_size(const void *app, uint32_t max_block_size) {
+  PluginInstance *vst = (PluginInstance *)app;
+
+  if (vst->sandbox) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Max block sizes are fixed for sandboxed plugins");
+    return false;
+  }
+
+  if (max_block_size == 0 || max_block_size > MAX_BLOCK_SIZE ||
+      max_block_size < vst->block_adapter.latency()) {
+    wrapper_log(vst, LogLevel::Error, "Invalid max block size %u",
+                max_block_size);
+    return false;
+  }
+
+  vst->exclude_process();
+  vst->apply_commands();
+
+  if (vst->processing) {
+    vst->_audioEffect->setProcessing(false);
+  }
+  vst->_vstPlug->setActive(false);
+  vst->_processSetup.maxSamplesPerBlock = max_block_size;
+  bool ok = vst->_audioEffect->setupProcessing(vst->_processSetup) == kResultOk;
+  if (!ok) {
+    wrapper_log(vst, LogLevel::Error, "Failed to setup VST processing");
+  }
+  if (vst->_processData.inputEvents) {
+    vst->eventList(kInput, 0)->setMaxSize(midi_event_capacity(max_block_size));
+  }
+  vst->_vstPlug->setActive(true);
+  if (vst->processing) {
+    vst->_audioEffect->setProcessing(true);
+  }
+
+  vst->allow_process();
+  return ok;
+}
+
+MemoryUsage memory_usage(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  return vst->memory_usage();
+}
+
+uint64_t output_silence_flags(const void *app, uintptr_t bus) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->output_silence_flags(bus);
+  }
+  if (bus >= (uintptr_t)vst->_processData.numOutputs) {
+    return 0;
+  }
+  return vst->_processData.outputs[bus].silenceFlags;
+}
+
+bool queue_event(const void *app, const HostIssuedEvent *event,
+                 EventTime time) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->queue_event(*event, time);
+  }
+  return vst->event_scheduler.push(*event, time);
+}
+
+uint64_t sample_position(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    return vst->sandbox->sample_position();
+  }
+  return vst->samples_processed.load(std::memory_order_relaxed);
+}
+
+void apply_restart(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  TimelineSpan span("apply_restart", vst);
+  if (vst->sandbox) {
+    vst->sandbox->apply_restart();
+    return;
+  }
+  vst->apply_restart();
+}
+
+void flush_param_updates(const void *app) {
+  PluginInstance *vst = (PluginInstance *)app;
+  if (vst->sandbox) {
+    vst->sandbox->flush_param_updates(vst->plugin_sent_events_producer);
+    return;
+  }
+  if (!vst->_editController) {
+    return;
+  }
+
+  vst->param_sync.flush([&](uint32_t id, float value) {
+    if (vst->_editController->setParamNormalized(id, value) != kResultOk) {
+      wrapper_log(vst, LogLevel::Warning, "Failed to set parameter normalized");
+    }
+  });
+
+  uint32_t dropped = 0;
+  if (vst->to_controller) {
+    dropped += vst->to_controller->deliver();
+  }
+  if (vst->to_component) {
+    dropped += vst->to_component->deliver();
+  }
+  if (dropped > 0) {
+    wrapper_log(vst, LogLevel::Warning,
+                "Dropped %u plugin messages sent from the audio thread",
+                dropped);
   }
 }
 
@@ -786,8 +1974,15 @@ ParameterFFI get_parameter(const void *app, int32_t id) {
 
   PluginInstance *vst = (PluginInstance *)app;
 
-  ParameterInfo param_info = {};
-  vst->_editController->getParameterInfo(id, param_info);
+  if (vst->sandbox) {
+    return vst->sandbox->get_parameter(id);
+  }
+
+  const std::vector<ParameterInfo> &infos = vst->parameter_infos();
+  if (id < 0 || (size_t)id >= infos.size()) {
+    return {};
+  }
+  const ParameterInfo &param_info = infos[id];
 
   vst->parameter_indicies[param_info.id] = id;
 
@@ -806,7 +2001,8 @@ ParameterFFI get_parameter(const void *app, int32_t id) {
   TChar formatted_value[128] = {};
   if (vst->_editController->getParamStringByValue(
           param_info.id, value, formatted_value) != kResultOk) {
-    std::cout << "Failed to get parameter value by string" << std::endl;
+    wrapper_log(vst, LogLevel::Warning,
+                "Failed to get parameter value by string");
   }
 
   std::string formatted_value_c_str = {};
@@ -833,10 +2029,17 @@ ParameterFFI get_parameter(const void *app, int32_t id) {
 IOConfigutaion io_config(const void *app) {
   PluginInstance *vst = (PluginInstance *)app;
 
-  return vst->get_io_config();
+  if (vst->sandbox) {
+    return vst->sandbox->io_config();
+  }
+
+  return vst->_io_config;
 }
 
 uintptr_t parameter_count(const void *app) {
   auto vst = (PluginInstance *)app;
-  return vst->_editController->getParameterCount();
+  if (vst->sandbox) {
+    return vst->sandbox->parameter_count();
+  }
+  return vst->parameter_infos().size();
 };
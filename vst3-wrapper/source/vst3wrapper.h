@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 
@@ -9,11 +11,44 @@
 
 #include "memoryibstream.h"
 #include <pluginterfaces/gui/iplugview.h>
+#include <pluginterfaces/vst/ivstprefetchablesupport.h>
 #include <public.sdk/source/vst/hosting/eventlist.h>
 #include <public.sdk/source/vst/hosting/parameterchanges.h>
 #include <public.sdk/source/vst/hosting/processdata.h>
 
 #include "bindings.h"
+#include "blockadapter.h"
+#include "capture.h"
+#include "controlqueue.h"
+#include "eventscheduler.h"
+#include "logring.h"
+#include "messageproxy.h"
+#include "moduleregistry.h"
+#include "paramsync.h"
+#include "programs.h"
+#include "runloop.h"
+#include "sandbox.h"
+#include "silence.h"
+#include "timeline.h"
+#include "transport.h"
+
+// Gives access to the SDK's own component/controller connection so it can be
+// replaced with `MessageProxy`s.
+class WrapperPlugProvider : public Steinberg::Vst::PlugProvider {
+public:
+  using PlugProvider::PlugProvider;
+  bool disconnect_components() { return disconnectComponents(); }
+};
+
+// Bus layouts with their own specialised process kernel. Mono and Stereo have
+// one input and one output bus of that width, Instrument a single stereo
+// output.
+enum class BusLayout { Any, Mono, Stereo, Instrument };
+
+class PluginInstance;
+using ProcessKernel = void (*)(PluginInstance *vst, const ProcessDetails *data,
+                               float ***input, float ***output,
+                               HostIssuedEvent *events, int32_t events_len);
 
 struct ParameterChange {
   int id;
@@ -35,25 +70,145 @@ public:
   bool init(const std::string &path);
   void destroy();
 
+  // Bus layout as last read from the plugin, so queries don't walk the buses.
   IOConfigutaion _io_config;
+  // Reads the bus layout and configures processing for it.
   IOConfigutaion get_io_config();
+  IOConfigutaion read_io_config();
+  void apply_io_config(const IOConfigutaion &io_config);
+  // Re-reads the bus layout after an IO change. Only deactivates the plugin
+  // and rebuilds `_processData` if the layout changed, or for a `reload`.
+  // Returns true if it changed.
+  bool reconfigure_buses(bool reload);
+  void activate_buses();
+
+  // `restartComponent` only records its flags, as plugins call it from any
+  // thread. `apply_restart` then redoes only the work they call for, on the
+  // UI thread with processing excluded.
+  std::atomic<Steinberg::int32> pending_restart{0};
+  void apply_restart();
+
+  // Reads the parameter list afresh and sizes `param_sync` and
+  // `parameter_indicies` for it.
+  void init_parameters();
+
+  // Cached on first use and after `kParamTitlesChanged`. Values are always
+  // read from the controller.
+  const std::vector<Steinberg::Vst::ParameterInfo> &parameter_infos();
+  std::vector<Steinberg::Vst::ParameterInfo> parameter_info_cache;
+  bool parameter_infos_valid = false;
+
+  // Reported by the plugin, without the block adapter's latency.
+  std::atomic<Steinberg::uint32> latency_samples{0};
+
+  // Last `setProcessing` state, restored after reconfiguring.
+  bool processing = false;
+
+  // Processes one block. Chosen for the IO configuration by
+  // `select_process_kernel` whenever it changes.
+  ProcessKernel process_kernel = nullptr;
+  void select_process_kernel();
 
   Steinberg::Vst::ProcessContext *processContext();
 
+  // Sets up `_processData` with the event and parameter lists handed to the
+  // plugin, sized for its buses and parameters.
+  void prepare_process_data();
+  void unprepare_process_data();
+
+  // Bytes allocated by the wrapper for this instance.
+  MemoryUsage memory_usage();
+
   Steinberg::Vst::EventList *eventList(Steinberg::Vst::BusDirection direction,
                                        int which);
   Steinberg::Vst::ParameterChanges *
   parameterChanges(Steinberg::Vst::BusDirection direction, int which);
 
+  // Creates the instance with `module_lock` held, releasing it once only
+  // this instance is touched.
   bool load_plugin_from_class(VST3::Hosting::PluginFactory &factory,
-                              VST3::Hosting::ClassInfo &classInfo);
+                              VST3::Hosting::ClassInfo &classInfo,
+                              std::unique_lock<std::mutex> &module_lock);
 
   Dims createView(void *window_id);
 
+  // Sets input silence flags and returns true if every input channel is
+  // silent for the current block.
+  bool scan_input_silence();
+  bool outputs_silent();
+  bool can_sleep();
+  void silence_outputs();
+
+  // Auto sleep, off until the host enables it: once inputs have been silent
+  // for longer than the plugin's tail, `process` skips the plugin and outputs
+  // flagged silence.
+  bool auto_sleep = false;
+  bool sleeping = false;
+  bool last_output_silent = false;
+  Steinberg::uint32 tail_samples = 0;
+  Steinberg::int64 silent_input_samples = 0;
+  int held_notes = 0;
+  // The transport state of the last block; any change wakes the plugin.
+  PlayingState last_playing_state = PlayingState::Stopped;
+  Tempo last_tempo = 0.0;
+
+  // Set for instances loaded with `load_plugin_sandboxed`. The plugin then
+  // lives in a worker process and every FFI call is forwarded to it.
+  std::unique_ptr<SandboxClient> sandbox;
+
+  // Set by `set_queued_control`. Control operations are then queued and
+  // applied at the start of the next block by whichever thread processes it.
+  std::atomic<bool> queued_control{false};
+  CommandQueue commands;
+  RetiredStateQueue retired_states;
+
+  // Held by `process` for each block, and by the control side while it needs
+  // the instance to itself. `process` only ever tries to take it and skips the
+  // block if it can't, so the audio thread never waits on the control side.
+  std::atomic<bool> process_busy{false};
+  void exclude_process();
+  void allow_process();
+
+  void push_command(const ControlCommand &command);
+  void apply_commands();
+  // Applies every queued command before returning.
+  void sync_commands();
+  // Waits for the processing thread to apply every command queued so far,
+  // without taking the instance from it.
+  void wait_for_commands();
+  void free_retired_states();
+  // Counts commands pushed and applied, so `wait_for_commands` knows when the
+  // processing thread has caught up.
+  std::atomic<uint64_t> commands_pushed{0};
+  std::atomic<uint64_t> commands_applied{0};
+
   Steinberg::Vst::HostProcessData _processData = {};
+  // The SDK's channel pointer arrays. Processing swaps in the host's, so these
+  // are put back before `unprepare` frees them.
+  std::vector<Steinberg::Vst::Sample32 **> prepared_inputs, prepared_outputs;
+  int32_t parameter_queues = 0;
 
   std::unordered_map<Steinberg::Vst::ParamID, int> parameter_indicies = {};
 
+  // Events queued from other threads for future blocks, and the instance's
+  // sample clock they are scheduled against.
+  EventScheduler event_scheduler;
+  std::atomic<uint64_t> samples_processed{0};
+
+  // Set by `set_fixed_block_size` to feed the plugin constant blocks.
+  FixedBlockAdapter block_adapter;
+
+  // Program lists of the plugin's units, for `program_name` and
+  // `set_program`.
+  ProgramCache program_cache;
+
+  // Records every block passed to `process` while a capture is running.
+  ProcessRecorder recorder;
+
+  // Automation applied by `process`, waiting to be mirrored to the edit
+  // controller by `flush_param_updates`.
+  ParameterSync param_sync;
+
   void _destroy(bool decrementRefCount);
 
   std::vector<Steinberg::Vst::BusInfo> _inAudioBusInfos, _outAudioBusInfos;
@@ -72,16 +227,27 @@ public:
   Steinberg::IPtr<Steinberg::Vst::IAudioProcessor> _audioEffect = nullptr;
   Steinberg::IPtr<Steinberg::Vst::IEditController> _editController = nullptr;
 
+  // Component to controller messages, and controller to component.
+  Steinberg::IPtr<MessageProxy> to_controller = nullptr;
+  Steinberg::IPtr<MessageProxy> to_component = nullptr;
+  void connect_message_proxies();
+  void disconnect_message_proxies();
+
   void *component_handler = nullptr;
 
   Steinberg::Vst::ProcessSetup _processSetup = {};
   Steinberg::Vst::ProcessContext _processContext = {};
+  // `IProcessContextRequirements` flags for the fields copied from the
+  // transport into `_processContext`.
+  Steinberg::uint32 context_requirements = ALL_PROCESS_CONTEXT_REQUIREMENTS;
+  TransportEngine transport;
 
   Steinberg::IPtr<Steinberg::IPlugView> _view = nullptr;
 
   std::vector<ParameterEditState> param_edits;
   std::mutex param_edits_mutex;
 
+  std::string path;
   std::string name;
   std::string vendor;
   std::string version;
@@ -89,6 +255,21 @@ public:
 
   const void *plugin_sent_events_producer = nullptr;
 
+  LogLimiter log_limiter;
+
   static Steinberg::Vst::HostApplication *_standardPluginContext;
   static int _standardPluginContextRefCount;
+  // Guards the context and its count, as instances load in parallel.
+  static std::mutex _standardPluginContextMutex;
 };
+
+void wrapper_log(PluginInstance *vst, LogLevel level, const char *format, ...);
+// Re-queues a record logged in a sandbox worker under `vst`'s tag.
+void forward_log_record(PluginInstance *vst, const LogRecordFFI &record);
+
+const char *alloc_string(const char *str);
+
+// Raises the calling thread to real-time priority, logging on failure.
+void set_realtime_priority();
+
+void vst3_set_sample_rate(const void *app, int32_t rate);